@@ -0,0 +1,8 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+
+void board_init(void);
+uint32_t board_millis(void);
+void board_led_write(bool state);
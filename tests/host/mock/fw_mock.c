@@ -0,0 +1,28 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "error.h"
+
+/*
+    Firmware functions from modules that aren't built for the host (the FAT filesystem)
+
+    LOG.TXT goes to stdout when HOST_TEST_LOG is set
+*/
+
+struct fat_filesystem *get_filesystem(void)
+{
+    return NULL;
+}
+
+int print_err_file(struct fat_filesystem *fs, const char *fmt, ...)
+{
+    static int enabled = -1;
+    if (enabled < 0) enabled = getenv("HOST_TEST_LOG") != NULL;
+    if (!enabled) return 0;
+
+    va_list args;
+    va_start(args, fmt);
+    int rtn = vprintf(fmt, args);
+    va_end(args);
+    return rtn;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include "pico/types.h"
+
+// everything runs from "SRAM" on the host
+#define __not_in_flash(group)
+#define __not_in_flash_func(func_name) func_name
+#define __time_critical_func(func_name) func_name
+
+static inline void tight_loop_contents(void) {}
+void busy_wait_at_least_cycles(uint32_t cycles);
@@ -0,0 +1,8 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef unsigned int uint;
+typedef volatile uint32_t io_rw_32;
+typedef volatile uint32_t io_ro_32;
+typedef volatile uint32_t io_wo_32;
@@ -0,0 +1,1039 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "hardware/spi.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "hardware/sync.h"
+#include "hardware/clocks.h"
+#include "sdk_mock.h"
+
+/*
+    Just enough of the pico-sdk for the flash/FPGA code to run on the host. See sdk_mock.h
+*/
+
+static uint64_t TIME_NS = 0;
+static uint32_t VIOLATIONS = 0;
+
+void mock_violation(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "VIOLATION at %lluus: ", (unsigned long long)(TIME_NS / 1000));
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    VIOLATIONS++;
+}
+
+uint32_t mock_violations(void)
+{
+    return VIOLATIONS;
+}
+
+static void mock_fatal(const char *msg, uint32_t n)
+{
+    fprintf(stderr, "FATAL: %s (%u)\n", msg, n);
+    abort();
+}
+
+/*
+    Time
+*/
+
+uint64_t mock_time_ns(void)
+{
+    return TIME_NS;
+}
+
+void mock_advance_ns(uint64_t ns)
+{
+    TIME_NS += ns;
+}
+
+// reading the timer takes a few cycles, so polling loops on it always finish
+#define TIMER_READ_NS 40
+
+uint32_t time_us_32(void)
+{
+    TIME_NS += TIMER_READ_NS;
+    return TIME_NS / 1000;
+}
+
+uint64_t time_us_64(void)
+{
+    TIME_NS += TIMER_READ_NS;
+    return TIME_NS / 1000;
+}
+
+void busy_wait_us_32(uint32_t delay_us)
+{
+    TIME_NS += (uint64_t)delay_us * 1000;
+}
+
+void busy_wait_us(uint64_t delay_us)
+{
+    TIME_NS += delay_us * 1000;
+}
+
+void sleep_us(uint64_t us)
+{
+    TIME_NS += us * 1000;
+}
+
+void sleep_ms(uint32_t ms)
+{
+    TIME_NS += (uint64_t)ms * 1000000;
+}
+
+void busy_wait_at_least_cycles(uint32_t cycles)
+{
+    TIME_NS += (uint64_t)cycles * 1000000000 / MOCK_CLK_SYS_HZ;
+}
+
+uint32_t board_millis(void)
+{
+    return TIME_NS / 1000000;
+}
+
+void board_led_write(bool state)
+{
+}
+
+uint32_t clock_get_hz(enum clock_index clk_index)
+{
+    return (clk_index == clk_peri) ? MOCK_CLK_PERI_HZ : MOCK_CLK_SYS_HZ;
+}
+
+/*
+    GPIO
+*/
+
+#define NUM_GPIOS 30
+
+struct mock_gpio {
+    enum gpio_function fn;
+    uint8_t out;
+    uint8_t dir;
+    int8_t level; // last level the watcher was told about
+    mock_gpio_watch_fn watch;
+    void *watch_ctx;
+    mock_gpio_input_fn input;
+    void *input_ctx;
+};
+
+static struct mock_gpio GPIOS[NUM_GPIOS];
+
+static struct mock_gpio *gpio_pin(uint gpio)
+{
+    if (gpio >= NUM_GPIOS) mock_fatal("bad GPIO", gpio);
+    return &GPIOS[gpio];
+}
+
+int mock_gpio_level(uint pin)
+{
+    struct mock_gpio *g = gpio_pin(pin);
+    if ((g->fn == GPIO_FUNC_SIO) && g->dir) return g->out;
+    if (g->input) return g->input(g->input_ctx, pin);
+    return 1;
+}
+
+static void gpio_changed(uint pin)
+{
+    struct mock_gpio *g = gpio_pin(pin);
+    int level = mock_gpio_level(pin);
+    if (level == g->level) return;
+    g->level = level;
+    if (g->watch) g->watch(g->watch_ctx, pin, level);
+}
+
+void mock_gpio_watch(uint pin, mock_gpio_watch_fn fn, void *ctx)
+{
+    struct mock_gpio *g = gpio_pin(pin);
+    g->watch = fn;
+    g->watch_ctx = ctx;
+    g->level = mock_gpio_level(pin);
+}
+
+void mock_gpio_input(uint pin, mock_gpio_input_fn fn, void *ctx)
+{
+    gpio_pin(pin)->input = fn;
+    gpio_pin(pin)->input_ctx = ctx;
+}
+
+void gpio_init(uint gpio)
+{
+    struct mock_gpio *g = gpio_pin(gpio);
+    g->dir = 0;
+    g->out = 0;
+    g->fn = GPIO_FUNC_SIO;
+    gpio_changed(gpio);
+}
+
+void gpio_set_dir(uint gpio, bool out)
+{
+    gpio_pin(gpio)->dir = out;
+    gpio_changed(gpio);
+}
+
+void gpio_put(uint gpio, bool value)
+{
+    gpio_pin(gpio)->out = value;
+    gpio_changed(gpio);
+}
+
+bool gpio_get(uint gpio)
+{
+    struct mock_gpio *g = gpio_pin(gpio);
+    if (g->input) return g->input(g->input_ctx, gpio);
+    return mock_gpio_level(gpio);
+}
+
+void gpio_set_function(uint gpio, enum gpio_function fn)
+{
+    gpio_pin(gpio)->fn = fn;
+    gpio_changed(gpio);
+}
+
+enum gpio_function gpio_get_function(uint gpio)
+{
+    return gpio_pin(gpio)->fn;
+}
+
+/*
+    Interrupts
+*/
+
+#define NUM_IRQS 32
+#define MAX_SHARED_HANDLERS 4
+
+static irq_handler_t IRQ_HANDLERS[NUM_IRQS][MAX_SHARED_HANDLERS];
+static uint32_t IRQ_ENABLED = 0;
+static int IRQS_DISABLED = 0;
+static int IN_IRQ = 0;
+
+static int irq_line(uint num);
+
+/*
+    Run handlers for any asserted IRQ lines, unless interrupts are off or we're already in one
+*/
+static void irq_dispatch(void)
+{
+    if (IRQS_DISABLED || IN_IRQ) return;
+    IN_IRQ = 1;
+    for (uint32_t spins = 0; ; spins++) {
+        int ran = 0;
+        for (uint num = 0; num < NUM_IRQS; num++) {
+            if (!(IRQ_ENABLED & (1u << num)) || !irq_line(num)) continue;
+            for (int i = 0; i < MAX_SHARED_HANDLERS; i++) {
+                if (IRQ_HANDLERS[num][i]) IRQ_HANDLERS[num][i]();
+            }
+            ran = 1;
+        }
+        if (!ran) break;
+        if (spins > 1000) mock_fatal("IRQ never acknowledged", spins);
+    }
+    IN_IRQ = 0;
+}
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler)
+{
+    IRQ_HANDLERS[num][0] = handler;
+}
+
+void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t order_priority)
+{
+    for (int i = 0; i < MAX_SHARED_HANDLERS; i++) {
+        if (IRQ_HANDLERS[num][i] == handler) return;
+        if (!IRQ_HANDLERS[num][i]) {
+            IRQ_HANDLERS[num][i] = handler;
+            return;
+        }
+    }
+    mock_fatal("too many shared handlers", num);
+}
+
+void irq_set_enabled(uint num, bool enabled)
+{
+    if (enabled) {
+        IRQ_ENABLED |= 1u << num;
+    } else {
+        IRQ_ENABLED &= ~(1u << num);
+    }
+    irq_dispatch();
+}
+
+uint32_t save_and_disable_interrupts(void)
+{
+    uint32_t state = IRQS_DISABLED;
+    IRQS_DISABLED = 1;
+    return state;
+}
+
+void restore_interrupts(uint32_t status)
+{
+    IRQS_DISABLED = status;
+    irq_dispatch();
+}
+
+/*
+    SPI. Both FIFOs are 8 deep, like the PL022. Bytes are exchanged with the attached device as
+    soon as they're written
+*/
+
+#define SPI_FIFO_DEPTH 8
+
+struct spi_inst {
+    spi_hw_t hw;
+    uint32_t baud;
+    uint8_t rx[SPI_FIFO_DEPTH];
+    uint8_t rx_count;
+    mock_spi_xfer_fn xfer;
+    void *ctx;
+};
+
+spi_inst_t mock_spi0, mock_spi1;
+
+void mock_spi_attach(spi_inst_t *spi, mock_spi_xfer_fn xfer, void *ctx)
+{
+    spi->xfer = xfer;
+    spi->ctx = ctx;
+}
+
+uint32_t mock_spi_baud(const spi_inst_t *spi)
+{
+    return spi->baud;
+}
+
+/*
+    Same divider search as the SDK
+*/
+uint spi_set_baudrate(spi_inst_t *spi, uint baudrate)
+{
+    uint32_t freq_in = MOCK_CLK_PERI_HZ;
+    uint prescale, postdiv;
+
+    for (prescale = 2; prescale <= 254; prescale += 2) {
+        if (freq_in < (prescale + 2) * 256 * (uint64_t)baudrate) break;
+    }
+    if (prescale > 254) mock_fatal("baud too low", baudrate);
+
+    for (postdiv = 256; postdiv > 1; --postdiv) {
+        if (freq_in / (prescale * (postdiv - 1)) > baudrate) break;
+    }
+    spi->baud = freq_in / (prescale * postdiv);
+    return spi->baud;
+}
+
+uint spi_init(spi_inst_t *spi, uint baudrate)
+{
+    spi->rx_count = 0;
+    return spi_set_baudrate(spi, baudrate);
+}
+
+void spi_deinit(spi_inst_t *spi)
+{
+    spi->rx_count = 0;
+}
+
+uint spi_get_baudrate(const spi_inst_t *spi)
+{
+    return spi->baud;
+}
+
+spi_hw_t *spi_get_hw(spi_inst_t *spi)
+{
+    return &spi->hw;
+}
+
+uint spi_get_index(const spi_inst_t *spi)
+{
+    return spi == spi1;
+}
+
+uint spi_get_dreq(spi_inst_t *spi, bool is_tx)
+{
+    return 16 + 2 * spi_get_index(spi) + !is_tx; // DREQ_SPI0_TX
+}
+
+bool spi_is_busy(const spi_inst_t *spi)
+{
+    return false; // every byte is done by the time the write returns
+}
+
+/*
+    Nothing can see the firmware reading DR directly, so the usual drain loop
+    (while (spi_is_readable()) dr;) is taken as reading one byte per check
+*/
+bool spi_is_readable(const spi_inst_t *spi)
+{
+    spi_inst_t *s = (spi_inst_t *)spi;
+    if (!s->rx_count) return false;
+    memmove(s->rx, s->rx + 1, --s->rx_count);
+    return true;
+}
+
+bool spi_is_writable(const spi_inst_t *spi)
+{
+    return true;
+}
+
+static void spi_tx_byte(spi_inst_t *spi, uint8_t out)
+{
+    uint8_t in = spi->xfer ? spi->xfer(spi->ctx, out) : 0xFF;
+    TIME_NS += 8ull * 1000000000 / spi->baud;
+    if (spi->rx_count == SPI_FIFO_DEPTH) {
+        spi->hw.ris |= 1; // receive overrun, byte lost
+        return;
+    }
+    spi->rx[spi->rx_count++] = in;
+}
+
+static uint8_t spi_rx_byte(spi_inst_t *spi)
+{
+    uint8_t in = spi->rx[0];
+    memmove(spi->rx, spi->rx + 1, --spi->rx_count);
+    return in;
+}
+
+int spi_write_read_blocking(spi_inst_t *spi, const uint8_t *src, uint8_t *dst, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        spi_tx_byte(spi, src[i]);
+        dst[i] = spi_rx_byte(spi);
+    }
+    return len;
+}
+
+/*
+    Like the SDK, throws away what comes back and leaves the RX FIFO empty with overrun cleared
+*/
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        spi_tx_byte(spi, src[i]);
+        spi->rx_count = 0;
+    }
+    spi->rx_count = 0;
+    spi->hw.ris &= ~1u;
+    return len;
+}
+
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        spi_tx_byte(spi, repeated_tx_data);
+        dst[i] = spi_rx_byte(spi);
+    }
+    return len;
+}
+
+/*
+    PIO. Only the two programs in qspi_flash.pio are modelled, told apart by their shift
+    config: the write program autopulls, the read program autopushes and pulls its count
+*/
+
+#define NUM_SMS 4
+
+// GPIO of each nibble bit, as wired on the board
+static const uint8_t QUAD_PINS[4] = {3, 0, 4, 5};
+#define QUAD_CLK_PIN 2
+
+struct mock_sm {
+    uint8_t claimed;
+    uint8_t enabled;
+    uint8_t autopull;
+    uint8_t autopush;
+    float clkdiv;
+    uint32_t nibbles; // left to read
+    uint32_t noise; // xorshift, for what CLK is sampled as
+};
+
+struct mock_pio {
+    pio_hw_t *hw;
+    struct mock_sm sm[NUM_SMS];
+    uint32_t pindirs;
+    uint32_t next_offset;
+};
+
+pio_hw_t mock_pio0, mock_pio1;
+static struct mock_pio PIOS[2] = {{&mock_pio0}, {&mock_pio1}};
+static mock_quad_write_fn QUAD_WRITE;
+static mock_quad_read_fn QUAD_READ;
+static void *QUAD_CTX;
+
+void mock_quad_attach(mock_quad_write_fn write, mock_quad_read_fn read, void *ctx)
+{
+    QUAD_WRITE = write;
+    QUAD_READ = read;
+    QUAD_CTX = ctx;
+}
+
+static struct mock_pio *mock_pio_get(PIO pio)
+{
+    return &PIOS[pio == pio1];
+}
+
+static struct mock_sm *mock_sm_get(PIO pio, uint sm)
+{
+    if (sm >= NUM_SMS) mock_fatal("bad SM", sm);
+    return &mock_pio_get(pio)->sm[sm];
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program)
+{
+    struct mock_pio *p = mock_pio_get(pio);
+    uint offset = p->next_offset;
+    p->next_offset += program->length;
+    return offset;
+}
+
+int pio_claim_unused_sm(PIO pio, bool required)
+{
+    struct mock_pio *p = mock_pio_get(pio);
+    for (int i = 0; i < NUM_SMS; i++) {
+        if (p->sm[i].claimed) continue;
+        p->sm[i].claimed = 1;
+        return i;
+    }
+    if (required) mock_fatal("no free SM", 0);
+    return -1;
+}
+
+#define SHIFTCTRL_AUTOPUSH (1u << 16)
+#define SHIFTCTRL_AUTOPULL (1u << 17)
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config)
+{
+    struct mock_sm *s = mock_sm_get(pio, sm);
+    s->enabled = 0;
+    s->autopull = !!(config->shiftctrl & SHIFTCTRL_AUTOPULL);
+    s->autopush = !!(config->shiftctrl & SHIFTCTRL_AUTOPUSH);
+    s->clkdiv = 1.0f;
+    s->nibbles = 0;
+    s->noise = 0x12345678 + sm;
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled)
+{
+    struct mock_sm *s = mock_sm_get(pio, sm);
+    if (!enabled && s->nibbles) mock_violation("read SM stopped with %u nibbles left", s->nibbles);
+    s->enabled = enabled;
+}
+
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t pin_dirs, uint32_t pin_mask)
+{
+    struct mock_pio *p = mock_pio_get(pio);
+    p->pindirs = (p->pindirs & ~pin_mask) | (pin_dirs & pin_mask);
+}
+
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask)
+{
+}
+
+void pio_sm_set_clkdiv(PIO pio, uint sm, float div)
+{
+    mock_sm_get(pio, sm)->clkdiv = div;
+}
+
+void pio_gpio_init(PIO pio, uint pin)
+{
+    gpio_set_function(pin, (pio == pio1) ? GPIO_FUNC_PIO1 : GPIO_FUNC_PIO0);
+}
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx)
+{
+    return ((pio == pio1) ? 8 : 0) + (is_tx ? 0 : 4) + sm;
+}
+
+pio_sm_config pio_get_default_sm_config(void)
+{
+    pio_sm_config c = {0};
+    return c;
+}
+
+void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count)
+{
+}
+
+void sm_config_set_in_pins(pio_sm_config *c, uint in_base)
+{
+}
+
+void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base)
+{
+}
+
+void sm_config_set_out_shift(pio_sm_config *c, bool shift_right, bool autopull, uint pull_threshold)
+{
+    c->shiftctrl = (c->shiftctrl & ~SHIFTCTRL_AUTOPULL) | (autopull ? SHIFTCTRL_AUTOPULL : 0);
+}
+
+void sm_config_set_in_shift(pio_sm_config *c, bool shift_right, bool autopush, uint push_threshold)
+{
+    c->shiftctrl = (c->shiftctrl & ~SHIFTCTRL_AUTOPUSH) | (autopush ? SHIFTCTRL_AUTOPUSH : 0);
+}
+
+void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join)
+{
+}
+
+static uint32_t quad_baud(struct mock_sm *s, uint32_t cycles_per_clk)
+{
+    return MOCK_CLK_SYS_HZ / (s->clkdiv * cycles_per_clk);
+}
+
+static int quad_pins_ok(PIO pio, int is_out)
+{
+    uint32_t data_mask = 0;
+    for (int i = 0; i < 4; i++) {
+        if (gpio_get_function(QUAD_PINS[i]) != GPIO_FUNC_PIO0) return 0;
+        data_mask |= 1u << QUAD_PINS[i];
+    }
+    if (gpio_get_function(QUAD_CLK_PIN) != GPIO_FUNC_PIO0) return 0;
+    return (mock_pio_get(pio)->pindirs & data_mask) == (is_out ? data_mask : 0);
+}
+
+static uint8_t symbol_to_nibble(uint32_t sym)
+{
+    uint8_t nibble = 0;
+    for (int i = 0; i < 4; i++) nibble |= ((sym >> QUAD_PINS[i]) & 1) << i;
+    return nibble;
+}
+
+static uint32_t nibble_to_symbol(uint8_t nibble)
+{
+    uint32_t sym = 0;
+    for (int i = 0; i < 4; i++) sym |= ((nibble >> i) & 1u) << QUAD_PINS[i];
+    return sym;
+}
+
+/*
+    A word into the write SM: one byte, as two symbols in bits 31:26 and 23:18
+*/
+static void pio_tx_word(PIO pio, uint sm, uint32_t word)
+{
+    struct mock_sm *s = mock_sm_get(pio, sm);
+    if (!s->enabled || !s->autopull) {
+        mock_violation("PIO TX to SM %u, which isn't running the write program", sm);
+        return;
+    }
+    if (!quad_pins_ok(pio, 1)) mock_violation("quad write without the data pins on the PIO");
+
+    uint8_t byte = (symbol_to_nibble(word >> 26) << 4) | symbol_to_nibble(word >> 18);
+    uint32_t baud = quad_baud(s, 2);
+    TIME_NS += 2ull * 1000000000 / baud;
+    if (QUAD_WRITE) QUAD_WRITE(QUAD_CTX, byte, baud);
+}
+
+static int pio_rx_ready(PIO pio, uint sm)
+{
+    return mock_sm_get(pio, sm)->nibbles >= 2;
+}
+
+/*
+    A word out of the read SM: one byte, as two symbols in bits 13:8 and 5:0. CS (GPIO 1) is
+    low for the whole read, and CLK (GPIO 2) is sampled as whatever it happens to be
+*/
+static uint32_t pio_rx_word(PIO pio, uint sm)
+{
+    struct mock_sm *s = mock_sm_get(pio, sm);
+    if (!pio_rx_ready(pio, sm)) mock_fatal("PIO RX read with nothing to read", sm);
+    if (!quad_pins_ok(pio, 0)) mock_violation("quad read without the data pins on the PIO");
+
+    uint32_t baud = quad_baud(s, 3);
+    uint8_t byte = QUAD_READ ? QUAD_READ(QUAD_CTX, baud) : 0xFF;
+    uint32_t sym[2];
+    for (int i = 0; i < 2; i++) {
+        s->noise ^= s->noise << 13;
+        s->noise ^= s->noise >> 17;
+        s->noise ^= s->noise << 5;
+        sym[i] = nibble_to_symbol(byte >> (4 - 4 * i)) | (s->noise & (1u << QUAD_CLK_PIN));
+    }
+    s->nibbles -= 2;
+    TIME_NS += 2ull * 1000000000 / baud;
+    return (sym[0] << 8) | sym[1];
+}
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data)
+{
+    struct mock_sm *s = mock_sm_get(pio, sm);
+    if (s->autopull) {
+        pio_tx_word(pio, sm, data);
+        return;
+    }
+    if (!s->enabled) mock_violation("count written to stopped read SM %u", sm);
+    if (s->nibbles) mock_violation("count written to read SM %u mid read", sm);
+    s->nibbles = data + 1;
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data)
+{
+    pio_sm_put(pio, sm, data);
+}
+
+uint32_t pio_sm_get(PIO pio, uint sm)
+{
+    return pio_rx_word(pio, sm);
+}
+
+uint32_t pio_sm_get_blocking(PIO pio, uint sm)
+{
+    return pio_rx_word(pio, sm);
+}
+
+void pio_sm_clear_fifos(PIO pio, uint sm)
+{
+    mock_sm_get(pio, sm)->nibbles = 0;
+}
+
+/*
+    DMA
+*/
+
+#define CTRL_DATA_SIZE_LSB 2
+#define CTRL_INCR_READ (1u << 4)
+#define CTRL_INCR_WRITE (1u << 5)
+#define CTRL_TREQ_LSB 15
+#define CTRL_IRQ_QUIET (1u << 21)
+#define CTRL_BSWAP (1u << 22)
+#define CTRL_SNIFF_EN (1u << 23)
+
+struct mock_dma_channel {
+    uint8_t claimed;
+    uint8_t busy;
+    uint32_t ctrl;
+    volatile void *write_addr;
+    const volatile void *read_addr;
+    uint32_t count;
+};
+
+static struct mock_dma_channel DMA_CH[NUM_DMA_CHANNELS];
+static dma_hw_t DMA_HW;
+dma_hw_t *dma_hw = &DMA_HW;
+static int SNIFF_CHANNEL = -1;
+
+static int irq_line(uint num)
+{
+    if (num == DMA_IRQ_0) return !!(DMA_HW.ints0 & DMA_HW.inte0);
+    if (num == DMA_IRQ_1) return !!(DMA_HW.ints1 & DMA_HW.inte1);
+    return 0;
+}
+
+static struct mock_dma_channel *dma_ch(uint channel)
+{
+    if (channel >= NUM_DMA_CHANNELS) mock_fatal("bad DMA channel", channel);
+    return &DMA_CH[channel];
+}
+
+int dma_claim_unused_channel(bool required)
+{
+    for (int i = 0; i < NUM_DMA_CHANNELS; i++) {
+        if (DMA_CH[i].claimed) continue;
+        DMA_CH[i].claimed = 1;
+        return i;
+    }
+    if (required) mock_fatal("no free DMA channel", 0);
+    return -1;
+}
+
+void dma_channel_unclaim(uint channel)
+{
+    dma_ch(channel)->claimed = 0;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel)
+{
+    // 32 bit, read increment, unpaced, chained to itself (i.e. not chained)
+    dma_channel_config c = {.ctrl = (DMA_SIZE_32 << CTRL_DATA_SIZE_LSB) | CTRL_INCR_READ | (0x3Fu << CTRL_TREQ_LSB) |
+        (channel << 11) | 1};
+    return c;
+}
+
+static void ctrl_set(dma_channel_config *c, uint32_t bits, bool set)
+{
+    c->ctrl = set ? (c->ctrl | bits) : (c->ctrl & ~bits);
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size)
+{
+    c->ctrl = (c->ctrl & ~(3u << CTRL_DATA_SIZE_LSB)) | ((uint32_t)size << CTRL_DATA_SIZE_LSB);
+}
+
+void channel_config_set_dreq(dma_channel_config *c, uint dreq)
+{
+    c->ctrl = (c->ctrl & ~(0x3Fu << CTRL_TREQ_LSB)) | (dreq << CTRL_TREQ_LSB);
+}
+
+void channel_config_set_read_increment(dma_channel_config *c, bool incr)
+{
+    ctrl_set(c, CTRL_INCR_READ, incr);
+}
+
+void channel_config_set_write_increment(dma_channel_config *c, bool incr)
+{
+    ctrl_set(c, CTRL_INCR_WRITE, incr);
+}
+
+void channel_config_set_chain_to(dma_channel_config *c, uint chain_to)
+{
+    c->ctrl = (c->ctrl & ~(0xFu << 11)) | (chain_to << 11);
+}
+
+void channel_config_set_sniff_enable(dma_channel_config *c, bool sniff_enable)
+{
+    ctrl_set(c, CTRL_SNIFF_EN, sniff_enable);
+}
+
+void channel_config_set_irq_quiet(dma_channel_config *c, bool irq_quiet)
+{
+    ctrl_set(c, CTRL_IRQ_QUIET, irq_quiet);
+}
+
+void channel_config_set_bswap(dma_channel_config *c, bool bswap)
+{
+    ctrl_set(c, CTRL_BSWAP, bswap);
+}
+
+enum dma_endpoint {
+    EP_MEMORY,
+    EP_SPI,
+    EP_PIO_TX,
+    EP_PIO_RX,
+};
+
+static enum dma_endpoint dma_endpoint(const volatile void *addr, spi_inst_t **spi, PIO *pio, uint *sm)
+{
+    spi_inst_t *spis[] = {spi0, spi1};
+    for (int i = 0; i < 2; i++) {
+        if (addr != &spis[i]->hw.dr) continue;
+        *spi = spis[i];
+        return EP_SPI;
+    }
+    for (int i = 0; i < 2; i++) {
+        for (uint j = 0; j < NUM_SMS; j++) {
+            *pio = PIOS[i].hw;
+            *sm = j;
+            if (addr == &PIOS[i].hw->txf[j]) return EP_PIO_TX;
+            if (addr == &PIOS[i].hw->rxf[j]) return EP_PIO_RX;
+        }
+    }
+    return EP_MEMORY;
+}
+
+/*
+    The sniffer's CRC32R mode: CRC-32 polynomial, MSB first, on the bit reversed data
+*/
+static void sniff(uint32_t value, uint32_t size)
+{
+    uint32_t acc = DMA_HW.sniff_data;
+    for (uint32_t i = 0; i < size; i++) {
+        uint8_t b = value >> (8 * i);
+        uint8_t r = 0;
+        for (int j = 0; j < 8; j++) r |= ((b >> j) & 1) << (7 - j);
+        acc ^= (uint32_t)r << 24;
+        for (int j = 0; j < 8; j++) acc = (acc & 0x80000000) ? ((acc << 1) ^ 0x04C11DB7) : (acc << 1);
+    }
+    DMA_HW.sniff_data = acc;
+}
+
+/*
+    Move one element on channel if its source and destination are ready. Returns 0 if it had to wait
+*/
+static int dma_step(uint channel)
+{
+    struct mock_dma_channel *ch = dma_ch(channel);
+    uint32_t size = 1u << ((ch->ctrl >> CTRL_DATA_SIZE_LSB) & 3);
+    spi_inst_t *spi = NULL;
+    PIO pio = NULL;
+    uint sm = 0;
+    uint32_t value = 0;
+
+    switch (dma_endpoint(ch->read_addr, &spi, &pio, &sm)) {
+        case EP_SPI:
+            if (!spi->rx_count) return 0;
+            value = spi_rx_byte(spi);
+            break;
+        case EP_PIO_RX:
+            if (!pio_rx_ready(pio, sm)) return 0;
+            value = pio_rx_word(pio, sm);
+            break;
+        case EP_PIO_TX:
+            mock_fatal("DMA read from a TX FIFO", channel);
+            break;
+        default:
+            memcpy(&value, (const void *)ch->read_addr, size);
+            break;
+    }
+    if (size < 4) value &= (1u << (8 * size)) - 1;
+
+    if ((ch->ctrl & CTRL_SNIFF_EN) && (SNIFF_CHANNEL == (int)channel)) sniff(value, size);
+
+    switch (dma_endpoint(ch->write_addr, &spi, &pio, &sm)) {
+        case EP_SPI:
+            spi_tx_byte(spi, value);
+            break;
+        case EP_PIO_TX:
+            // narrow writes are replicated across the bus, as on the real thing
+            if (size == 1) value *= 0x01010101;
+            if (size == 2) value *= 0x00010001;
+            pio_tx_word(pio, sm, value);
+            break;
+        case EP_PIO_RX:
+            mock_fatal("DMA write to an RX FIFO", channel);
+            break;
+        default:
+            memcpy((void *)ch->write_addr, &value, size);
+            break;
+    }
+
+    if (ch->ctrl & CTRL_INCR_READ) ch->read_addr = (const volatile uint8_t *)ch->read_addr + size;
+    if (ch->ctrl & CTRL_INCR_WRITE) ch->write_addr = (volatile uint8_t *)ch->write_addr + size;
+    ch->count--;
+    return 1;
+}
+
+/*
+    Run every busy channel to completion, an element from each in turn
+*/
+static void dma_run(void)
+{
+    for (;;) {
+        int busy = 0, moved = 0;
+        for (uint i = 0; i < NUM_DMA_CHANNELS; i++) {
+            struct mock_dma_channel *ch = &DMA_CH[i];
+            if (!ch->busy) continue;
+            busy = 1;
+            if (ch->count) moved |= dma_step(i);
+            if (ch->count) continue;
+
+            ch->busy = 0;
+            moved = 1;
+            if (!(ch->ctrl & CTRL_IRQ_QUIET)) {
+                DMA_HW.ints0 |= 1u << i;
+                DMA_HW.ints1 |= 1u << i;
+            }
+        }
+        if (!busy) break;
+        if (!moved) {
+            for (uint i = 0; i < NUM_DMA_CHANNELS; i++) {
+                if (DMA_CH[i].busy) mock_fatal("DMA channel stalled waiting on its DREQ", i);
+            }
+        }
+    }
+    irq_dispatch();
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+    const volatile void *read_addr, uint transfer_count, bool trigger)
+{
+    struct mock_dma_channel *ch = dma_ch(channel);
+    if (ch->busy) mock_violation("DMA channel %u reconfigured while busy", channel);
+    ch->ctrl = config->ctrl;
+    ch->write_addr = write_addr;
+    ch->read_addr = read_addr;
+    ch->count = transfer_count;
+    if (trigger) dma_channel_start(channel);
+}
+
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger)
+{
+    dma_ch(channel)->read_addr = read_addr;
+    if (trigger) dma_channel_start(channel);
+}
+
+void dma_channel_set_write_addr(uint channel, volatile void *write_addr, bool trigger)
+{
+    dma_ch(channel)->write_addr = write_addr;
+    if (trigger) dma_channel_start(channel);
+}
+
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger)
+{
+    dma_ch(channel)->count = trans_count;
+    if (trigger) dma_channel_start(channel);
+}
+
+void dma_start_channel_mask(uint32_t chan_mask)
+{
+    for (uint i = 0; i < NUM_DMA_CHANNELS; i++) {
+        if (chan_mask & (1u << i)) dma_ch(i)->busy = 1;
+    }
+    dma_run();
+}
+
+void dma_channel_start(uint channel)
+{
+    dma_start_channel_mask(1u << channel);
+}
+
+void dma_channel_abort(uint channel)
+{
+    dma_ch(channel)->busy = 0;
+}
+
+bool dma_channel_is_busy(uint channel)
+{
+    return dma_ch(channel)->busy;
+}
+
+void dma_channel_wait_for_finish_blocking(uint channel)
+{
+    if (dma_ch(channel)->busy) mock_fatal("waiting on a stalled DMA channel", channel);
+}
+
+void dma_channel_set_irq0_enabled(uint channel, bool enabled)
+{
+    DMA_HW.inte0 = enabled ? (DMA_HW.inte0 | (1u << channel)) : (DMA_HW.inte0 & ~(1u << channel));
+}
+
+void dma_channel_set_irq1_enabled(uint channel, bool enabled)
+{
+    DMA_HW.inte1 = enabled ? (DMA_HW.inte1 | (1u << channel)) : (DMA_HW.inte1 & ~(1u << channel));
+}
+
+bool dma_channel_get_irq0_status(uint channel)
+{
+    return DMA_HW.ints0 & DMA_HW.inte0 & (1u << channel);
+}
+
+bool dma_channel_get_irq1_status(uint channel)
+{
+    return DMA_HW.ints1 & DMA_HW.inte1 & (1u << channel);
+}
+
+void dma_channel_acknowledge_irq0(uint channel)
+{
+    DMA_HW.ints0 &= ~(1u << channel);
+}
+
+void dma_channel_acknowledge_irq1(uint channel)
+{
+    DMA_HW.ints1 &= ~(1u << channel);
+}
+
+void dma_sniffer_enable(uint channel, uint mode, bool force_channel_enable)
+{
+    if (mode != DMA_SNIFF_CTRL_CALC_VALUE_CRC32R) mock_fatal("sniffer mode not modelled", mode);
+    if (SNIFF_CHANNEL >= 0) mock_violation("sniffer enabled on %u while still on %d", channel, SNIFF_CHANNEL);
+    SNIFF_CHANNEL = channel;
+}
+
+void dma_sniffer_disable(void)
+{
+    SNIFF_CHANNEL = -1;
+}
+
+void dma_sniffer_set_data_accumulator(uint32_t seed_value)
+{
+    DMA_HW.sniff_data = seed_value;
+}
+
+uint32_t dma_sniffer_get_data_accumulator(void)
+{
+    return DMA_HW.sniff_data;
+}
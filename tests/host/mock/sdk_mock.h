@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include "pico/types.h"
+#include "hardware/spi.h"
+
+/*
+    Test side of the host SDK mock
+
+    Time is virtual: it only moves when the firmware waits, reads the clock or clocks data
+    over a bus, so tests are deterministic and benchmarks measure bus time rather than host
+    speed. DMA transfers run to completion as soon as they're started, with the channels
+    interleaved element by element (like DREQ pacing), and completion IRQs are dispatched
+    straight away unless interrupts are disabled.
+
+    Devices hook onto the buses below. Anything the firmware does that would break on the
+    real hardware is reported through mock_violation()
+*/
+
+#define MOCK_CLK_SYS_HZ 125000000
+#define MOCK_CLK_PERI_HZ 125000000
+
+uint64_t mock_time_ns(void);
+void mock_advance_ns(uint64_t ns);
+
+/*
+    A device on a hardware SPI. Called with each byte clocked out, returns the byte clocked in
+*/
+typedef uint8_t (*mock_spi_xfer_fn)(void *ctx, uint8_t out);
+void mock_spi_attach(spi_inst_t *spi, mock_spi_xfer_fn xfer, void *ctx);
+uint32_t mock_spi_baud(const spi_inst_t *spi);
+
+/*
+    A device on the PIO quad data pins (GPIO 0 and 3-5, see qspi_flash.pio). Bytes are already
+    put back together from the nibbles. baud is the PIO's SPI clock
+*/
+typedef void (*mock_quad_write_fn)(void *ctx, uint8_t byte, uint32_t baud);
+typedef uint8_t (*mock_quad_read_fn)(void *ctx, uint32_t baud);
+void mock_quad_attach(mock_quad_write_fn write, mock_quad_read_fn read, void *ctx);
+
+/*
+    Called whenever the level on pin changes. Pins that aren't driven read as high (pulled up)
+*/
+typedef void (*mock_gpio_watch_fn)(void *ctx, uint pin, int level);
+void mock_gpio_watch(uint pin, mock_gpio_watch_fn fn, void *ctx);
+int mock_gpio_level(uint pin);
+
+/*
+    Level an input pin reads as, for pins driven by a device
+*/
+typedef int (*mock_gpio_input_fn)(void *ctx, uint pin);
+void mock_gpio_input(uint pin, mock_gpio_input_fn fn, void *ctx);
+
+void mock_violation(const char *fmt, ...);
+uint32_t mock_violations(void);
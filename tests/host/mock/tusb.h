@@ -0,0 +1,6 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+void tud_task(void);
+bool tud_mounted(void);
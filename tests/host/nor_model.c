@@ -0,0 +1,464 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sdk_mock.h"
+#include "hardware/gpio.h"
+#include "nor_model.h"
+
+/*
+    W25Q256JV style SFDP: header, basic flash parameter table (16 dwords at 0x80) and the
+    4 byte address instruction table (at 0xD0)
+*/
+const uint8_t NOR_W25Q256_SFDP[] = {
+    [0x00] = 'S', 'F', 'D', 'P', 0x06, 0x01, 0x01, 0xFF,
+    [0x08] = 0x00, 0x06, 0x01, 0x10, 0x80, 0x00, 0x00, 0xFF,
+    [0x10] = 0x84, 0x00, 0x01, 0x02, 0xD0, 0x00, 0x00, 0xFF,
+    [0x18 ... 0x7F] = 0xFF,
+    [0x80] = 0xE5, 0x20, 0xF3, 0xFF, // 4k erase 0x20, 3 or 4 byte address, 1-1-4
+             0xFF, 0xFF, 0xFF, 0x0F, // 256Mbit
+             0x44, 0xEB, 0x08, 0x6B, // 1-1-4: 8 clocks, 0x6B
+             0x08, 0x3B, 0x42, 0xBB,
+             0xFE, 0xFF, 0xFF, 0xFF,
+             0xFF, 0xFF, 0x00, 0x00,
+             0xFF, 0xFF, 0x40, 0xEB,
+             0x0C, 0x20, 0x0F, 0x52, // 4k 0x20, 32k 0x52
+             0x10, 0xD8, 0x00, 0x00, // 64k 0xD8
+             0x36, 0x02, 0xA6, 0x00, // erase times
+             0x82, 0xEA, 0x14, 0xC9, // 256 byte page, chip erase time
+             0xE9, 0x63, 0x76, 0x33, // suspend supported, latency and resume interval
+             0x7A, 0x75, 0x7A, 0x75, // suspend 0x75, resume 0x7A
+             0xF7, 0xA2, 0xD5, 0x5C,
+             0x19, 0xF7, 0x4D, 0xFF, // QER 4
+             0xE9, 0x70, 0xF9, 0xA5,
+    [0xD0] = 0xFB, 0x0F, 0xFF, 0xFF,
+             0x21, 0xDC, 0x5C, 0xDC,
+};
+const uint32_t NOR_W25Q256_SFDP_LEN = sizeof(NOR_W25Q256_SFDP);
+
+enum nor_kind {
+    NOR_UNKNOWN,
+    NOR_READ,
+    NOR_READ_QUAD,
+    NOR_PROGRAM,
+    NOR_PROGRAM_QUAD,
+    NOR_ERASE,
+    NOR_STATUS1,
+    NOR_STATUS2,
+    NOR_STATUS3,
+    NOR_WREN,
+    NOR_WRDI,
+    NOR_VWREN,
+    NOR_WRSR1,
+    NOR_WRSR2,
+    NOR_JEDEC,
+    NOR_SFDP,
+    NOR_SUSPEND,
+    NOR_RESUME,
+    NOR_WR_EXT,
+    NOR_RD_EXT,
+    NOR_IGNORED, // accepted, but nothing to model
+};
+
+struct nor_cmd {
+    uint8_t opcode;
+    uint8_t kind;
+    uint8_t addr_len;
+    uint8_t dummy;
+    uint8_t erase; // enum nor_erase, for NOR_ERASE
+};
+
+static const struct nor_cmd NOR_CMDS[] = {
+    {0x03, NOR_READ, 3, 0},
+    {0x13, NOR_READ, 4, 0},
+    {0x0B, NOR_READ, 3, 1},
+    {0x0C, NOR_READ, 4, 1},
+    {0x6B, NOR_READ_QUAD, 3, 1},
+    {0x6C, NOR_READ_QUAD, 4, 1},
+    {0x02, NOR_PROGRAM, 3, 0},
+    {0x12, NOR_PROGRAM, 4, 0},
+    {0x32, NOR_PROGRAM_QUAD, 3, 0},
+    {0x34, NOR_PROGRAM_QUAD, 4, 0},
+    {0x20, NOR_ERASE, 3, 0, NOR_ERASE_4K},
+    {0x21, NOR_ERASE, 4, 0, NOR_ERASE_4K},
+    {0x52, NOR_ERASE, 3, 0, NOR_ERASE_32K},
+    {0xD8, NOR_ERASE, 3, 0, NOR_ERASE_64K},
+    {0xDC, NOR_ERASE, 4, 0, NOR_ERASE_64K},
+    {0xC7, NOR_ERASE, 0, 0, NOR_ERASE_CHIP},
+    {0x05, NOR_STATUS1, 0, 0},
+    {0x35, NOR_STATUS2, 0, 0},
+    {0x15, NOR_STATUS3, 0, 0},
+    {0x06, NOR_WREN, 0, 0},
+    {0x04, NOR_WRDI, 0, 0},
+    {0x50, NOR_VWREN, 0, 0},
+    {0x01, NOR_WRSR1, 0, 0},
+    {0x31, NOR_WRSR2, 0, 0},
+    {0x9F, NOR_JEDEC, 0, 0},
+    {0x5A, NOR_SFDP, 3, 1},
+    {0x75, NOR_SUSPEND, 0, 0},
+    {0x7A, NOR_RESUME, 0, 0},
+    {0xC5, NOR_WR_EXT, 0, 0},
+    {0xC8, NOR_RD_EXT, 0, 0},
+    {0x90, NOR_IGNORED, 0, 0},
+    {0xB7, NOR_IGNORED, 0, 0},
+    {0xE9, NOR_IGNORED, 0, 0},
+};
+
+static const uint32_t NOR_ERASE_SIZES[NOR_ERASE_NUM] = {0x1000, 0x8000, 0x10000, NOR_SIZE};
+
+#define NOR_SR2_QE 0x02
+#define NOR_SR2_SUS 0x80
+
+// firmware flash D2/D3, which have to be held high for single bit SPI
+#define NOR_FW_W_PIN 4
+#define NOR_FW_HOLD_PIN 5
+
+struct nor_chip NOR_BITSTREAM;
+struct nor_chip NOR_FIRMWARE;
+
+static const struct nor_cmd *nor_cmd(uint8_t opcode)
+{
+    static const struct nor_cmd unknown = {0, NOR_UNKNOWN};
+    for (uint32_t i = 0; i < sizeof(NOR_CMDS) / sizeof(NOR_CMDS[0]); i++) {
+        if (NOR_CMDS[i].opcode == opcode) return &NOR_CMDS[i];
+    }
+    return &unknown;
+}
+
+static const char *nor_name(struct nor_chip *chip)
+{
+    return (chip == &NOR_FIRMWARE) ? "firmware flash" : "bitstream flash";
+}
+
+/*
+    Finish off an erase whose time is up
+*/
+static void nor_update(struct nor_chip *chip)
+{
+    if (chip->erasing && !chip->suspended && (mock_time_ns() >= chip->busy_until_ns)) chip->erasing = 0;
+}
+
+int nor_is_busy(struct nor_chip *chip)
+{
+    nor_update(chip);
+    return mock_time_ns() < chip->busy_until_ns;
+}
+
+void nor_reset_stats(struct nor_chip *chip)
+{
+    memset(&chip->stats, 0x00, sizeof(chip->stats));
+}
+
+static uint8_t nor_corrupt(struct nor_chip *chip, uint8_t byte, uint32_t baud)
+{
+    if (!chip->max_baud || (baud <= chip->max_baud)) return byte;
+    if (++chip->error_count % chip->error_interval) return byte;
+    chip->stats.bit_errors++;
+    return byte ^ (1 << (chip->error_count % 8));
+}
+
+static uint32_t nor_header_len(const struct nor_cmd *cmd)
+{
+    return 1 + cmd->addr_len + cmd->dummy;
+}
+
+static void nor_frame_start(struct nor_chip *chip, uint8_t opcode)
+{
+    const struct nor_cmd *cmd = nor_cmd(opcode);
+    int busy = nor_is_busy(chip);
+
+    chip->opcode = opcode;
+    chip->ignore = 0;
+    chip->addr = 0;
+    chip->data_len = 0;
+
+    if (cmd->kind == NOR_UNKNOWN) {
+        mock_violation("%s: unknown command %02X", nor_name(chip), opcode);
+        chip->ignore = 1;
+    } else if (busy && (cmd->kind != NOR_STATUS1) && (cmd->kind != NOR_STATUS2) && (cmd->kind != NOR_STATUS3) &&
+               !((cmd->kind == NOR_SUSPEND) && chip->erasing)) {
+        mock_violation("%s: command %02X while busy", nor_name(chip), opcode);
+        chip->ignore = 1;
+    } else if (((cmd->kind == NOR_READ_QUAD) || (cmd->kind == NOR_PROGRAM_QUAD)) && !(chip->sr2 & NOR_SR2_QE)) {
+        mock_violation("%s: quad command %02X with QE clear", nor_name(chip), opcode);
+        chip->ignore = 1;
+    }
+}
+
+/*
+    Next byte of a read. Reads of a region that's being erased (suspended or not) are undefined
+*/
+static uint8_t nor_read_byte(struct nor_chip *chip, uint32_t baud)
+{
+    uint32_t addr = chip->addr++ % NOR_SIZE;
+    if (chip->erasing && ((addr - chip->erase_addr) < chip->erase_len)) {
+        mock_violation("%s: read of %08X while it's being erased", nor_name(chip), addr);
+    }
+    chip->stats.bytes_read++;
+    return nor_corrupt(chip, chip->mem[addr], baud);
+}
+
+static void nor_write_byte(struct nor_chip *chip, uint8_t byte, uint32_t baud)
+{
+    if (chip->data_len < sizeof(chip->data)) chip->data[chip->data_len] = nor_corrupt(chip, byte, baud);
+    chip->data_len++;
+}
+
+static uint8_t nor_xfer(struct nor_chip *chip, uint8_t out)
+{
+    uint32_t baud = mock_spi_baud(spi0);
+    uint32_t pos = chip->pos++;
+
+    if (!pos) {
+        nor_frame_start(chip, out);
+        return 0xFF;
+    }
+    if (chip->ignore) return 0xFF;
+
+    const struct nor_cmd *cmd = nor_cmd(chip->opcode);
+    if (pos <= cmd->addr_len) {
+        chip->addr = (chip->addr << 8) | out;
+        if ((pos == cmd->addr_len) && (cmd->addr_len == 3) && (cmd->kind != NOR_SFDP)) {
+            chip->addr |= (uint32_t)chip->ext_addr << 24; // top byte of a 3 byte address
+        }
+        return 0xFF;
+    }
+    if (pos < nor_header_len(cmd)) return 0xFF; // dummy
+
+    uint32_t n = pos - nor_header_len(cmd);
+    switch (cmd->kind) {
+        case NOR_READ:
+            return nor_read_byte(chip, baud);
+        case NOR_STATUS1:
+            return (chip->sr1 & 0xFC) | (chip->wel << 1) | nor_is_busy(chip);
+        case NOR_STATUS2:
+            return (chip->sr2 & ~NOR_SR2_SUS) | (chip->suspended ? NOR_SR2_SUS : 0);
+        case NOR_STATUS3:
+            return 0x00;
+        case NOR_JEDEC:
+            return (n < 3) ? (chip->jedec_id >> (16 - 8 * n)) : 0xFF;
+        case NOR_SFDP:
+            return ((chip->addr + n) < chip->sfdp_len) ? chip->sfdp[chip->addr + n] : 0xFF;
+        case NOR_RD_EXT:
+            return chip->ext_addr;
+        case NOR_PROGRAM:
+            nor_write_byte(chip, out, baud);
+            return 0xFF;
+        case NOR_WRSR1: case NOR_WRSR2: case NOR_WR_EXT:
+            nor_write_byte(chip, out, 0);
+            return 0xFF;
+        case NOR_READ_QUAD: case NOR_PROGRAM_QUAD:
+            mock_violation("%s: data for quad command %02X on the SPI", nor_name(chip), chip->opcode);
+            return 0xFF;
+        default:
+            mock_violation("%s: %u extra bytes for command %02X", nor_name(chip), n + 1, chip->opcode);
+            return 0xFF;
+    }
+}
+
+static int nor_take_wel(struct nor_chip *chip)
+{
+    if (!chip->wel) {
+        mock_violation("%s: command %02X without write enable", nor_name(chip), chip->opcode);
+        return 0;
+    }
+    chip->wel = 0;
+    return 1;
+}
+
+static void nor_program(struct nor_chip *chip)
+{
+    uint32_t page = chip->addr & ~(NOR_PAGE_SIZE - 1);
+    uint32_t offset = chip->addr & (NOR_PAGE_SIZE - 1);
+
+    if (!nor_take_wel(chip) || !chip->data_len) return;
+    if ((offset + chip->data_len) > NOR_PAGE_SIZE) {
+        mock_violation("%s: program of %u bytes at %08X crosses a page", nor_name(chip), chip->data_len, chip->addr);
+    }
+    if (chip->erasing && ((page - chip->erase_addr) < chip->erase_len)) {
+        mock_violation("%s: program of %08X while it's being erased", nor_name(chip), chip->addr);
+    }
+    for (uint32_t i = 0; i < chip->data_len; i++) {
+        chip->mem[(page + ((offset + i) % NOR_PAGE_SIZE)) % NOR_SIZE] &= chip->data[i % sizeof(chip->data)];
+    }
+    chip->stats.pages++;
+    chip->busy_until_ns = mock_time_ns() + chip->page_ns;
+}
+
+static void nor_erase(struct nor_chip *chip, enum nor_erase type)
+{
+    if (!nor_take_wel(chip)) return;
+    if (chip->suspended) {
+        mock_violation("%s: erase while another is suspended", nor_name(chip));
+        return;
+    }
+    chip->erase_len = NOR_ERASE_SIZES[type];
+    chip->erase_addr = (chip->addr % NOR_SIZE) & ~(chip->erase_len - 1);
+    memset(chip->mem + chip->erase_addr, 0xFF, chip->erase_len);
+    chip->erasing = 1;
+    chip->busy_until_ns = mock_time_ns() + chip->erase_ns[type];
+    chip->stats.erases[type]++;
+    chip->stats.erase_busy_ns += chip->erase_ns[type];
+}
+
+static void nor_write_status(struct nor_chip *chip, uint8_t *reg, uint8_t value)
+{
+    if (chip->volatile_wel) {
+        chip->volatile_wel = 0;
+    } else if (!nor_take_wel(chip)) {
+        return;
+    }
+    *reg = value;
+}
+
+static void nor_frame_end(struct nor_chip *chip)
+{
+    const struct nor_cmd *cmd = nor_cmd(chip->opcode);
+    uint32_t hdr_len = nor_header_len(cmd);
+
+    if (!chip->pos || chip->ignore) return;
+    if (chip->pos < hdr_len) {
+        mock_violation("%s: command %02X cut short", nor_name(chip), chip->opcode);
+        return;
+    }
+
+    switch (cmd->kind) {
+        case NOR_WREN:
+            chip->wel = 1;
+            break;
+        case NOR_WRDI:
+            chip->wel = 0;
+            break;
+        case NOR_VWREN:
+            chip->volatile_wel = 1;
+            break;
+        case NOR_WRSR1:
+            if (chip->data_len) nor_write_status(chip, &chip->sr1, chip->data[0] & 0xFC);
+            if (chip->data_len > 1) chip->sr2 = chip->data[1];
+            break;
+        case NOR_WRSR2:
+            if (chip->data_len) nor_write_status(chip, &chip->sr2, chip->data[0]);
+            break;
+        case NOR_WR_EXT:
+            if (chip->data_len && nor_take_wel(chip)) chip->ext_addr = chip->data[0];
+            break;
+        case NOR_PROGRAM: case NOR_PROGRAM_QUAD:
+            nor_program(chip);
+            break;
+        case NOR_ERASE:
+            nor_erase(chip, cmd->erase);
+            break;
+        case NOR_SUSPEND:
+            if (!chip->erasing || chip->suspended || !nor_is_busy(chip)) break;
+            chip->erase_left_ns = chip->busy_until_ns - mock_time_ns();
+            chip->suspended = 1;
+            chip->busy_until_ns = mock_time_ns() + chip->suspend_ns;
+            chip->stats.suspends++;
+            break;
+        case NOR_RESUME:
+            if (!chip->suspended) break;
+            chip->suspended = 0;
+            chip->busy_until_ns = mock_time_ns() + chip->erase_left_ns;
+            break;
+        default:
+            break;
+    }
+}
+
+static struct nor_chip *nor_selected(void)
+{
+    if (NOR_BITSTREAM.selected && NOR_FIRMWARE.selected) mock_violation("both flashes selected");
+    if (NOR_BITSTREAM.selected) return &NOR_BITSTREAM;
+    if (NOR_FIRMWARE.selected) return &NOR_FIRMWARE;
+    return NULL;
+}
+
+static uint8_t nor_bus_xfer(void *ctx, uint8_t out)
+{
+    struct nor_chip *chip = nor_selected();
+    if (!chip) {
+        mock_violation("flash SPI byte %02X with no CS", out);
+        return 0xFF;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (gpio_get_function(chip->spi_pins[i]) == GPIO_FUNC_SPI) continue;
+        mock_violation("%s: selected but GPIO %u isn't on the SPI", nor_name(chip), chip->spi_pins[i]);
+        return 0xFF;
+    }
+    if ((chip == &NOR_FIRMWARE) && (!mock_gpio_level(NOR_FW_W_PIN) || !mock_gpio_level(NOR_FW_HOLD_PIN))) {
+        mock_violation("firmware flash: single bit SPI with W#/HOLD# low");
+    }
+    return nor_xfer(chip, out);
+}
+
+static int nor_quad_frame_ok(struct nor_chip *chip, int kind)
+{
+    const struct nor_cmd *cmd = nor_cmd(chip->opcode);
+    if (!chip->selected || chip->ignore || (cmd->kind != kind) || (chip->pos < nor_header_len(cmd))) {
+        mock_violation("%s: quad data outside a quad command", nor_name(chip));
+        return 0;
+    }
+    return 1;
+}
+
+static void nor_quad_write(void *ctx, uint8_t byte, uint32_t baud)
+{
+    struct nor_chip *chip = ctx;
+    if (!nor_quad_frame_ok(chip, NOR_PROGRAM_QUAD)) return;
+    chip->stats.quad_bytes++;
+    nor_write_byte(chip, byte, baud);
+}
+
+static uint8_t nor_quad_read(void *ctx, uint32_t baud)
+{
+    struct nor_chip *chip = ctx;
+    if (!nor_quad_frame_ok(chip, NOR_READ_QUAD)) return 0xFF;
+    chip->stats.quad_bytes++;
+    return nor_read_byte(chip, baud);
+}
+
+static void nor_cs(void *ctx, uint pin, int level)
+{
+    struct nor_chip *chip = ctx;
+    if (!level) {
+        chip->selected = 1;
+        chip->pos = 0;
+        nor_selected();
+    } else if (chip->selected) {
+        chip->selected = 0;
+        nor_frame_end(chip);
+    }
+}
+
+static void nor_chip_init(struct nor_chip *chip, uint8_t cs, uint8_t di, uint8_t d0, uint8_t clk)
+{
+    if (!chip->mem) chip->mem = malloc(NOR_SIZE);
+    memset(chip->mem, 0xFF, NOR_SIZE);
+    chip->cs_pin = cs;
+    chip->spi_pins[0] = di;
+    chip->spi_pins[1] = d0;
+    chip->spi_pins[2] = clk;
+    chip->jedec_id = NOR_JEDEC_ID;
+    chip->sfdp = NOR_W25Q256_SFDP;
+    chip->sfdp_len = NOR_W25Q256_SFDP_LEN;
+
+    // W25Q256JV typicals
+    chip->page_ns = 400000;
+    chip->erase_ns[NOR_ERASE_4K] = 45000000;
+    chip->erase_ns[NOR_ERASE_32K] = 120000000;
+    chip->erase_ns[NOR_ERASE_64K] = 150000000;
+    chip->erase_ns[NOR_ERASE_CHIP] = 80000000000ull;
+    chip->suspend_ns = 20000;
+    chip->error_interval = 1000;
+
+    mock_gpio_watch(cs, nor_cs, chip);
+}
+
+/*
+    Put both flashes on the bus, erased
+*/
+void nor_init(void)
+{
+    nor_chip_init(&NOR_BITSTREAM, 21, 23, 20, 22);
+    nor_chip_init(&NOR_FIRMWARE, 1, 3, 0, 2);
+    mock_spi_attach(spi0, nor_bus_xfer, NULL);
+    mock_quad_attach(nor_quad_write, nor_quad_read, &NOR_FIRMWARE);
+}
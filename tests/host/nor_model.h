@@ -0,0 +1,88 @@
+#pragma once
+#include <stdint.h>
+
+/*
+    W25Q256JV-like NOR flash on the mock SPI bus
+
+    Commands are decoded a byte at a time as the firmware clocks them, and take effect when
+    CS goes high, with busy times for programs and erases. Anything the real chip would ignore
+    or get wrong (commands while busy, missing write enable, programs crossing a page, reading
+    a region under a suspended erase, quad commands with QE clear) is a mock_violation().
+
+    Above max_baud, every error_interval'th data byte (in either direction) gets a bit
+    flipped, to stand in for a board that can't take that clock.
+*/
+
+#define NOR_SIZE (32 * 1024 * 1024)
+#define NOR_PAGE_SIZE 256
+#define NOR_JEDEC_ID 0xEF4019
+
+enum nor_erase {
+    NOR_ERASE_4K,
+    NOR_ERASE_32K,
+    NOR_ERASE_64K,
+    NOR_ERASE_CHIP,
+    NOR_ERASE_NUM
+};
+
+struct nor_stats {
+    uint32_t erases[NOR_ERASE_NUM];
+    uint32_t pages;
+    uint32_t bytes_read;
+    uint32_t quad_bytes; // read or programmed on four lines
+    uint32_t suspends;
+    uint32_t bit_errors;
+    uint64_t erase_busy_ns; // time spent erasing
+};
+
+struct nor_chip {
+    uint8_t *mem;
+    uint8_t cs_pin;
+    uint8_t spi_pins[3]; // DI, DO, CLK, must be on the SPI while selected
+    uint32_t jedec_id;
+    const uint8_t *sfdp;
+    uint32_t sfdp_len;
+
+    // timing, ns
+    uint64_t page_ns;
+    uint64_t erase_ns[NOR_ERASE_NUM];
+    uint64_t suspend_ns;
+
+    uint32_t max_baud; // 0 for no errors at any speed
+    uint32_t error_interval;
+
+    // state
+    uint8_t selected;
+    uint8_t wel;
+    uint8_t volatile_wel;
+    uint8_t sr1;
+    uint8_t sr2;
+    uint8_t ext_addr;
+    uint64_t busy_until_ns;
+    uint8_t erasing;
+    uint8_t suspended;
+    uint32_t erase_addr;
+    uint32_t erase_len;
+    uint64_t erase_left_ns; // while suspended
+
+    // current frame
+    uint8_t opcode;
+    uint8_t ignore; // frame is being ignored (e.g. sent while busy)
+    uint32_t pos; // bytes so far
+    uint32_t addr;
+    uint8_t data[NOR_PAGE_SIZE + 8]; // bytes after the header, for writes
+    uint32_t data_len;
+    uint32_t error_count;
+
+    struct nor_stats stats;
+};
+
+extern const uint8_t NOR_W25Q256_SFDP[];
+extern const uint32_t NOR_W25Q256_SFDP_LEN;
+
+extern struct nor_chip NOR_BITSTREAM;
+extern struct nor_chip NOR_FIRMWARE;
+
+void nor_init(void);
+int nor_is_busy(struct nor_chip *chip);
+void nor_reset_stats(struct nor_chip *chip);
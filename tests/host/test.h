@@ -0,0 +1,58 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+    Minimal checks for the host tests. Each test program returns non-zero if anything failed
+*/
+
+static int TEST_FAILURES = 0;
+
+#define CHECK(COND) do { \
+    if (!(COND)) { \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #COND); \
+        TEST_FAILURES++; \
+    } \
+} while (0)
+
+#define CHECK_EQ(A, B) do { \
+    unsigned long long a_ = (A), b_ = (B); \
+    if (a_ != b_) { \
+        fprintf(stderr, "%s:%d: %s == %s failed (0x%llX != 0x%llX)\n", __FILE__, __LINE__, #A, #B, a_, b_); \
+        TEST_FAILURES++; \
+    } \
+} while (0)
+
+#define RUN_TEST(FN) do { \
+    int failures_ = TEST_FAILURES; \
+    FN(); \
+    printf("%-40s %s\n", #FN, (failures_ == TEST_FAILURES) ? "PASS" : "FAIL"); \
+} while (0)
+
+#define TEST_RESULT() (TEST_FAILURES ? 1 : 0)
+
+/*
+    xorshift32, same as the on-device tests
+*/
+static inline void test_fill(uint8_t *buf, uint32_t len, uint32_t seed)
+{
+    for (uint32_t i = 0; i < len; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        buf[i] = seed;
+    }
+}
+
+/*
+    zlib's crc32(), a bit at a time
+*/
+static inline uint32_t test_crc32(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
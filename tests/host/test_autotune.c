@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "sdk_mock.h"
+#include "nor_model.h"
+#include "flash_util.h"
+#include "fpga_program.h"
+#include "autotune.h"
+#include "flash_fingerprint.h"
+#include "flash_pre_erase.h"
+#include "config.h"
+#include "main.h"
+#include "util.h"
+
+/*
+    SPI speed tuning (autotune.c), with the flash model flipping bits above its max_baud and
+    the FPGA only raising DONE below a set speed
+*/
+
+#define MAX_STEP_NS 50000000 // USB is serviced between steps
+
+struct config_options CONFIG;
+uint8_t TEST_RD_BUF[4096];
+uint32_t FLASH_BITSTREAM_OFFSET[FLASH_PRE_ERASE_SLOTS] = {0, FLASH_SLOT_SIZE, 2 * FLASH_SLOT_SIZE};
+
+static uint32_t FPGA_MAX_BAUD = 0;
+static int FPGA_DONE = 0;
+static uint32_t FPGA_PROGRAMS = 0;
+static uint32_t STARTUP_PROGRAMS = 0;
+
+/*
+    main.c's bitstream handling, with a pretend bitstream in slot 0
+*/
+uint32_t flash_get_bitstream_offset(void)
+{
+    return 0;
+}
+
+uint32_t flash_bitstream_length(uint32_t offset)
+{
+    return FPGA_MAX_BAUD ? 0x40000 : 0;
+}
+
+uint32_t program_bitstream_from_flash(uint32_t offset, uint32_t bs_len)
+{
+    FPGA_PROGRAMS++;
+    FPGA_DONE = CONFIG.fpga_prog_speed <= FPGA_MAX_BAUD;
+    return 0;
+}
+
+void startup_program_bitstream(void)
+{
+    STARTUP_PROGRAMS++;
+}
+
+static void default_speeds(struct config_options *opts)
+{
+    opts->flash_prog_speed = CONF_DEFAULT_FLASH_PROG_SPEED;
+    opts->fpga_prog_speed = CONF_DEFAULT_FPGA_PROG_SPEED;
+}
+
+static int fpga_done_level(void *ctx, uint pin)
+{
+    return FPGA_DONE;
+}
+
+/*
+    Run tuning to the end. Returns the number of steps it took
+*/
+static uint32_t run_tune(void)
+{
+    uint32_t steps = 0;
+    uint64_t max_ns = 0;
+
+    STARTUP_PROGRAMS = 0;
+    autotune_start();
+    for (;;) {
+        uint64_t start_ns = mock_time_ns();
+        int more = autotune_task(&CONFIG);
+        max_ns = max(max_ns, mock_time_ns() - start_ns);
+        steps++;
+        if (!more) break;
+        mock_advance_ns(1000000); // the rest of the main loop
+    }
+    CHECK(max_ns < MAX_STEP_NS);
+    CHECK_EQ(STARTUP_PROGRAMS, 1);
+    return steps;
+}
+
+static void check_record(uint32_t flash_baud, uint32_t fpga_baud)
+{
+    struct autotune_record rec;
+    memcpy(&rec, NOR_BITSTREAM.mem + NOR_SIZE - CONST_4k, sizeof(rec));
+    CHECK_EQ(rec.magic, AUTOTUNE_MAGIC);
+    CHECK_EQ(rec.flash_baud, flash_baud);
+    CHECK_EQ(rec.fpga_baud, fpga_baud);
+
+    struct config_options opts;
+    default_speeds(&opts);
+    autotune_apply(&opts);
+    CHECK_EQ(opts.flash_prog_speed, flash_baud);
+    CHECK_EQ(opts.fpga_prog_speed, fpga_baud);
+}
+
+/*
+    Bit errors from 31.25MHz up: 25MHz passed, but the next one up failed, so one step down
+*/
+static void test_tune_errors(void)
+{
+    default_speeds(&CONFIG);
+    NOR_BITSTREAM.max_baud = 30000000;
+    FPGA_MAX_BAUD = 41700000;
+    nor_reset_stats(&NOR_BITSTREAM);
+    FPGA_PROGRAMS = 0;
+
+    run_tune();
+    printf("flash %uHz (%u bit errors), FPGA %uHz\n", CONFIG.flash_prog_speed, NOR_BITSTREAM.stats.bit_errors,
+        CONFIG.fpga_prog_speed);
+    CHECK(NOR_BITSTREAM.stats.bit_errors);
+
+    // three speeds read and programmed, the failing one only read, then the record
+    uint32_t pattern_pages = AUTOTUNE_PATTERN_LEN / NOR_PAGE_SIZE;
+    CHECK_EQ(NOR_BITSTREAM.stats.pages, 3 * 2 * pattern_pages + pattern_pages + 1);
+    CHECK_EQ(CONFIG.flash_prog_speed, 20000000);
+    CHECK_EQ(CONFIG.fpga_prog_speed, 31250000);
+    CHECK_EQ(FPGA_PROGRAMS, 6); // stops at the first failure
+    check_record(20000000, 31250000);
+}
+
+/*
+    Everything works: the fastest speeds, no margin needed
+*/
+static void test_tune_clean(void)
+{
+    default_speeds(&CONFIG);
+    NOR_BITSTREAM.max_baud = 0;
+    FPGA_MAX_BAUD = 100000000;
+
+    run_tune();
+    CHECK_EQ(CONFIG.flash_prog_speed, 62500000);
+    CHECK_EQ(CONFIG.fpga_prog_speed, 62500000);
+    check_record(62500000, 62500000);
+}
+
+/*
+    Nothing works at all, or there's no bitstream: those speeds are left alone
+*/
+static void test_tune_nothing_passes(void)
+{
+    default_speeds(&CONFIG);
+    uint32_t flash_baud = CONFIG.flash_prog_speed;
+    uint32_t fpga_baud = CONFIG.fpga_prog_speed;
+    NOR_BITSTREAM.max_baud = 1000000;
+    FPGA_MAX_BAUD = 0;
+
+    run_tune();
+    CHECK_EQ(CONFIG.flash_prog_speed, flash_baud);
+    CHECK_EQ(CONFIG.fpga_prog_speed, fpga_baud);
+    NOR_BITSTREAM.max_baud = 0;
+}
+
+/*
+    A slot record that changes while tuning (a program gone astray) means the tuned flash
+    speed isn't trusted
+*/
+static void test_tune_record_changed(void)
+{
+    struct flash_fingerprint fp = {.magic = FLASH_FINGERPRINT_MAGIC, .len = 0x1000};
+    default_speeds(&CONFIG);
+    NOR_BITSTREAM.max_baud = 0;
+    FPGA_MAX_BAUD = 0;
+    spi_flash_select(SPI_FLASH_BITSTREAM, CONF_DEFAULT_FLASH_PROG_SPEED);
+    CHECK_EQ(flash_fingerprint_write(FLASH_BITSTREAM_OFFSET[1], &fp), 0);
+
+    autotune_start();
+    CHECK(autotune_task(&CONFIG));
+    NOR_BITSTREAM.mem[flash_fingerprint_sector(FLASH_BITSTREAM_OFFSET[1])] &= 0x0F; // bits cleared, like a stray program
+    while (autotune_task(&CONFIG)) mock_advance_ns(1000000);
+    CHECK_EQ(CONFIG.flash_prog_speed, AUTOTUNE_SAFE_BAUD);
+    flash_fingerprint_clear(FLASH_BITSTREAM_OFFSET[1]);
+}
+
+int main(void)
+{
+    nor_init();
+    mock_gpio_input(FPGA_DONE_PIN, fpga_done_level, NULL);
+    spi_flash_select(SPI_FLASH_BITSTREAM, CONF_DEFAULT_FLASH_PROG_SPEED);
+
+    RUN_TEST(test_tune_errors);
+    RUN_TEST(test_tune_clean);
+    RUN_TEST(test_tune_nothing_passes);
+    RUN_TEST(test_tune_record_changed);
+
+    CHECK_EQ(mock_violations(), 0);
+    return TEST_RESULT();
+}
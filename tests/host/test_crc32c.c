@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "test.h"
+#include "crc32.h"
+#include "util.h"
+
+/*
+    CRC32C (crc32.c): slicing against a bytewise reference, combining, and throughput
+*/
+
+#define BENCH_LEN (1024 * 1024)
+#define BENCH_REPEAT 64
+
+static uint32_t BYTE_TABLE[256];
+static uint8_t BUF[BENCH_LEN + 8];
+
+static void ref_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; j++) crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+        BYTE_TABLE[i] = crc;
+    }
+}
+
+// one table lookup per byte
+static uint32_t ref_crc32c(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+    crc = ~crc;
+    while (len--) crc = (crc >> 8) ^ BYTE_TABLE[(crc ^ *data++) & 0xFF];
+    return ~crc;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+    RFC 3720 (iSCSI) vectors, and the on-device test_crc() ones
+*/
+static void test_known_answers(void)
+{
+    static const uint32_t seeds[] = {0xDEADBEEF, 0x11223344, 0xF0F0A7A7};
+    static const uint32_t results[] = {0x632C14D2, 0x30B74855, 0x0419985C};
+    uint8_t buf[32];
+
+    CHECK_EQ(crc32c(0, (const uint8_t *)"123456789", 9), 0xE3069283);
+    memset(buf, 0x00, sizeof(buf));
+    CHECK_EQ(crc32c(0, buf, sizeof(buf)), 0x8A9136AA);
+    memset(buf, 0xFF, sizeof(buf));
+    CHECK_EQ(crc32c(0, buf, sizeof(buf)), 0x62A8AB43);
+    for (uint32_t i = 0; i < sizeof(buf); i++) buf[i] = i;
+    CHECK_EQ(crc32c(0, buf, sizeof(buf)), 0x46DD794E);
+    CHECK_EQ(crc32c(0x12345678, buf, 0), 0x12345678);
+
+    for (uint32_t i = 0; i < ARR_LEN(seeds); i++) {
+        // xor_fill_buf() in tests.c: 32 xorshift words
+        uint32_t words[32], state = seeds[i];
+        for (uint32_t j = 0; j < ARR_LEN(words); j++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            words[j] = state;
+        }
+        CHECK_EQ(crc32c(0, (const uint8_t *)words, sizeof(words)), results[i]);
+    }
+}
+
+/*
+    Every alignment and short length, and chained calls, match the bytewise version
+*/
+static void test_matches_bytewise(void)
+{
+    test_fill(BUF, 4096, 3);
+    for (uint32_t offset = 0; offset < 8; offset++) {
+        for (uint32_t len = 0; len <= 600; len++) {
+            uint32_t start = len * 0x9E3779B9;
+            CHECK_EQ(crc32c(start, BUF + offset, len), ref_crc32c(start, BUF + offset, len));
+        }
+    }
+
+    uint32_t crc = 0;
+    uint32_t pos = 0;
+    for (uint32_t len = 1; pos + len < 4096; pos += len, len = len * 3 % 251 + 1) {
+        crc = crc32c(crc, BUF + pos, len);
+    }
+    CHECK_EQ(crc, ref_crc32c(0, BUF, pos));
+}
+
+/*
+    crc32c_combine(crc(A), crc(B), len(B)) == crc(A then B)
+*/
+static void test_combine(void)
+{
+    uint32_t seed = 11;
+    test_fill(BUF, 0x20000, 4);
+    for (int i = 0; i < 2000; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        uint32_t len_a = seed % 0x10000;
+        uint32_t len_b = (i < 10) ? (uint32_t)i : (seed >> 16) % 0x10000;
+
+        uint32_t crc_a = crc32c(0, BUF, len_a);
+        uint32_t crc_b = crc32c(0, BUF + len_a, len_b);
+        CHECK_EQ(crc32c_combine(crc_a, crc_b, len_b), crc32c(0, BUF, len_a + len_b));
+    }
+
+    // blocks arriving in any order, shifted by what follows and XORed in (uf2_crc_add_block())
+    uint32_t crc = 0;
+    for (uint32_t i = 0; i < 63; i++) {
+        uint32_t blk = (i * 37) % 63;
+        crc ^= crc32c_combine(crc32c(0, BUF + blk * 476, 476), 0, (62 - blk) * 476);
+    }
+    crc = crc32c_combine(crc, crc32c(0, BUF + 63 * 476, 100), 100);
+    CHECK_EQ(crc, crc32c(0, BUF, 63 * 476 + 100));
+}
+
+static void test_benchmark(void)
+{
+    test_fill(BUF, sizeof(BUF), 5);
+    volatile uint32_t sink = 0;
+
+    double start = now_s();
+    for (int i = 0; i < BENCH_REPEAT; i++) sink += crc32c(i, BUF + (i & 7), BENCH_LEN);
+    double slicing_s = now_s() - start;
+
+    start = now_s();
+    for (int i = 0; i < BENCH_REPEAT; i++) sink += ref_crc32c(i, BUF + (i & 7), BENCH_LEN);
+    double bytewise_s = now_s() - start;
+
+    printf("crc32c: %.0f MB/s, bytewise %.0f MB/s\n", BENCH_REPEAT / slicing_s, BENCH_REPEAT / bytewise_s);
+
+    // one per UF2 block, shifted by what follows it
+    start = now_s();
+    for (int i = 0; i < BENCH_REPEAT * 1000; i++) sink += crc32c_combine(i, 0, i * 476);
+    printf("crc32c_combine: %.0fns\n", (now_s() - start) * 1e9 / (BENCH_REPEAT * 1000));
+    (void)sink;
+}
+
+int main(void)
+{
+    ref_init();
+
+    RUN_TEST(test_known_answers);
+    RUN_TEST(test_matches_bytewise);
+    RUN_TEST(test_combine);
+    RUN_TEST(test_benchmark);
+
+    return TEST_RESULT();
+}
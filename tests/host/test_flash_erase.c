@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "sdk_mock.h"
+#include "nor_model.h"
+#include "flash_util.h"
+#include "flash_erase.h"
+#include "flash_job.h"
+#include "util.h"
+
+/*
+    Erase planning and scheduling (flash_erase.c), and erasing ranges on the simulated bitstream flash
+*/
+
+#define BAUD 20000000
+
+static const uint32_t ERASE_SIZES[] = {CONST_4k, CONST_32k, CONST_64k};
+
+static uint32_t plan_cost_4k(uint32_t start, uint32_t end)
+{
+    const struct spi_flash_caps *caps = spi_flash_get_caps(SPI_FLASH_BITSTREAM);
+    return ((end - start + CONST_4k - 1) / CONST_4k) * caps->erase_times[SPI_FLASH_ERASE_4K].typ_ms;
+}
+
+static void check_plan(uint32_t start, uint32_t end, uint32_t limit, const struct flash_erase_plan *plan)
+{
+    const struct spi_flash_caps *caps = spi_flash_get_caps(SPI_FLASH_BITSTREAM);
+    uint8_t covered[FLASH_ERASE_PLAN_MAX_OPS] = {0}; // per 4k sector of the block
+    uint32_t block = start & ~(FLASH_ERASE_BLOCK_SIZE - 1);
+    uint32_t est_ms = 0;
+
+    for (uint8_t i = 0; i < plan->num_ops; i++) {
+        uint32_t size = ERASE_SIZES[plan->ops[i].type];
+        uint32_t addr = plan->ops[i].addr;
+        CHECK_EQ(addr % size, 0);
+        CHECK(addr + size <= block + FLASH_ERASE_BLOCK_SIZE);
+        CHECK(addr + size <= limit);
+        for (uint32_t s = addr; s < addr + size; s += CONST_4k) {
+            CHECK(!covered[(s - block) / CONST_4k]); // no sector erased twice
+            covered[(s - block) / CONST_4k] = 1;
+        }
+        est_ms += caps->erase_times[plan->ops[i].type].typ_ms;
+    }
+    for (uint32_t s = start; s < end; s += CONST_4k) CHECK(covered[(s - block) / CONST_4k]);
+    CHECK_EQ(plan->est_ms, est_ms);
+    CHECK(plan->est_ms <= plan_cost_4k(start, end));
+}
+
+/*
+    With the W25Q256 times (4k 64ms, 32k 128ms, 64k 160ms)
+*/
+static void test_plan_known(void)
+{
+    struct flash_erase_plan plan;
+    spi_flash_select(SPI_FLASH_BITSTREAM, BAUD);
+
+    CHECK_EQ(flash_erase_plan_block(SPI_FLASH_BITSTREAM, 0x10000, 0x20000, 0x20000, &plan), 0);
+    CHECK_EQ(plan.num_ops, 1);
+    CHECK_EQ(plan.ops[0].type, SPI_FLASH_ERASE_64K);
+    CHECK_EQ(plan.est_ms, 160);
+
+    // 36k: 32k + 4k if the rest of the block has to be kept, a 64k if it doesn't
+    CHECK_EQ(flash_erase_plan_block(SPI_FLASH_BITSTREAM, 0x10000, 0x19000, 0x19000, &plan), 0);
+    CHECK_EQ(plan.num_ops, 2);
+    CHECK_EQ(plan.ops[0].type, SPI_FLASH_ERASE_32K);
+    CHECK_EQ(plan.ops[1].type, SPI_FLASH_ERASE_4K);
+    CHECK_EQ(plan.ops[1].addr, 0x18000);
+    CHECK_EQ(plan.est_ms, 192);
+    CHECK_EQ(flash_erase_plan_block(SPI_FLASH_BITSTREAM, 0x10000, 0x19000, 0x20000, &plan), 0);
+    CHECK_EQ(plan.num_ops, 1);
+    CHECK_EQ(plan.ops[0].type, SPI_FLASH_ERASE_64K);
+
+    // partial last sector
+    CHECK_EQ(flash_erase_plan_block(SPI_FLASH_BITSTREAM, 0x3000, 0x3001, 0x4000, &plan), 0);
+    CHECK_EQ(plan.num_ops, 1);
+    CHECK_EQ(plan.ops[0].type, SPI_FLASH_ERASE_4K);
+    CHECK_EQ(plan.ops[0].addr, 0x3000);
+
+    // bad arguments
+    CHECK_EQ(flash_erase_plan_block(SPI_FLASH_BITSTREAM, 0x3001, 0x4000, 0x4000, &plan), -1);
+    CHECK_EQ(flash_erase_plan_block(SPI_FLASH_BITSTREAM, 0x3000, 0x3000, 0x4000, &plan), -1);
+    CHECK_EQ(flash_erase_plan_block(SPI_FLASH_BITSTREAM, 0x3000, 0x3001, 0x3001, &plan), -1);
+    CHECK_EQ(flash_erase_plan_block(SPI_FLASH_BITSTREAM, 0xF000, 0x11000, 0x11000, &plan), -1);
+}
+
+/*
+    Every aligned start, random end and limit: covers the range, stays under the limit,
+    and is never worse than 4k erases
+*/
+static void test_plan_property(void)
+{
+    struct flash_erase_plan plan;
+    uint32_t seed = 1;
+    spi_flash_select(SPI_FLASH_BITSTREAM, BAUD);
+
+    for (uint32_t start = 0; start < FLASH_ERASE_BLOCK_SIZE; start += CONST_4k) {
+        for (int i = 0; i < 200; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            uint32_t end = start + 1 + seed % (FLASH_ERASE_BLOCK_SIZE - start);
+            uint32_t min_limit = (end + CONST_4k - 1) & ~(CONST_4k - 1);
+            uint32_t limit = min_limit + ((seed >> 16) % (FLASH_ERASE_BLOCK_SIZE - min_limit + 1));
+            CHECK_EQ(flash_erase_plan_block(SPI_FLASH_BITSTREAM, start, end, limit, &plan), 0);
+            check_plan(start, end, limit, &plan);
+        }
+    }
+}
+
+/*
+    Against the simulated flash: the range is erased and nothing past limit is touched
+*/
+static void test_erase_range(void)
+{
+    uint32_t addr = 0x1F000;
+    uint32_t len = 0x49000; // 4k, a 32k+4k, ..., into the middle of a block
+    uint32_t limit = addr + len + CONST_4k;
+
+    spi_flash_select(SPI_FLASH_BITSTREAM, BAUD);
+    memset(NOR_BITSTREAM.mem, 0x00, 0x100000);
+    nor_reset_stats(&NOR_BITSTREAM);
+
+    CHECK_EQ(flash_erase_range(addr, len, limit), 0);
+    CHECK(!nor_is_busy(&NOR_BITSTREAM));
+    CHECK(spi_flash_is_erased(NOR_BITSTREAM.mem + addr, len));
+    CHECK_EQ(NOR_BITSTREAM.mem[addr - 1], 0x00);
+    CHECK_EQ(NOR_BITSTREAM.mem[limit], 0x00);
+    CHECK_EQ(NOR_BITSTREAM.stats.erases[NOR_ERASE_CHIP], 0);
+}
+
+/*
+    Typical erase times for a bitstream sized range, against erasing it 4k at a time
+*/
+static void test_erase_benchmark(void)
+{
+    uint32_t addr = 0x200000;
+    uint32_t len = 0x43000; // a little over four 64k blocks, like a 268KB bitstream
+
+    spi_flash_select(SPI_FLASH_BITSTREAM, BAUD);
+    uint64_t start_ns = mock_time_ns();
+    for (uint32_t a = addr; a < addr + len; a += CONST_4k) {
+        CHECK_EQ(spi_flash_erase_nonblocking(SPI_FLASH_ERASE_4K, a), 0);
+        while (spi_flash_is_busy());
+    }
+    uint64_t sector_ns = mock_time_ns() - start_ns;
+
+    nor_reset_stats(&NOR_BITSTREAM);
+    start_ns = mock_time_ns();
+    CHECK_EQ(flash_erase_range(addr, len, addr + len), 0);
+    uint64_t planned_ns = mock_time_ns() - start_ns;
+
+    printf("erase %uk: 4k erases %llums, planned %llums (%u 64k, %u 32k, %u 4k)\n", len / 1024,
+        (unsigned long long)sector_ns / 1000000, (unsigned long long)planned_ns / 1000000,
+        NOR_BITSTREAM.stats.erases[NOR_ERASE_64K], NOR_BITSTREAM.stats.erases[NOR_ERASE_32K],
+        NOR_BITSTREAM.stats.erases[NOR_ERASE_4K]);
+    CHECK(planned_ns * 4 < sector_ns);
+}
+
+/*
+    The scheduler only queues erase jobs and never waits on the chip itself. Programs queued
+    after a prepare() land on erased flash
+*/
+static void test_sched_queued(void)
+{
+    static uint8_t data[256];
+    struct flash_erase_sched sched;
+    struct flash_job program;
+    uint32_t base = 0x400000;
+
+    test_fill(data, sizeof(data), 31);
+    memset(NOR_BITSTREAM.mem + base, 0x00, 4 * FLASH_ERASE_BLOCK_SIZE);
+    nor_reset_stats(&NOR_BITSTREAM);
+    flash_erase_sched_start(&sched, SPI_FLASH_BITSTREAM, BAUD, base, 4 * FLASH_ERASE_BLOCK_SIZE);
+
+    uint64_t start_ns = mock_time_ns();
+    CHECK_EQ(flash_erase_sched_prepare(&sched, base, sizeof(data)), 0);
+    program = (struct flash_job){.type = FLASH_JOB_PROGRAM, .chip = SPI_FLASH_BITSTREAM, .baud = BAUD,
+        .addr = base, .len = sizeof(data), .data = data};
+    CHECK_EQ(flash_job_submit(&program), 0);
+    CHECK_EQ(flash_erase_sched_ahead(&sched, base + sizeof(data)), 0); // first erase still queued
+    CHECK(mock_time_ns() - start_ns < 1000000);
+    CHECK(flash_erase_sched_is_busy(&sched));
+
+    flash_job_drain();
+    CHECK_EQ(program.state, FLASH_JOB_DONE);
+    CHECK(!memcmp(NOR_BITSTREAM.mem + base, data, sizeof(data)));
+    CHECK(spi_flash_is_erased(NOR_BITSTREAM.mem + base + sizeof(data), FLASH_ERASE_BLOCK_SIZE - sizeof(data)));
+    CHECK_EQ(NOR_BITSTREAM.stats.erases[NOR_ERASE_64K], 1);
+
+    // erase-ahead of the next block, then a write into it and one out of order
+    start_ns = mock_time_ns();
+    CHECK_EQ(flash_erase_sched_ahead(&sched, base + sizeof(data)), 0);
+    CHECK_EQ(flash_erase_sched_prepare(&sched, base + FLASH_ERASE_BLOCK_SIZE, sizeof(data)), 0);
+    CHECK_EQ(flash_erase_sched_prepare(&sched, base + 3 * FLASH_ERASE_BLOCK_SIZE + 0x100, sizeof(data)), 0);
+    program.addr = base + 3 * FLASH_ERASE_BLOCK_SIZE + 0x100;
+    CHECK_EQ(flash_job_submit(&program), 0);
+    CHECK(mock_time_ns() - start_ns < 1000000);
+
+    flash_erase_sched_wait(&sched);
+    flash_job_drain();
+    CHECK_EQ(NOR_BITSTREAM.stats.erases[NOR_ERASE_64K], 3);
+    CHECK(spi_flash_is_erased(NOR_BITSTREAM.mem + base + FLASH_ERASE_BLOCK_SIZE, FLASH_ERASE_BLOCK_SIZE));
+    CHECK(!memcmp(NOR_BITSTREAM.mem + program.addr, data, sizeof(data)));
+    CHECK_EQ(NOR_BITSTREAM.mem[base + 2 * FLASH_ERASE_BLOCK_SIZE], 0x00); // never written, never erased
+}
+
+int main(void)
+{
+    nor_init();
+
+    RUN_TEST(test_plan_known);
+    RUN_TEST(test_plan_property);
+    RUN_TEST(test_erase_range);
+    RUN_TEST(test_erase_benchmark);
+    RUN_TEST(test_sched_queued);
+
+    CHECK_EQ(mock_violations(), 0);
+    return TEST_RESULT();
+}
@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "sdk_mock.h"
+#include "nor_model.h"
+#include "flash_util.h"
+#include "flash_job.h"
+#include "util.h"
+
+/*
+    Flash job queue (flash_job.c) against the simulated flashes
+*/
+
+#define BAUD 20000000
+#define MAX_STEP_NS 1000000 // a step may send a page, but never waits on the chip
+
+static uint8_t DATA[0x3000];
+static uint8_t BUF[0x3000];
+static struct flash_job *FINISHED[32];
+static uint64_t FINISHED_NS[32];
+static uint32_t NUM_FINISHED = 0;
+
+static void job_finished(struct flash_job *job)
+{
+    CHECK(!flash_job_is_busy(job));
+    FINISHED_NS[NUM_FINISHED] = mock_time_ns();
+    FINISHED[NUM_FINISHED++] = job;
+}
+
+static void job_init(struct flash_job *job, enum flash_job_type type, enum spi_flash_chip chip, uint32_t addr,
+    uint32_t len, uint8_t *data)
+{
+    memset(job, 0x00, sizeof(*job));
+    job->type = type;
+    job->chip = chip;
+    job->baud = BAUD;
+    job->addr = addr;
+    job->len = len;
+    job->data = data;
+    job->erase_type = SPI_FLASH_ERASE_4K;
+    job->cb = job_finished;
+}
+
+/*
+    Run the queue to empty, checking no single step blocks on the flash. The mock's DMA
+    finishes before the call that starts it returns, so READ jobs are kept short
+*/
+static void drain_checked(void)
+{
+    uint64_t max_ns = 0;
+    for (;;) {
+        uint64_t start_ns = mock_time_ns();
+        int left = flash_job_task();
+        max_ns = max(max_ns, mock_time_ns() - start_ns);
+        if (!left) break;
+    }
+    CHECK(max_ns < MAX_STEP_NS);
+}
+
+/*
+    Erase, program, verify, read back and CRC a range, in order
+*/
+static void test_job_sequence(void)
+{
+    struct flash_job erase[3], program, verify, read, crc;
+    uint32_t addr = 0x30000;
+
+    memset(NOR_BITSTREAM.mem + addr, 0x00, sizeof(DATA));
+    test_fill(DATA, sizeof(DATA), 5);
+    memset(BUF, 0x00, sizeof(BUF));
+    NUM_FINISHED = 0;
+
+    for (int i = 0; i < 3; i++) {
+        job_init(&erase[i], FLASH_JOB_ERASE, SPI_FLASH_BITSTREAM, addr + i * CONST_4k, 0, NULL);
+        CHECK_EQ(flash_job_submit(&erase[i]), 0);
+    }
+    job_init(&program, FLASH_JOB_PROGRAM, SPI_FLASH_BITSTREAM, addr + 0x10, sizeof(DATA) - 0x10, DATA + 0x10);
+    job_init(&verify, FLASH_JOB_VERIFY, SPI_FLASH_BITSTREAM, addr + 0x10, sizeof(DATA) - 0x10, DATA + 0x10);
+    job_init(&read, FLASH_JOB_READ, SPI_FLASH_BITSTREAM, addr, 0x400, BUF);
+    job_init(&crc, FLASH_JOB_CRC, SPI_FLASH_BITSTREAM, addr + 0x10, sizeof(DATA) - 0x10, NULL);
+    crc.crc = 0x12345678;
+    CHECK_EQ(flash_job_submit(&program), 0);
+    CHECK_EQ(flash_job_submit(&verify), 0);
+    CHECK_EQ(flash_job_submit(&read), 0);
+    CHECK_EQ(flash_job_submit(&crc), 0);
+    CHECK(flash_job_is_busy(&crc));
+
+    drain_checked();
+
+    struct flash_job *order[] = {&erase[0], &erase[1], &erase[2], &program, &verify, &read, &crc};
+    CHECK_EQ(NUM_FINISHED, ARR_LEN(order));
+    for (uint32_t i = 0; i < ARR_LEN(order); i++) {
+        CHECK(FINISHED[i] == order[i]);
+        CHECK_EQ(order[i]->state, FLASH_JOB_DONE);
+    }
+    CHECK(!memcmp(NOR_BITSTREAM.mem + addr + 0x10, DATA + 0x10, sizeof(DATA) - 0x10));
+    CHECK(spi_flash_is_erased(BUF, 0x10));
+    CHECK(!memcmp(BUF + 0x10, DATA + 0x10, 0x400 - 0x10));
+    CHECK_EQ(BUF[0x400], 0x00);
+    CHECK_EQ(crc.crc, test_crc32(0x12345678, DATA + 0x10, sizeof(DATA) - 0x10));
+}
+
+/*
+    A failed verify is reported, and doesn't hold up the jobs behind it
+*/
+static void test_job_verify_error(void)
+{
+    struct flash_job verify, read;
+    uint32_t addr = 0x30000;
+
+    memcpy(BUF, NOR_BITSTREAM.mem + addr, sizeof(BUF));
+    BUF[0x2345] ^= 0x10;
+    NUM_FINISHED = 0;
+
+    job_init(&verify, FLASH_JOB_VERIFY, SPI_FLASH_BITSTREAM, addr, sizeof(BUF), BUF);
+    job_init(&read, FLASH_JOB_READ, SPI_FLASH_BITSTREAM, addr, 16, DATA);
+    CHECK_EQ(flash_job_submit(&verify), 0);
+    CHECK_EQ(flash_job_submit(&read), 0);
+    drain_checked();
+
+    CHECK_EQ(verify.state, FLASH_JOB_ERROR);
+    CHECK_EQ(verify.done, 0x2300); // up to the chunk with the difference
+    CHECK_EQ(read.state, FLASH_JOB_DONE);
+    CHECK_EQ(NUM_FINISHED, 2);
+}
+
+/*
+    Pages of all 0xFF aren't programmed, so verify doesn't read them back either
+*/
+static void test_job_verify_erased_pages(void)
+{
+    struct flash_job erase, program, verify;
+    uint32_t addr = 0x40000;
+
+    test_fill(DATA, CONST_4k, 7);
+    memset(DATA + 0x300, 0xFF, 0x200);
+    NUM_FINISHED = 0;
+
+    job_init(&erase, FLASH_JOB_ERASE, SPI_FLASH_BITSTREAM, addr, 0, NULL);
+    job_init(&program, FLASH_JOB_PROGRAM, SPI_FLASH_BITSTREAM, addr, CONST_4k, DATA);
+    job_init(&verify, FLASH_JOB_VERIFY, SPI_FLASH_BITSTREAM, addr, CONST_4k, DATA);
+    CHECK_EQ(flash_job_submit(&erase), 0);
+    CHECK_EQ(flash_job_submit(&program), 0);
+    nor_reset_stats(&NOR_BITSTREAM);
+    CHECK_EQ(flash_job_submit(&verify), 0);
+    drain_checked();
+
+    CHECK_EQ(verify.state, FLASH_JOB_DONE);
+    CHECK_EQ(verify.done, CONST_4k);
+    CHECK_EQ(NOR_BITSTREAM.stats.pages, CONST_4k / NOR_PAGE_SIZE - 2);
+    CHECK_EQ(NOR_BITSTREAM.stats.bytes_read, CONST_4k - 0x200);
+}
+
+/*
+    While one chip is erasing, the other chip's jobs get the bus
+*/
+static void test_job_overlap(void)
+{
+    struct flash_job erase, program, verify;
+    uint32_t addr = 0x50000;
+
+    memset(NOR_FIRMWARE.mem + addr, 0xFF, CONST_4k);
+    test_fill(DATA, CONST_4k, 6);
+    NUM_FINISHED = 0;
+
+    job_init(&erase, FLASH_JOB_ERASE, SPI_FLASH_BITSTREAM, addr, 0, NULL);
+    erase.erase_type = SPI_FLASH_ERASE_64K;
+    job_init(&program, FLASH_JOB_PROGRAM, SPI_FLASH_FIRMWARE, addr, CONST_4k, DATA);
+    job_init(&verify, FLASH_JOB_VERIFY, SPI_FLASH_FIRMWARE, addr, CONST_4k, DATA);
+    CHECK_EQ(flash_job_submit(&erase), 0);
+    CHECK_EQ(flash_job_submit(&program), 0);
+    CHECK_EQ(flash_job_submit(&verify), 0);
+
+    uint64_t start_ns = mock_time_ns();
+    drain_checked();
+    uint64_t took_ns = mock_time_ns() - start_ns;
+
+    CHECK_EQ(NUM_FINISHED, 3);
+    CHECK(FINISHED[2] == &erase); // the 16 pages on the firmware flash fit inside the erase
+    CHECK_EQ(verify.state, FLASH_JOB_DONE);
+    CHECK(took_ns < NOR_BITSTREAM.erase_ns[NOR_ERASE_64K] + MAX_STEP_NS);
+    printf("64k erase + 4k program on the other chip: %lluus (erase alone %lluus)\n",
+        (unsigned long long)took_ns / 1000, (unsigned long long)NOR_BITSTREAM.erase_ns[NOR_ERASE_64K] / 1000);
+}
+
+static void test_job_queue_full(void)
+{
+    static struct flash_job jobs[FLASH_JOB_QUEUE_LEN + 1];
+    NUM_FINISHED = 0;
+
+    for (uint32_t i = 0; i < ARR_LEN(jobs); i++) {
+        job_init(&jobs[i], FLASH_JOB_READ, SPI_FLASH_BITSTREAM, i * 16, 16, BUF + i * 16);
+        CHECK_EQ(flash_job_submit(&jobs[i]), (i < FLASH_JOB_QUEUE_LEN) ? 0 : -1);
+    }
+    jobs[0].chip = SPI_FLASH_NUM_CHIPS;
+    CHECK_EQ(flash_job_submit(&jobs[0]), -1);
+    jobs[0].chip = SPI_FLASH_BITSTREAM;
+
+    flash_job_drain();
+    CHECK_EQ(NUM_FINISHED, FLASH_JOB_QUEUE_LEN);
+    CHECK_EQ(jobs[FLASH_JOB_QUEUE_LEN].state, FLASH_JOB_IDLE);
+    CHECK(!memcmp(BUF, NOR_BITSTREAM.mem, FLASH_JOB_QUEUE_LEN * 16));
+    CHECK_EQ(flash_job_task(), 0);
+}
+
+int main(void)
+{
+    nor_init();
+
+    RUN_TEST(test_job_sequence);
+    RUN_TEST(test_job_verify_error);
+    RUN_TEST(test_job_verify_erased_pages);
+    RUN_TEST(test_job_overlap);
+    RUN_TEST(test_job_queue_full);
+
+    CHECK_EQ(mock_violations(), 0);
+    return TEST_RESULT();
+}
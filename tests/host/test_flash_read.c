@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "sdk_mock.h"
+#include "nor_model.h"
+#include "flash_util.h"
+#include "dma_crc.h"
+#include "util.h"
+
+/*
+    DMA flash reads (spi_flash_read*) on the bitstream flash
+*/
+
+#define BAUD_SLOW 20000000
+#define BAUD_FAST 62500000 // needs fast read
+
+static uint8_t BUF[0x11000];
+static uint8_t EXPECTED[0x11000];
+static int CB_CALLS = 0;
+
+static void read_done(void)
+{
+    CB_CALLS++;
+    CHECK(!spi_flash_dma_is_busy());
+}
+
+static void test_probe(void)
+{
+    spi_flash_select(SPI_FLASH_BITSTREAM, BAUD_SLOW);
+    const struct spi_flash_caps *caps = spi_flash_get_caps(SPI_FLASH_BITSTREAM);
+
+    CHECK(caps->probed);
+    CHECK(caps->from_sfdp);
+    CHECK_EQ(caps->jedec_id, NOR_JEDEC_ID);
+    CHECK_EQ(caps->size, NOR_SIZE);
+    CHECK_EQ(caps->addr_bytes, 4);
+    CHECK_EQ(caps->page_size, 256);
+    CHECK(spi_flash_get_baud() <= BAUD_SLOW); // what the divider could do
+}
+
+/*
+    Odd lengths and addresses, including across the 16MB line (3 byte address limit)
+*/
+static void test_read_matches(void)
+{
+    static const struct {uint32_t addr, len;} reads[] = {
+        {0, 1}, {0, 4096}, {0x123, 7}, {0xFFF0, 0x20}, {0xFFF800, 0x10000}, {NOR_SIZE - 0x800, 0x800},
+    };
+    uint32_t bauds[] = {BAUD_SLOW, BAUD_FAST};
+
+    for (uint32_t b = 0; b < 2; b++) {
+        spi_flash_select(SPI_FLASH_BITSTREAM, bauds[b]);
+        for (uint32_t i = 0; i < ARR_LEN(reads); i++) {
+            test_fill(NOR_BITSTREAM.mem + reads[i].addr, reads[i].len, reads[i].addr + b + 1);
+            memset(BUF, 0x00, sizeof(BUF));
+            CHECK_EQ(spi_flash_read(reads[i].addr, BUF, reads[i].len), 0);
+            CHECK(!memcmp(BUF, NOR_BITSTREAM.mem + reads[i].addr, reads[i].len));
+            CHECK_EQ(BUF[reads[i].len], 0x00); // nothing past the end
+        }
+    }
+}
+
+static void test_read_dma_callback(void)
+{
+    spi_flash_select(SPI_FLASH_BITSTREAM, BAUD_SLOW);
+    test_fill(NOR_BITSTREAM.mem + 0x20000, 0x1000, 77);
+
+    CB_CALLS = 0;
+    CHECK_EQ(spi_flash_read_dma(0x20000, BUF, 0x1000, read_done), 0);
+    while (spi_flash_dma_is_busy());
+    CHECK_EQ(CB_CALLS, 1);
+    CHECK(!memcmp(BUF, NOR_BITSTREAM.mem + 0x20000, 0x1000));
+
+    // zero length still calls back
+    CHECK_EQ(spi_flash_read_dma(0x20000, BUF, 0, read_done), 0);
+    CHECK_EQ(CB_CALLS, 2);
+}
+
+/*
+    Sniffed CRC is zlib's CRC-32 and chains across reads
+*/
+static void test_read_crc(void)
+{
+    spi_flash_select(SPI_FLASH_BITSTREAM, BAUD_SLOW);
+    test_fill(NOR_BITSTREAM.mem + 0x40000, 0x3000, 1234);
+    memcpy(EXPECTED, NOR_BITSTREAM.mem + 0x40000, 0x3000);
+
+    uint32_t crc = 0;
+    CHECK_EQ(spi_flash_read_crc(0x40000, BUF, 0x1000, &crc), 0);
+    CHECK_EQ(spi_flash_read_crc(0x41000, BUF + 0x1000, 0x2001 - 1, &crc), 0);
+    CHECK_EQ(crc, test_crc32(0, EXPECTED, 0x3000));
+    CHECK(!memcmp(BUF, EXPECTED, 0x3000));
+
+    crc = 0xDEADBEEF;
+    CHECK_EQ(spi_flash_read_crc(0x40001, BUF, 13, &crc), 0);
+    CHECK_EQ(crc, test_crc32(0xDEADBEEF, EXPECTED + 1, 13));
+}
+
+/*
+    Copying through the sniffer gives the same CRC-32, at any alignment
+*/
+static void test_dma_crc_copy(void)
+{
+    test_fill(EXPECTED, 0x1000, 99);
+    for (uint32_t offset = 0; offset < 4; offset++) {
+        memset(BUF, 0x00, 0x1000);
+        uint32_t crc = dma_crc32_copy(0x1234, BUF + offset, EXPECTED, 0x800 + offset);
+        CHECK_EQ(crc, test_crc32(0x1234, EXPECTED, 0x800 + offset));
+        CHECK(!memcmp(BUF + offset, EXPECTED, 0x800 + offset));
+        CHECK_EQ(BUF[0x800 + 2 * offset], 0x00);
+    }
+    CHECK_EQ(dma_crc32_copy(0x1234, BUF, EXPECTED, 0), 0x1234);
+}
+
+/*
+    A 64k read should take the time it takes to clock the bytes, plus a little for the command
+*/
+static void test_wire_speed(void)
+{
+    uint32_t bauds[] = {BAUD_SLOW, BAUD_FAST};
+    for (uint32_t b = 0; b < 2; b++) {
+        spi_flash_select(SPI_FLASH_BITSTREAM, bauds[b]);
+        uint64_t wire_ns = 0x10000ull * 8 * 1000000000 / spi_flash_get_baud();
+        uint64_t start_ns = mock_time_ns();
+        CHECK_EQ(spi_flash_read(0, BUF, 0x10000), 0);
+        uint64_t took_ns = mock_time_ns() - start_ns;
+
+        printf("64k read at %uHz: %lluus (wire %lluus)\n", spi_flash_get_baud(),
+            (unsigned long long)took_ns / 1000, (unsigned long long)wire_ns / 1000);
+        CHECK(took_ns < wire_ns + wire_ns / 50);
+    }
+}
+
+int main(void)
+{
+    nor_init();
+
+    RUN_TEST(test_probe);
+    RUN_TEST(test_read_matches);
+    RUN_TEST(test_read_dma_callback);
+    RUN_TEST(test_read_crc);
+    RUN_TEST(test_dma_crc_copy);
+    RUN_TEST(test_wire_speed);
+
+    CHECK_EQ(mock_violations(), 0);
+    return TEST_RESULT();
+}
@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "sdk_mock.h"
+#include "fpga_program.h"
+
+/*
+    FPGA DMA buffers (fpga_dma_*): claimed ahead, sent in claim order
+*/
+
+#define FPGA_BAUD 31250000
+
+static uint8_t SENT[4 * FPGA_BUF_SIZE];
+static uint32_t SENT_LEN = 0;
+
+static uint8_t fpga_xfer(void *ctx, uint8_t out)
+{
+    if (SENT_LEN < sizeof(SENT)) SENT[SENT_LEN++] = out;
+    return 0xFF;
+}
+
+static void test_claim_order(void)
+{
+    static uint8_t expected[2 * FPGA_BUF_SIZE];
+    test_fill(expected, sizeof(expected), 21);
+    SENT_LEN = 0;
+
+    // both claimed before either's submitted, like a flash read into one while the next is claimed
+    uint8_t *first = fpga_dma_get_buf();
+    uint8_t *second = fpga_dma_get_buf();
+    CHECK(first && second && (first != second));
+    CHECK(!fpga_dma_get_buf());
+    CHECK(!is_fpga_dma_ready());
+
+    memcpy(first, expected, FPGA_BUF_SIZE);
+    memcpy(second, expected + FPGA_BUF_SIZE, 100);
+    CHECK_EQ(fpga_dma_submit(FPGA_BUF_SIZE), 0);
+    CHECK_EQ(fpga_dma_submit(100), 0);
+    CHECK_EQ(fpga_dma_submit(100), -1); // nothing claimed
+    fpga_dma_wait();
+
+    CHECK_EQ(SENT_LEN, FPGA_BUF_SIZE + 100);
+    CHECK(!memcmp(SENT, expected, FPGA_BUF_SIZE + 100));
+    CHECK(is_fpga_dma_ready());
+}
+
+/*
+    Submitting nothing gives the buffer back, so it can be claimed again
+*/
+static void test_submit_empty(void)
+{
+    SENT_LEN = 0;
+    CHECK(fpga_dma_get_buf() && fpga_dma_get_buf());
+    CHECK_EQ(fpga_dma_submit(0), 0);
+    CHECK(is_fpga_dma_ready());
+    CHECK_EQ(fpga_dma_submit(0), 0);
+    CHECK_EQ(fpga_dma_submit(0), -1); // nothing claimed
+    fpga_dma_wait();
+    CHECK_EQ(SENT_LEN, 0);
+
+    uint8_t *buf = fpga_dma_get_buf();
+    CHECK(buf != NULL);
+    memset(buf, 0x5A, 10);
+    CHECK_EQ(fpga_dma_submit(10), 0);
+    fpga_dma_wait();
+    CHECK_EQ(SENT_LEN, 10);
+    CHECK(is_fpga_dma_ready());
+}
+
+static void test_send_dma(void)
+{
+    uint8_t data[300];
+    test_fill(data, sizeof(data), 22);
+    SENT_LEN = 0;
+
+    CHECK_EQ(fpga_send_dma(data, 0), 0); // doesn't hold on to a buffer
+    for (int i = 0; i < 3; i++) CHECK_EQ(fpga_send_dma(data + i * 100, 100), 100);
+    fpga_dma_wait();
+    CHECK_EQ(SENT_LEN, sizeof(data));
+    CHECK(!memcmp(SENT, data, sizeof(data)));
+    CHECK(fpga_dma_get_buf() != NULL);
+    CHECK(fpga_dma_get_buf() != NULL);
+}
+
+int main(void)
+{
+    fpga_program_init(FPGA_BAUD);
+    mock_spi_attach(spi1, fpga_xfer, NULL);
+
+    RUN_TEST(test_claim_order);
+    RUN_TEST(test_submit_empty);
+    RUN_TEST(test_send_dma);
+
+    CHECK_EQ(mock_violations(), 0);
+    return TEST_RESULT();
+}
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "test.h"
+#include "sdk_mock.h"
+#include "nor_model.h"
+#include "flash_util.h"
+#include "flash_erase.h"
+#include "flash_pre_erase.h"
+#include "config.h"
+#include "util.h"
+
+/*
+    Idle pre-erase (flash_pre_erase.c) handing a slot over to an upload
+*/
+
+#define BAUD 20000000
+#define SLOT 1
+
+struct config_options CONFIG = {.flash_prog_speed = BAUD};
+uint32_t FLASH_BITSTREAM_OFFSET[FLASH_PRE_ERASE_SLOTS] = {0, FLASH_SLOT_SIZE, 2 * FLASH_SLOT_SIZE};
+
+/*
+    Claiming a slot mid erase doesn't wait for the erase, it's left suspended. The blocks that
+    finished are skipped by the scheduler, the map is gone from flash, and the block still
+    erasing is erased again by the scheduler
+*/
+static void test_claim_mid_erase(void)
+{
+    uint32_t base = FLASH_BITSTREAM_OFFSET[SLOT];
+    struct flash_erase_sched sched;
+
+    memset(NOR_BITSTREAM.mem + base, 0x00, FLASH_SLOT_SIZE);
+    nor_reset_stats(&NOR_BITSTREAM);
+    flash_pre_erase_mark_stale(SLOT);
+    mock_advance_ns((FLASH_PRE_ERASE_IDLE_MS + 1) * 1000000ull);
+
+    // record sector, then three blocks, with the fourth still going
+    while (NOR_BITSTREAM.stats.erases[NOR_ERASE_64K] < 4) {
+        flash_pre_erase_task(0);
+        mock_advance_ns(1000000);
+    }
+    CHECK(nor_is_busy(&NOR_BITSTREAM));
+    uint32_t erasing = base + 3 * FLASH_ERASE_BLOCK_SIZE;
+
+    flash_erase_sched_start(&sched, SPI_FLASH_BITSTREAM, BAUD, base, 8 * FLASH_ERASE_BLOCK_SIZE);
+    uint64_t start_ns = mock_time_ns();
+    CHECK_EQ(flash_pre_erase_claim(base, &sched), 3);
+    uint64_t took_ns = mock_time_ns() - start_ns;
+    printf("claim with an erase in flight: %lluus\n", (unsigned long long)took_ns / 1000);
+    CHECK(took_ns < 5000000);
+    CHECK(NOR_BITSTREAM.suspended);
+    CHECK_EQ(NOR_BITSTREAM.stats.erases[NOR_ERASE_4K], 1); // only the pre-erase's
+
+    uint32_t magic;
+    memcpy(&magic, NOR_BITSTREAM.mem + flash_fingerprint_sector(base) + FLASH_PRE_ERASE_MAP_OFFSET, sizeof(magic));
+    CHECK(magic != FLASH_PRE_ERASE_MAP_MAGIC);
+
+    // the scheduler only erases what wasn't pre-erased, after resuming the erase
+    nor_reset_stats(&NOR_BITSTREAM);
+    CHECK_EQ(flash_erase_sched_prepare(&sched, base, 8 * FLASH_ERASE_BLOCK_SIZE), 0);
+    flash_erase_sched_wait(&sched);
+    CHECK_EQ(NOR_BITSTREAM.stats.erases[NOR_ERASE_64K], 5);
+    CHECK(spi_flash_is_erased(NOR_BITSTREAM.mem + base, 8 * FLASH_ERASE_BLOCK_SIZE));
+
+    uint8_t buf[16];
+    CHECK_EQ(spi_flash_read(erasing + 0x100, buf, sizeof(buf)), 0);
+    CHECK(spi_flash_is_erased(buf, sizeof(buf)));
+
+    // nothing more is pre-erased in a claimed slot
+    mock_advance_ns((FLASH_PRE_ERASE_IDLE_MS + 1) * 1000000ull);
+    nor_reset_stats(&NOR_BITSTREAM);
+    flash_pre_erase_task(0);
+    CHECK_EQ(NOR_BITSTREAM.stats.erases[NOR_ERASE_64K] + NOR_BITSTREAM.stats.erases[NOR_ERASE_4K], 0);
+}
+
+/*
+    An erase on another slot is suspended too, so reads of the claimed slot go straight
+    through. The idle task picks it back up and records it once it finishes
+*/
+static void test_claim_other_slot_mid_erase(void)
+{
+    uint32_t base = FLASH_BITSTREAM_OFFSET[2];
+
+    memset(NOR_BITSTREAM.mem + base, 0x00, FLASH_SLOT_SIZE);
+    flash_pre_erase_mark_stale(2);
+    mock_advance_ns((FLASH_PRE_ERASE_IDLE_MS + 1) * 1000000ull);
+    nor_reset_stats(&NOR_BITSTREAM);
+    while (NOR_BITSTREAM.stats.erases[NOR_ERASE_64K] < 1) {
+        flash_pre_erase_task(0);
+        mock_advance_ns(1000000);
+    }
+    CHECK(nor_is_busy(&NOR_BITSTREAM));
+
+    uint64_t start_ns = mock_time_ns();
+    CHECK_EQ(flash_pre_erase_claim(FLASH_BITSTREAM_OFFSET[0], NULL), 0);
+    uint8_t buf[16];
+    CHECK_EQ(spi_flash_read(FLASH_BITSTREAM_OFFSET[0], buf, sizeof(buf)), 0);
+    CHECK(mock_time_ns() - start_ns < 1000000);
+    CHECK(NOR_BITSTREAM.suspended);
+
+    // the block is in the map once the task starts on the next one
+    mock_advance_ns((FLASH_PRE_ERASE_IDLE_MS + 1) * 1000000ull);
+    while (NOR_BITSTREAM.stats.erases[NOR_ERASE_64K] < 2) {
+        flash_pre_erase_task(0);
+        mock_advance_ns(1000000);
+    }
+    uint8_t bits;
+    memcpy(&bits, NOR_BITSTREAM.mem + flash_fingerprint_sector(base) + FLASH_PRE_ERASE_MAP_OFFSET +
+        offsetof(struct flash_pre_erase_map, not_erased), 1);
+    CHECK_EQ(bits & 1, 0);
+    CHECK(spi_flash_is_erased(NOR_BITSTREAM.mem + base, FLASH_ERASE_BLOCK_SIZE));
+}
+
+int main(void)
+{
+    nor_init();
+    spi_flash_select(SPI_FLASH_BITSTREAM, BAUD);
+
+    RUN_TEST(test_claim_mid_erase);
+    RUN_TEST(test_claim_other_slot_mid_erase);
+
+    CHECK_EQ(mock_violations(), 0);
+    return TEST_RESULT();
+}
@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "sdk_mock.h"
+#include "nor_model.h"
+#include "flash_util.h"
+#include "util.h"
+
+/*
+    PIO quad reads and programs (qspi_flash.c) on the firmware flash
+*/
+
+#define BAUD 20000000
+
+static uint8_t BUF[0x11000];
+static uint8_t DATA[0x11000];
+
+static void test_quad_enabled(void)
+{
+    spi_flash_select(SPI_FLASH_FIRMWARE, BAUD);
+    const struct spi_flash_caps *caps = spi_flash_get_caps(SPI_FLASH_FIRMWARE);
+
+    CHECK(caps->probed);
+    CHECK_EQ(caps->quad_enable, SPI_FLASH_QE_SR2_WRSR);
+    CHECK(NOR_FIRMWARE.sr2 & 0x02);
+}
+
+/*
+    Lengths either side of the DMA chunk size, with CLK sampled at random levels by the mock
+*/
+static void test_quad_read(void)
+{
+    static const struct {uint32_t addr, len;} reads[] = {
+        {0, 1}, {0x101, 255}, {0x1000, 256}, {0x2003, 257}, {0x3000, 513}, {0x10000, 0x10000},
+    };
+
+    spi_flash_select(SPI_FLASH_FIRMWARE, BAUD);
+    for (uint32_t i = 0; i < ARR_LEN(reads); i++) {
+        test_fill(NOR_FIRMWARE.mem + reads[i].addr, reads[i].len, reads[i].addr + 1);
+        memset(BUF, 0x00, sizeof(BUF));
+        nor_reset_stats(&NOR_FIRMWARE);
+
+        CHECK_EQ(spi_flash_read(reads[i].addr, BUF, reads[i].len), 0);
+        CHECK(!memcmp(BUF, NOR_FIRMWARE.mem + reads[i].addr, reads[i].len));
+        CHECK_EQ(BUF[reads[i].len], 0x00);
+        CHECK_EQ(NOR_FIRMWARE.stats.quad_bytes, reads[i].len);
+    }
+}
+
+static void test_quad_program(void)
+{
+    uint32_t addr = 0x100080; // starts mid page
+    uint32_t len = 0x1234;
+
+    spi_flash_select(SPI_FLASH_FIRMWARE, BAUD);
+    memset(NOR_FIRMWARE.mem + addr, 0xFF, len);
+    test_fill(DATA, len, 99);
+    nor_reset_stats(&NOR_FIRMWARE);
+
+    CHECK_EQ(spi_flash_write_buffer(addr, DATA, len), 0);
+    while (spi_flash_is_busy());
+    CHECK(!memcmp(NOR_FIRMWARE.mem + addr, DATA, len));
+    CHECK_EQ(NOR_FIRMWARE.stats.quad_bytes, len);
+    CHECK_EQ(NOR_FIRMWARE.stats.pages, (len + 0x80 + NOR_PAGE_SIZE - 1) / NOR_PAGE_SIZE);
+
+    memset(BUF, 0x00, len);
+    CHECK_EQ(spi_flash_read(addr, BUF, len), 0);
+    CHECK(!memcmp(BUF, DATA, len));
+}
+
+/*
+    Quad reads take about a quarter of the time single bit reads would
+*/
+static void test_quad_speed(void)
+{
+    spi_flash_select(SPI_FLASH_FIRMWARE, BAUD);
+    uint64_t wire_ns = 0x10000ull * 2 * 1000000000 / spi_flash_get_baud();
+    uint64_t start_ns = mock_time_ns();
+    CHECK_EQ(spi_flash_read(0, BUF, 0x10000), 0);
+    uint64_t took_ns = mock_time_ns() - start_ns;
+
+    printf("64k quad read at %uHz: %lluus (wire %lluus)\n", spi_flash_get_baud(),
+        (unsigned long long)took_ns / 1000, (unsigned long long)wire_ns / 1000);
+    CHECK(took_ns < wire_ns + wire_ns / 10);
+}
+
+int main(void)
+{
+    nor_init();
+
+    RUN_TEST(test_quad_enabled);
+    RUN_TEST(test_quad_read);
+    RUN_TEST(test_quad_program);
+    RUN_TEST(test_quad_speed);
+
+    CHECK_EQ(mock_violations(), 0);
+    return TEST_RESULT();
+}
@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "nor_model.h"
+#include "sfdp.h"
+#include "util.h"
+
+/*
+    SFDP decoding (sfdp.c) with recorded and hand-built tables
+*/
+
+/*
+    JESD216 (no revision) table, 9 DWORDs: 16Mbit, 3 byte address, 4k/32k/64k erases, no
+    times, page size or QER
+*/
+static const uint8_t OLD_SFDP[] = {
+    'S', 'F', 'D', 'P', 0x00, 0x01, 0x00, 0xFF,
+    0x00, 0x00, 0x01, 0x09, 0x10, 0x00, 0x00, 0xFF,
+    0xE5, 0x20, 0xF1, 0xFF,
+    0xFF, 0xFF, 0xFF, 0x00,
+    0x44, 0xEB, 0x08, 0x6B,
+    0x08, 0x3B, 0x80, 0xBB,
+    0xEE, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0x00, 0xFF,
+    0xFF, 0xFF, 0x00, 0xFF,
+    0x0C, 0x20, 0x0F, 0x52,
+    0x10, 0xD8, 0x00, 0xFF,
+};
+
+static void test_w25q256(void)
+{
+    struct sfdp_info info;
+    uint32_t offset = 0, dwords = 0;
+
+    CHECK_EQ(sfdp_find_bfpt(NOR_W25Q256_SFDP, 0x18, &offset, &dwords), 0);
+    CHECK_EQ(offset, 0x80);
+    CHECK_EQ(dwords, 16);
+    CHECK_EQ(sfdp_parse_bfpt(NOR_W25Q256_SFDP + offset, dwords, &info), 0);
+
+    CHECK_EQ(info.dwords, 16);
+    CHECK_EQ(info.size, 32 * 1024 * 1024);
+    CHECK_EQ(info.addr_mode, SFDP_ADDR_3OR4BYTE);
+    CHECK_EQ(info.page_size, 256);
+
+    CHECK_EQ(info.erase[0].size, 4096);
+    CHECK_EQ(info.erase[0].opcode, 0x20);
+    CHECK_EQ(info.erase[0].typ_ms, 64);
+    CHECK_EQ(info.erase[0].max_ms, 64 * 14);
+    CHECK_EQ(info.erase[1].size, 32768);
+    CHECK_EQ(info.erase[1].opcode, 0x52);
+    CHECK_EQ(info.erase[1].typ_ms, 128);
+    CHECK_EQ(info.erase[2].size, 65536);
+    CHECK_EQ(info.erase[2].opcode, 0xD8);
+    CHECK_EQ(info.erase[2].typ_ms, 160);
+    CHECK_EQ(info.erase[3].size, 0);
+    CHECK_EQ(info.chip_erase_typ_ms, 40000);
+    CHECK_EQ(info.chip_erase_max_ms, 40000 * 14);
+
+    CHECK(info.fast_read_114);
+    CHECK_EQ(info.fast_read_114_opcode, 0x6B);
+    CHECK_EQ(info.fast_read_114_dummy_clocks, 8);
+    CHECK_EQ(info.qer, 4);
+
+    CHECK(info.erase_suspend);
+    CHECK_EQ(info.suspend_opcode, 0x75);
+    CHECK_EQ(info.resume_opcode, 0x7A);
+    CHECK_EQ(info.suspend_latency_us, 21);
+    CHECK_EQ(info.resume_interval_us, 512);
+}
+
+/*
+    Anything past the end of an old table is left as "not given"
+*/
+static void test_old_table(void)
+{
+    struct sfdp_info info;
+    uint32_t offset = 0, dwords = 0;
+
+    CHECK_EQ(sfdp_find_bfpt(OLD_SFDP, sizeof(OLD_SFDP), &offset, &dwords), 0);
+    CHECK_EQ(offset, 0x10);
+    CHECK_EQ(dwords, 9);
+    CHECK_EQ(sfdp_parse_bfpt(OLD_SFDP + offset, dwords, &info), 0);
+
+    CHECK_EQ(info.size, 2 * 1024 * 1024);
+    CHECK_EQ(info.addr_mode, SFDP_ADDR_3BYTE);
+    CHECK_EQ(info.page_size, 0);
+    CHECK_EQ(info.erase[0].size, 4096);
+    CHECK_EQ(info.erase[2].size, 65536);
+    CHECK_EQ(info.erase[0].typ_ms, 0);
+    CHECK_EQ(info.chip_erase_typ_ms, 0);
+    CHECK_EQ(info.qer, 0xFF);
+    CHECK(!info.erase_suspend);
+
+    // only the first two DWORDs: the 4k erase comes from DWORD1
+    CHECK_EQ(sfdp_parse_bfpt(OLD_SFDP + offset, 2, &info), 0);
+    CHECK_EQ(info.erase[0].size, 4096);
+    CHECK_EQ(info.erase[0].opcode, 0x20);
+    CHECK_EQ(info.erase[1].size, 0);
+    CHECK_EQ(info.fast_read_114_opcode, 0);
+}
+
+static void test_corrupt(void)
+{
+    uint8_t table[sizeof(OLD_SFDP)];
+    struct sfdp_info info;
+    uint32_t offset, dwords;
+
+    memcpy(table, OLD_SFDP, sizeof(table));
+    table[0] = 'X';
+    CHECK_EQ(sfdp_find_bfpt(table, sizeof(table), &offset, &dwords), -1);
+
+    // header cut short
+    CHECK_EQ(sfdp_find_bfpt(OLD_SFDP, 12, &offset, &dwords), -1);
+
+    // BFPT major revision 2 isn't defined
+    memcpy(table, OLD_SFDP, sizeof(table));
+    table[10] = 2;
+    CHECK_EQ(sfdp_find_bfpt(table, sizeof(table), &offset, &dwords), -1);
+
+    // too short to have the density
+    memcpy(table, OLD_SFDP, sizeof(table));
+    table[11] = 1;
+    CHECK_EQ(sfdp_find_bfpt(table, sizeof(table), &offset, &dwords), -1);
+    CHECK_EQ(sfdp_parse_bfpt(OLD_SFDP + 0x10, 1, &info), -1);
+
+    // more parameter headers claimed than were read
+    memcpy(table, OLD_SFDP, sizeof(table));
+    table[6] = 0xFF;
+    table[8] = 0x01; // first one isn't the BFPT
+    CHECK_EQ(sfdp_find_bfpt(table, 0x18, &offset, &dwords), -1);
+
+    // BFPT after a vendor table
+    CHECK_EQ(sfdp_find_bfpt(NOR_W25Q256_SFDP, 0x20, &offset, &dwords), 0);
+    CHECK_EQ(offset, 0x80);
+
+    // 2^N bit densities that don't fit
+    memcpy(table, OLD_SFDP, sizeof(table));
+    table[0x14] = 35; table[0x15] = 0; table[0x16] = 0; table[0x17] = 0x80;
+    CHECK_EQ(sfdp_parse_bfpt(table + 0x10, 9, &info), -1);
+    table[0x14] = 2;
+    CHECK_EQ(sfdp_parse_bfpt(table + 0x10, 9, &info), -1);
+    table[0x14] = 34;
+    CHECK_EQ(sfdp_parse_bfpt(table + 0x10, 9, &info), 0);
+    CHECK_EQ(info.size, 2u * 1024 * 1024 * 1024);
+}
+
+/*
+    Random tables decode to something self consistent
+*/
+static void test_random_tables(void)
+{
+    uint8_t table[SFDP_BFPT_MAX_DWORDS * 4 + 4];
+    struct sfdp_info info;
+
+    for (uint32_t seed = 1; seed <= 20000; seed++) {
+        test_fill(table, sizeof(table), seed);
+        uint32_t dwords = seed % (SFDP_BFPT_MAX_DWORDS + 2);
+        int rtn = sfdp_parse_bfpt(table, dwords, &info);
+        if (dwords < 2) {
+            CHECK_EQ(rtn, -1);
+            continue;
+        }
+        if (rtn) continue;
+
+        CHECK(info.size);
+        CHECK(info.addr_mode <= SFDP_ADDR_4BYTE);
+        CHECK_EQ(info.dwords, min(dwords, SFDP_BFPT_MAX_DWORDS));
+        CHECK(!info.page_size || !(info.page_size & (info.page_size - 1)));
+        for (int i = 0; i < SFDP_NUM_ERASE_TYPES; i++) {
+            CHECK(!(info.erase[i].size & (info.erase[i].size - 1)));
+            CHECK(info.erase[i].max_ms >= info.erase[i].typ_ms);
+            if (!info.erase[i].size) CHECK_EQ(info.erase[i].typ_ms, 0);
+        }
+        CHECK((info.qer <= 7) || ((info.qer == 0xFF) && (dwords < 15)));
+        if (!info.erase_suspend) CHECK_EQ(info.suspend_latency_us, 0);
+    }
+}
+
+int main(void)
+{
+    RUN_TEST(test_w25q256);
+    RUN_TEST(test_old_table);
+    RUN_TEST(test_corrupt);
+    RUN_TEST(test_random_tables);
+
+    return TEST_RESULT();
+}
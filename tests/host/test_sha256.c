@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "test.h"
+#include "sha256.h"
+#include "util.h"
+
+/*
+    SHA-256 (sha256.c): FIPS 180-2 vectors, padding edges, split updates, and throughput
+*/
+
+#define BENCH_LEN (1024 * 1024)
+#define BENCH_REPEAT 16
+
+static uint8_t BUF[BENCH_LEN];
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void hash(const uint8_t *data, uint32_t len, uint8_t out[SHA256_LEN])
+{
+    struct sha256 ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, out);
+}
+
+static int hash_is(const uint8_t hash[SHA256_LEN], const char *hex)
+{
+    char str[SHA256_LEN * 2 + 1];
+    for (uint32_t i = 0; i < SHA256_LEN; i++) sprintf(str + i * 2, "%02x", hash[i]);
+    if (!strcmp(str, hex)) return 1;
+    fprintf(stderr, "got %s\nnot %s\n", str, hex);
+    return 0;
+}
+
+static void test_fips_vectors(void)
+{
+    static const struct {const char *msg, *hash;} vectors[] = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+            "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+        {"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+            "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"},
+    };
+    uint8_t out[SHA256_LEN];
+
+    for (uint32_t i = 0; i < ARR_LEN(vectors); i++) {
+        hash((const uint8_t *)vectors[i].msg, strlen(vectors[i].msg), out);
+        CHECK(hash_is(out, vectors[i].hash));
+    }
+
+    // one million 'a's, in uneven pieces
+    struct sha256 ctx;
+    sha256_init(&ctx);
+    memset(BUF, 'a', 1000);
+    for (uint32_t left = 1000000, len = 1; left; left -= len, len = len % 997 + 1) {
+        len = min(len, left);
+        sha256_update(&ctx, BUF, len);
+    }
+    sha256_final(&ctx, out);
+    CHECK(hash_is(out, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"));
+}
+
+/*
+    Lengths either side of where the padding needs another block (from Python's hashlib)
+*/
+static void test_padding(void)
+{
+    static const struct {uint32_t len; const char *hash;} vectors[] = {
+        {55, "b04ac93605b08eac2a555bfc8dfc5f43d997c68b0a26d6a197a3779e40c949df"},
+        {56, "4135b764b69d8b93f134fa73ff31cf2954b85d4b7ccbb369f4925768bfc3db7e"},
+        {63, "8ebe1d16e9e863aede30cc5dfb49dc682d59f7bdd804c47630490a7ece7915c1"},
+        {64, "dd95a227ff8da244c1122b3c896ed6b2f09d7859c410cac3597ebd403fc2f2aa"},
+        {65, "8dd41389f7043eeba5c705d7e7c52472f98780d1c21c9bbacc5920d3a2204c29"},
+        {119, "33b28236500385cbc012d3e11f4aafbd39e5aa7990ad2e70cc6f2c0f25a73276"},
+        {120, "df44054b1fcc8297650a73388d21e273b9c96de2c6396883d7a8c3c116f87fde"},
+        {1000, "ad32c4dda2639b2d517de838d7596dc3cfe26b096ca2f2a85760ae672c098d0e"},
+    };
+    uint8_t out[SHA256_LEN];
+
+    test_fill(BUF, 1000, 7);
+    for (uint32_t i = 0; i < ARR_LEN(vectors); i++) {
+        hash(BUF, vectors[i].len, out);
+        CHECK(hash_is(out, vectors[i].hash));
+    }
+}
+
+/*
+    However the data's split into updates, the hash is the same as doing it in one go
+*/
+static void test_split_updates(void)
+{
+    uint8_t whole[SHA256_LEN], split[SHA256_LEN];
+    uint32_t seed = 5;
+
+    test_fill(BUF, 0x1000, 8);
+    for (int i = 0; i < 500; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        uint32_t len = (i < 200) ? (uint32_t)i : seed % 0x1000;
+        hash(BUF, len, whole);
+
+        struct sha256 ctx;
+        sha256_init(&ctx);
+        uint32_t pos = 0, piece_seed = seed;
+        while (pos < len) {
+            piece_seed = piece_seed * 1103515245 + 12345;
+            uint32_t piece = min((piece_seed >> 16) % 150, len - pos); // including empty updates
+            sha256_update(&ctx, BUF + pos, piece);
+            pos += piece;
+        }
+        sha256_final(&ctx, split);
+        CHECK(!memcmp(whole, split, SHA256_LEN));
+    }
+}
+
+static void test_benchmark(void)
+{
+    uint8_t out[SHA256_LEN];
+    test_fill(BUF, sizeof(BUF), 9);
+
+    double start = now_s();
+    for (int i = 0; i < BENCH_REPEAT; i++) hash(BUF, sizeof(BUF), out);
+    double took_s = now_s() - start;
+
+    printf("sha256: %.0f MB/s\n", BENCH_REPEAT / took_s);
+}
+
+int main(void)
+{
+    RUN_TEST(test_fips_vectors);
+    RUN_TEST(test_padding);
+    RUN_TEST(test_split_updates);
+    RUN_TEST(test_benchmark);
+
+    return TEST_RESULT();
+}
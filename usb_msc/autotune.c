@@ -0,0 +1,319 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "pico/time.h"
+#include "autotune.h"
+#include "flash_util.h"
+#include "fpga_program.h"
+#include "flash_fingerprint.h"
+#include "flash_pre_erase.h"
+#include "crc32.h"
+#include "main.h"
+#include "util.h"
+#include "error.h"
+
+static const uint32_t AUTOTUNE_SPEEDS[] = {(uint32_t)15E6, (uint32_t)20E6, (uint32_t)25E6, (uint32_t)31.25E6,
+    (uint32_t)41.7E6, (uint32_t)62.5E6};
+
+extern uint8_t TEST_RD_BUF[4096];
+extern uint32_t FLASH_BITSTREAM_OFFSET[FLASH_PRE_ERASE_SLOTS];
+
+enum autotune_step {
+    AUTOTUNE_IDLE,
+    AUTOTUNE_FLASH_ERASE, // erase the scratch sector for the next flash speed
+    AUTOTUNE_FLASH_CHECK, // program and read back the pattern at that speed
+    AUTOTUNE_FPGA, // program the FPGA at the next speed
+    AUTOTUNE_STORE_ERASE,
+    AUTOTUNE_STORE
+};
+
+static struct autotune_record RECORD;
+static int RECORD_LOADED = 0;
+
+static enum autotune_step STEP = AUTOTUNE_IDLE;
+static uint8_t SPEED; // index into AUTOTUNE_SPEEDS being tried
+static uint32_t PASSED; // bitmask of speeds that worked
+static uint32_t FLASH_BAUD; // result for the flash, once it's been tuned
+static uint32_t FPGA_OFFSET;
+static uint32_t FPGA_LEN;
+static uint32_t SLOT_RECORDS[FLASH_PRE_ERASE_SLOTS]; // record_crc of each slot's fingerprint before tuning, 0 if none
+
+/*
+    Record and scratch sectors, past the end of the last slot. Returns 0 if the flash is too small
+*/
+static uint32_t record_addr(void)
+{
+    uint32_t size = spi_flash_get_size(SPI_FLASH_BITSTREAM);
+    if (size < 3 * FLASH_SLOT_SIZE + 2 * CONST_4k) return 0;
+    return size - CONST_4k;
+}
+
+static uint32_t record_crc(const struct autotune_record *rec)
+{
+    return crc32c(0, (const uint8_t *)rec, offsetof(struct autotune_record, crc));
+}
+
+static void fill_pattern(uint8_t *buf, uint32_t len, uint32_t seed)
+{
+    // xorshift, so every bit position sees both levels and plenty of transitions
+    for (uint32_t i = 0; i < len; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        buf[i] = seed;
+    }
+}
+
+/*
+    Wait on the flash at the safe speed. Busy reads at a bad speed could spin forever
+*/
+static int wait_flash(uint32_t timeout_us)
+{
+    uint32_t start_us = time_us_32();
+    while (spi_flash_is_busy()) {
+        if (time_us_32() - start_us > timeout_us) return -1;
+    }
+    return 0;
+}
+
+static int pattern_ok(uint32_t addr, uint32_t expected)
+{
+    memset(TEST_RD_BUF, 0x00, AUTOTUNE_PATTERN_LEN);
+    if (spi_flash_read(addr, TEST_RD_BUF, AUTOTUNE_PATTERN_LEN)) return 0;
+    return crc32c(0, TEST_RD_BUF, AUTOTUNE_PATTERN_LEN) == expected;
+}
+
+/*
+    Program a pattern at the safe speed, or (safe not set) at the selected speed, and check it
+    at the safe speed. Returns the pattern's crc32c, or 0 if it didn't program
+*/
+static uint32_t program_pattern(uint32_t addr, int safe)
+{
+    fill_pattern(TEST_RD_BUF, AUTOTUNE_PATTERN_LEN, time_us_32() | 1);
+    uint32_t expected = crc32c(0, TEST_RD_BUF, AUTOTUNE_PATTERN_LEN);
+
+    if (safe) spi_flash_select(SPI_FLASH_BITSTREAM, AUTOTUNE_SAFE_BAUD);
+    int err = spi_flash_write_buffer(addr, TEST_RD_BUF, AUTOTUNE_PATTERN_LEN);
+    spi_flash_select(SPI_FLASH_BITSTREAM, AUTOTUNE_SAFE_BAUD);
+    if (err || wait_flash(100000) || !pattern_ok(addr, expected)) return 0;
+    return expected;
+}
+
+/*
+    Check the flash at baud, using the (erased) scratch sector. 
+
+    Reads come first: the JEDEC ID (for the command path) and a pattern programmed at the safe
+    speed, AUTOTUNE_READS times. Only if they all pass is anything programmed at baud, into the
+    other half of the sector, and checked at the safe speed, since programs use the tuned speed
+    too. A clock that mangles the address phase of a program could hit anywhere in the flash,
+    so it has to have read cleanly first
+*/
+static int flash_speed_ok(uint32_t scratch, uint32_t baud)
+{
+    uint32_t expected = program_pattern(scratch, 1);
+    if (!expected) return 0;
+
+    spi_flash_select(SPI_FLASH_BITSTREAM, baud);
+    for (uint8_t i = 0; i < AUTOTUNE_READS; i++) {
+        if (spi_flash_read_jedec_id() != spi_flash_get_caps(SPI_FLASH_BITSTREAM)->jedec_id) return 0;
+        if (!pattern_ok(scratch, expected)) return 0;
+    }
+
+    expected = program_pattern(scratch + AUTOTUNE_PATTERN_LEN, 0);
+    return expected != 0;
+}
+
+/*
+    Snapshot the slots' fingerprint records (at the safe speed), or with check set, compare them
+    with the snapshot. Nothing in tuning writes outside its own sectors, so a change means a
+    program at a bad clock went astray. Only the records are checked: rereading whole slots
+    would take tens of seconds, and tuning only programs at a speed that has read cleanly.
+
+    Returns -1 if a record changed
+*/
+static int slot_records(int check)
+{
+    int rtn = 0;
+    spi_flash_select(SPI_FLASH_BITSTREAM, AUTOTUNE_SAFE_BAUD);
+    for (uint8_t slot = 0; slot < FLASH_PRE_ERASE_SLOTS; slot++) {
+        struct flash_fingerprint fp;
+        uint32_t crc = flash_fingerprint_read(FLASH_BITSTREAM_OFFSET[slot], &fp) ? 0 : fp.record_crc;
+        if (!check) {
+            SLOT_RECORDS[slot] = crc;
+        } else if (crc != SLOT_RECORDS[slot]) {
+            PRINT_ERR("Slot %u record changed by tuning", slot);
+            rtn = -1;
+        }
+    }
+    return rtn;
+}
+
+/*
+    Pick from the speeds that passed (bitmask, lowest speed first). Stops at the first failure,
+    and backs off a step if there was one
+*/
+static int pick_speed(uint32_t passed)
+{
+    int best = -1;
+    for (uint8_t i = 0; i < ARR_LEN(AUTOTUNE_SPEEDS); i++) {
+        if (!(passed & (1 << i))) {
+            if (best > 0) best--; // margin
+            break;
+        }
+        best = i;
+    }
+    return best;
+}
+
+static uint32_t picked_baud(uint32_t current)
+{
+    int best = pick_speed(PASSED);
+    return (best < 0) ? current : AUTOTUNE_SPEEDS[best];
+}
+
+/*
+    Move on to the next speed if this one passed, or to next once they've all been tried
+    (there's no point going past the first failure)
+*/
+static void next_speed(int ok, enum autotune_step same, enum autotune_step next)
+{
+    if (ok) PASSED |= (1 << SPEED);
+    if (ok && (++SPEED < ARR_LEN(AUTOTUNE_SPEEDS))) {
+        STEP = same;
+        return;
+    }
+    SPEED = 0;
+    STEP = next;
+}
+
+static void start_fpga(struct config_options *opts)
+{
+    FLASH_BAUD = picked_baud(opts->flash_prog_speed);
+    if (slot_records(1)) FLASH_BAUD = AUTOTUNE_SAFE_BAUD;
+    PASSED = 0;
+    FPGA_OFFSET = flash_get_bitstream_offset();
+    FPGA_LEN = flash_bitstream_length(FPGA_OFFSET);
+    if (!FPGA_LEN) {
+        PRINT_INFO("No bitstream, FPGA not tuned");
+        STEP = AUTOTUNE_STORE_ERASE;
+    }
+}
+
+static void load_record(void)
+{
+    uint32_t addr;
+    if (RECORD_LOADED) return;
+    RECORD_LOADED = 1;
+
+    spi_flash_select(SPI_FLASH_BITSTREAM, AUTOTUNE_SAFE_BAUD);
+    addr = record_addr();
+    if (!addr || spi_flash_read(addr, (uint8_t *)&RECORD, sizeof(RECORD)) ||
+        (RECORD.magic != AUTOTUNE_MAGIC) || (RECORD.crc != record_crc(&RECORD))) {
+        RECORD.magic = 0;
+    }
+}
+
+/*
+    Use the stored speeds (if there are any) in opts
+*/
+void autotune_apply(struct config_options *opts)
+{
+    load_record();
+    if (RECORD.magic != AUTOTUNE_MAGIC) return;
+    opts->flash_prog_speed = RECORD.flash_baud;
+    opts->fpga_prog_speed = RECORD.fpga_baud;
+}
+
+/*
+    Start tuning both buses. The work is done by autotune_task()
+*/
+void autotune_start(void)
+{
+    if (!record_addr()) {
+        PRINT_ERR("Flash too small to tune");
+        return;
+    }
+    slot_records(0);
+    STEP = AUTOTUNE_FLASH_ERASE;
+    SPEED = 0;
+    PASSED = 0;
+}
+
+/*
+    Do the next step of tuning. Call from the main loop while USB is being serviced, as it's
+    one erase, a sector program/read back or one FPGA programming at a time.
+
+    When it's finished, the results are stored and put in opts, and the FPGA is left programmed
+    at the new speed. Returns 1 while there's still tuning to do
+*/
+int autotune_task(struct config_options *opts)
+{
+    uint32_t scratch = record_addr() - CONST_4k;
+
+    switch (STEP) {
+        case AUTOTUNE_IDLE:
+            return 0;
+
+        case AUTOTUNE_FLASH_ERASE:
+            spi_flash_select(SPI_FLASH_BITSTREAM, AUTOTUNE_SAFE_BAUD);
+            if (spi_flash_erase_nonblocking(SPI_FLASH_ERASE_4K, scratch)) {
+                next_speed(0, AUTOTUNE_FLASH_ERASE, AUTOTUNE_FPGA);
+                start_fpga(opts);
+                break;
+            }
+            STEP = AUTOTUNE_FLASH_CHECK;
+            break;
+
+        case AUTOTUNE_FLASH_CHECK: {
+            spi_flash_select(SPI_FLASH_BITSTREAM, AUTOTUNE_SAFE_BAUD);
+            if (spi_flash_is_busy()) break;
+            int ok = flash_speed_ok(scratch, AUTOTUNE_SPEEDS[SPEED]);
+            PRINT_INFO("Flash %luHz %s", AUTOTUNE_SPEEDS[SPEED], ok ? "ok" : "fail");
+            spi_flash_select(SPI_FLASH_BITSTREAM, AUTOTUNE_SAFE_BAUD);
+            next_speed(ok, AUTOTUNE_FLASH_ERASE, AUTOTUNE_FPGA);
+            if (STEP == AUTOTUNE_FPGA) start_fpga(opts);
+            break;
+        }
+
+        case AUTOTUNE_FPGA: {
+            // the FPGA checks the bitstream CRC itself, DONE only goes high if it was good
+            uint32_t current = opts->fpga_prog_speed;
+            opts->fpga_prog_speed = AUTOTUNE_SPEEDS[SPEED];
+            program_bitstream_from_flash(FPGA_OFFSET, FPGA_LEN);
+            opts->fpga_prog_speed = current;
+
+            int ok = FPGA_ISDONE();
+            PRINT_INFO("FPGA %luHz %s", fpga_program_get_baud(), ok ? "ok" : "fail");
+            next_speed(ok, AUTOTUNE_FPGA, AUTOTUNE_STORE_ERASE);
+            break;
+        }
+
+        case AUTOTUNE_STORE_ERASE:
+            RECORD.magic = AUTOTUNE_MAGIC;
+            RECORD.flash_baud = FLASH_BAUD;
+            RECORD.fpga_baud = FPGA_LEN ? picked_baud(opts->fpga_prog_speed) : opts->fpga_prog_speed;
+            RECORD.crc = record_crc(&RECORD);
+            RECORD_LOADED = 1;
+
+            spi_flash_select(SPI_FLASH_BITSTREAM, AUTOTUNE_SAFE_BAUD);
+            if (spi_flash_erase_nonblocking(SPI_FLASH_ERASE_4K, record_addr())) PRINT_ERR("Couldn't store tuning");
+            STEP = AUTOTUNE_STORE;
+            break;
+
+        case AUTOTUNE_STORE:
+            spi_flash_select(SPI_FLASH_BITSTREAM, AUTOTUNE_SAFE_BAUD);
+            if (spi_flash_is_busy()) break;
+            if (spi_flash_page_program_nonblocking(record_addr(), (uint8_t *)&RECORD, sizeof(RECORD)) ||
+                wait_flash(100000)) {
+                PRINT_ERR("Couldn't store tuning");
+            }
+
+            opts->flash_prog_speed = RECORD.flash_baud;
+            opts->fpga_prog_speed = RECORD.fpga_baud;
+            PRINT_INFO("Tuned flash %luHz, FPGA %luHz", opts->flash_prog_speed, opts->fpga_prog_speed);
+            startup_program_bitstream();
+            STEP = AUTOTUNE_IDLE;
+            return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+#include "config.h"
+
+#define AUTOTUNE_MAGIC 0x454E5554 // "TUNE"
+#define AUTOTUNE_READS 4 // reads of the test pattern at each speed
+#define AUTOTUNE_SAFE_BAUD CONF_DEFAULT_FLASH_PROG_SPEED // for writing the read pattern and checking
+#define AUTOTUNE_PATTERN_LEN (CONST_4k / 2) // two per scratch sector, one read and one programmed at each speed
+
+/*
+    SPI clock tuning, stored at the end of the bitstream flash so it's kept across resets
+
+    Each bus is stepped up through AUTOTUNE_SPEEDS until a speed fails. The flash is checked by
+    reading back a CRC'd test pattern from a scratch sector, then programming one, and the FPGA by
+    programming the selected bitstream and checking DONE (the FPGA checks the bitstream CRC
+    itself). The fastest speed that passed is used, one step lower if the next one up failed.
+
+    It's run a step at a time from the main loop by autotune_task(), so USB isn't held off.
+*/
+struct autotune_record {
+    uint32_t magic;
+    uint32_t flash_baud;
+    uint32_t fpga_baud;
+    uint32_t crc; // crc32c of everything above
+};
+
+void autotune_apply(struct config_options *opts);
+void autotune_start(void);
+int autotune_task(struct config_options *opts);
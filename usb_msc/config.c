@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <ctype.h>
 #include "config.h"
 #include "util.h"
 #include "error.h"
@@ -6,6 +7,12 @@
 #define FPGA_PROG_SPEED_STR "SPI_FPGA_SPEED"
 #define FLASH_PROG_SPEED_STR "SPI_FLASH_SPEED"
 #define PROG_FLASH_STR "PROG_SPI_FLASH"
+#define DELTA_FLASH_STR "DELTA_FLASH"
+#define SCRATCH_SLOTS_STR "SCRATCH_SLOTS"
+#define VERIFY_STR "VERIFY"
+#define AUTOTUNE_STR "AUTOTUNE"
+
+static const char VERIFY_OPTS[CONF_VERIFY_NUM][8] = {"NONE", "BLOCK", "SECTOR", "IMAGE"};
 
 // simplify operations
 // static uint8_t conf_buf[DISK_SECTOR_SIZE + 1];
@@ -34,6 +41,22 @@ uint8_t *get_config_opt_int(uint8_t *str, enum config_options_int *opt)
             // str += sizeof(PROG_FLASH_STR);
             return strchr(str, '=');
         }
+        if (cmp = strncmp(str, DELTA_FLASH_STR, sizeof(DELTA_FLASH_STR) - 1), !cmp) {
+            *opt = CONF_DELTA_FLASH;
+            return strchr(str, '=');
+        }
+        if (cmp = strncmp(str, SCRATCH_SLOTS_STR, sizeof(SCRATCH_SLOTS_STR) - 1), !cmp) {
+            *opt = CONF_SCRATCH_SLOTS;
+            return strchr(str, '=');
+        }
+        if (cmp = strncmp(str, VERIFY_STR, sizeof(VERIFY_STR) - 1), !cmp) {
+            *opt = CONF_VERIFY;
+            return strchr(str, '=');
+        }
+        if (cmp = strncmp(str, AUTOTUNE_STR, sizeof(AUTOTUNE_STR) - 1), !cmp) {
+            *opt = CONF_AUTOTUNE;
+            return strchr(str, '=');
+        }
     }
 
     // didn't find anything, return NULL
@@ -56,10 +79,18 @@ int write_config_to_file(struct fat_filesystem *fs, struct config_options *opts)
     int file_size = snprintf(data, DISK_SECTOR_SIZE - 1, 
         "%s=%lu\r\n"\
         "%s=%lu\r\n"\
+        "%s=%s\r\n"\
+        "%s=%s\r\n"\
+        "%s=%lu\r\n"\
+        "%s=%s\r\n"\
         "%s=%s\r\n",
         FPGA_PROG_SPEED_STR, opts->fpga_prog_speed,
         FLASH_PROG_SPEED_STR, opts->flash_prog_speed,
-        PROG_FLASH_STR, flash_str_opts[opts->prog_flash]
+        PROG_FLASH_STR, flash_str_opts[opts->prog_flash],
+        DELTA_FLASH_STR, flash_str_opts[opts->delta_flash],
+        SCRATCH_SLOTS_STR, opts->scratch_slots,
+        VERIFY_STR, VERIFY_OPTS[opts->verify],
+        AUTOTUNE_STR, flash_str_opts[opts->autotune]
     );
 
     uint8_t file_size_arr[] = {LE_U32_TO_4U8(file_size)};
@@ -75,16 +106,15 @@ int str_is_valid_integer(const char *x)
     int is_valid = 1;
 
     while (*x == ' ') x++; // skip whitespaces
-    if (*x == '0') { // hex/octal prefix
-        x++;
-        // if 1-9, then it's an octal number
-        if (*x <= '1' || *x >= '9') {
-            // if it's x or X, then it's a hex number
-            if (*x != 'x' && *x != 'X') {
-                return 0;
-            }
-        } else {
-            return 0;
+    if (*x == '0') { // hex/octal prefix, or just 0
+        // if 0-9, then it's an octal number
+        if ((x[1] >= '0') && (x[1] <= '9')) return 0;
+
+        // if it's x or X, then it's a hex number
+        if ((x[1] == 'x') || (x[1] == 'X')) {
+            x += 2;
+            if (!isxdigit(*x)) return 0;
+            while (isxdigit(*x)) x++; //skip all the hex digits
         }
     }
     while (*x >= '0' && *x <= '9') x++; //skip all the numbers
@@ -139,6 +169,37 @@ int parse_config(struct fat_filesystem *fs, struct config_options *opts)
                 }
                 opts->flash_prog_speed = strtoul(cur_line, NULL, 0);
                 break;
+            case CONF_SCRATCH_SLOTS:
+                if (!str_is_valid_integer(cur_line)) {
+                    PRINT_ERR("Invalid integer at %s", cur_line);
+                    return -1;
+                }
+                opts->scratch_slots = strtoul(cur_line, NULL, 0);
+                break;
+            case CONF_VERIFY: {
+                while (*cur_line == ' ') cur_line++; // skip spaces
+                enum config_verify verify;
+                for (verify = 0; verify < CONF_VERIFY_NUM; verify++) {
+                    if (!memcmp(cur_line, VERIFY_OPTS[verify], strlen(VERIFY_OPTS[verify]))) break;
+                }
+                if (verify >= CONF_VERIFY_NUM) {
+                    PRINT_ERR("Invalid option for VERIFY at %s", cur_line);
+                    return -1;
+                }
+                opts->verify = verify;
+                break;
+            }
+            case CONF_AUTOTUNE:
+                while (*cur_line == ' ') cur_line++; // skip spaces
+                if (!memcmp(cur_line, "YES", sizeof("YES") - 1)) {
+                    opts->autotune = true;
+                } else if (!memcmp(cur_line, "NO", sizeof("NO") - 1)) {
+                    opts->autotune = false;
+                } else {
+                    PRINT_ERR("Invalid option for AUTOTUNE at %s", cur_line);
+                    return -1;
+                }
+                break;
             case CONF_PROG_FLASH:
                 while (*cur_line == ' ') cur_line++; // skip spaces
                 if (!memcmp(cur_line, "YES", sizeof("YES") - 1)) {
@@ -150,6 +211,17 @@ int parse_config(struct fat_filesystem *fs, struct config_options *opts)
                     return -1;
                 }
                 break;
+            case CONF_DELTA_FLASH:
+                while (*cur_line == ' ') cur_line++; // skip spaces
+                if (!memcmp(cur_line, "YES", sizeof("YES") - 1)) {
+                    opts->delta_flash = true;
+                } else if (!memcmp(cur_line, "NO", sizeof("NO") - 1)) {
+                    opts->delta_flash = false;
+                } else {
+                    PRINT_ERR("Invalid option for DELTA_FLASH at %s", cur_line);
+                    return -1;
+                }
+                break;
             default:
                 PRINT_ERR("Config parse failed at %s", cur_line);
                 return -1;
@@ -168,4 +240,8 @@ void set_default_config(struct config_options *opts)
     opts->flash_prog_speed = CONF_DEFAULT_FLASH_PROG_SPEED;
     opts->fpga_prog_speed = CONF_DEFAULT_FPGA_PROG_SPEED;
     opts->prog_flash = CONF_DEFAULT_PROG_FLASH;
+    opts->delta_flash = CONF_DEFAULT_DELTA_FLASH;
+    opts->scratch_slots = CONF_DEFAULT_SCRATCH_SLOTS;
+    opts->verify = CONF_DEFAULT_VERIFY;
+    opts->autotune = CONF_DEFAULT_AUTOTUNE;
 }
\ No newline at end of file
@@ -3,10 +3,25 @@
 #include <stdint.h>
 #include "fat_util.h"
 
+/*
+    How uploads are read back and checked
+*/
+enum config_verify {
+    CONF_VERIFY_NONE,
+    CONF_VERIFY_BLOCK, // compare each UF2 block after it's programmed
+    CONF_VERIFY_SECTOR, // crc each 4k sector once it's programmed
+    CONF_VERIFY_IMAGE, // crc the whole image at the end
+    CONF_VERIFY_NUM
+};
+
 enum config_defaults {
     CONF_DEFAULT_FPGA_PROG_SPEED = (int)20E6,
     CONF_DEFAULT_FLASH_PROG_SPEED = (int)20E6,
-    CONF_DEFAULT_PROG_FLASH = true
+    CONF_DEFAULT_PROG_FLASH = true,
+    CONF_DEFAULT_DELTA_FLASH = false, // 4k erases per changed sector, only worth it for small changes
+    CONF_DEFAULT_SCRATCH_SLOTS = 0,
+    CONF_DEFAULT_VERIFY = CONF_VERIFY_BLOCK,
+    CONF_DEFAULT_AUTOTUNE = false
 };
 
 #define MAX_CONFIG_NAME_LEN 32
@@ -14,7 +29,11 @@ enum config_defaults {
 struct config_options {
     uint32_t fpga_prog_speed;
     uint32_t flash_prog_speed;
+    uint32_t scratch_slots; // bitmask of bitstream slots that can be erased while idle
+    enum config_verify verify;
     bool prog_flash;
+    bool delta_flash; // only erase/program sectors that changed
+    bool autotune; // find the fastest working SPI speeds, then clears itself
     bool dirty; // note think about how to do this
 };
 
@@ -22,7 +41,11 @@ enum config_options_int {
     CONF_UNKNOWN,
     CONF_FPGA_PROG_SPEED,
     CONF_FLASH_PROG_SPEED,
-    CONF_PROG_FLASH
+    CONF_PROG_FLASH,
+    CONF_DELTA_FLASH,
+    CONF_SCRATCH_SLOTS,
+    CONF_VERIFY,
+    CONF_AUTOTUNE
 };
 
 int parse_config(struct fat_filesystem *fs, struct config_options *opts);
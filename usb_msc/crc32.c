@@ -14,6 +14,7 @@ Lots of space so the 1kB for the table isn't worth worrying about
 */
 
 #include "crc32.h"
+#include "pico/platform.h"
 
 /*
  * This is the CRC-32C table
@@ -92,11 +93,114 @@ static const uint32_t crc32c_table[256] = {
 };
 
 
-uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length)
+/*
+    Slicing-by-4 tables, built in SRAM on first use. crc32c_slice[0] is crc32c_table.
+    Slicing-by-8 was tried, but the M0+ runs out of low registers for it and it's no faster
+*/
+static uint32_t crc32c_slice[4][256];
+static int crc32c_slice_ready = 0;
+
+/*
+    x^(2^k) mod the CRC polynomial, for crc32c_combine(). Built with the slices
+*/
+static uint32_t crc32c_x2n_table[32];
+
+static uint32_t crc32c_multmodp(uint32_t a, uint32_t b);
+
+static void crc32c_init_slices(void)
+{
+    uint32_t p = (uint32_t)1 << 30; // x^1
+    for (int k = 0; k < 32; k++) {
+        crc32c_x2n_table[k] = p;
+        p = crc32c_multmodp(p, p);
+    }
+
+    for (int i = 0; i < 256; i++) {
+        crc32c_slice[0][i] = crc32c_table[i];
+    }
+    for (int k = 1; k < 4; k++) {
+        for (int i = 0; i < 256; i++) {
+            uint32_t prev = crc32c_slice[k - 1][i];
+            crc32c_slice[k][i] = (prev >> 8) ^ crc32c_slice[0][prev & 0xFF];
+        }
+    }
+    crc32c_slice_ready = 1;
+}
+
+/*
+    Runs from SRAM, along with its tables, so it isn't held up by XIP cache misses
+*/
+uint32_t __not_in_flash_func(crc32c)(uint32_t crc, const uint8_t *data, unsigned int length)
 {
+    if (!crc32c_slice_ready) crc32c_init_slices();
+
     crc ^= 0xffffffff;
+    while (length && ((uintptr_t)data & 0b11)) {
+        crc = crc32c_slice[0][(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
+        length--;
+    }
+
+    // a word at a time (little endian), two words per loop
+    const uint32_t *words = (const uint32_t *)data;
+    while (length >= 8) {
+        crc ^= *words++;
+        crc = crc32c_slice[3][crc & 0xFF] ^ crc32c_slice[2][(crc >> 8) & 0xFF] ^
+            crc32c_slice[1][(crc >> 16) & 0xFF] ^ crc32c_slice[0][crc >> 24];
+        crc ^= *words++;
+        crc = crc32c_slice[3][crc & 0xFF] ^ crc32c_slice[2][(crc >> 8) & 0xFF] ^
+            crc32c_slice[1][(crc >> 16) & 0xFF] ^ crc32c_slice[0][crc >> 24];
+        length -= 8;
+    }
+
+    data = (const uint8_t *)words;
     while (length--) {
-        crc = crc32c_table[(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
+        crc = crc32c_slice[0][(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
     }
     return crc^0xffffffff;
-}
\ No newline at end of file
+}
+
+#define CRC32C_POLY 0x82F63B78 // reflected
+
+/*
+    a * b mod the CRC polynomial (reflected, so x^0 is the top bit)
+*/
+static uint32_t crc32c_multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = (uint32_t)1 << 31;
+    uint32_t p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+/*
+    x^(8 * len) mod the CRC polynomial
+*/
+static uint32_t crc32c_x8nmodp(uint32_t len)
+{
+    if (!crc32c_slice_ready) crc32c_init_slices();
+
+    uint32_t p = (uint32_t)1 << 31; // x^0
+    int k = 3; // x^8, i.e. one byte
+    while (len) {
+        if (len & 1) p = crc32c_multmodp(crc32c_x2n_table[k & 31], p);
+        len >>= 1;
+        k++;
+    }
+    return p;
+}
+
+/*
+    CRC of A followed by B, from crc_a, crc_b and B's length. Lets pieces of something
+    be CRC'd separately (e.g. out of order) and put together afterwards
+*/
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint32_t len_b)
+{
+    return crc32c_multmodp(crc32c_x8nmodp(len_b), crc_a) ^ crc_b;
+}
@@ -2,4 +2,5 @@
 #include <stdint.h>
 #include <stdlib.h>
 // uint32_t crc32c(uint32_t crc, const void *buf, size_t size);
-uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length);
\ No newline at end of file
+uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length);
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint32_t len_b);
\ No newline at end of file
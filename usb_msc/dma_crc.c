@@ -0,0 +1,92 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "hardware/dma.h"
+#include "dma_crc.h"
+
+static volatile int SNIFF_ATTACHED = 0;
+static int CRC_DMA = -1; // channel for dma_crc32()
+static uint32_t CRC_DMA_SINK;
+
+/*
+    The sniffer's CRC32R mode works MSB first on bit reversed data, so the standard
+    (reflected, inverted) CRC-32 state is bit reversed going in and out
+*/
+static uint32_t bit_reverse(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+    x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+    x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+/*
+    Sniff the next transfer on channel, continuing from crc. config is the one the transfer will
+    be started with
+*/
+void dma_crc_attach(uint channel, dma_channel_config *config, uint32_t crc)
+{
+    while (SNIFF_ATTACHED); // someone else's transfer is still going
+    SNIFF_ATTACHED = 1;
+    channel_config_set_sniff_enable(config, true);
+    dma_sniffer_enable(channel, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, false);
+    dma_sniffer_set_data_accumulator(bit_reverse(~crc));
+}
+
+/*
+    Get the CRC once the sniffed transfer is finished, and free up the sniffer. Safe to call from an IRQ
+*/
+uint32_t dma_crc_detach(void)
+{
+    uint32_t crc = ~bit_reverse(dma_sniffer_get_data_accumulator());
+    dma_sniffer_disable();
+    SNIFF_ATTACHED = 0;
+    return crc;
+}
+
+int dma_crc_is_attached(void)
+{
+    return SNIFF_ATTACHED;
+}
+
+/*
+    Run len bytes at src through the sniffer with the crc channel, into dst or (dst NULL) a
+    dummy sink
+*/
+static uint32_t dma_crc_transfer(uint32_t crc, void *dst, const void *src, uint32_t len)
+{
+    if (!len) return crc;
+    if (CRC_DMA < 0) CRC_DMA = dma_claim_unused_channel(true);
+
+    dma_channel_config c = dma_channel_get_default_config(CRC_DMA);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, dst != NULL);
+
+    // word transfers when possible. The sniffer bit reverses whole words, which on little endian
+    // is the same as going byte by byte
+    int words = !(((uintptr_t)src | (uintptr_t)dst | len) & 0b11);
+    channel_config_set_transfer_data_size(&c, words ? DMA_SIZE_32 : DMA_SIZE_8);
+
+    dma_crc_attach(CRC_DMA, &c, crc);
+    dma_channel_configure(CRC_DMA, &c, dst ? dst : &CRC_DMA_SINK, src, words ? len / 4 : len, true);
+    dma_channel_wait_for_finish_blocking(CRC_DMA);
+    return dma_crc_detach();
+}
+
+/*
+    CRC of len bytes at data, continuing from crc. The DMA reads it all into a dummy sink,
+    which is much quicker than the CPU doing it
+*/
+uint32_t dma_crc32(uint32_t crc, const void *data, uint32_t len)
+{
+    return dma_crc_transfer(crc, NULL, data, len);
+}
+
+/*
+    memcpy() by DMA, returning the CRC of what was copied, continuing from crc. For data that
+    has to be copied anyway, so the CRC doesn't need its own pass
+*/
+uint32_t dma_crc32_copy(uint32_t crc, void *dst, const void *src, uint32_t len)
+{
+    return dma_crc_transfer(crc, dst, src, len);
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <stdint.h>
+#include "hardware/dma.h"
+
+/*
+    CRC-32 (IEEE, the same value as zlib's crc32()) from the DMA sniffer
+
+    The sniffer can't do CRC32C, so anything that has to match a crc32c() value (Xilinx
+    bitstream CRCs, the upload fingerprints) still uses the software one. Values from here are 
+    only compared with other values from here.
+
+    There's only one sniffer. It's attached to a channel for the length of one transfer, and the
+    result is read back as soon as that transfer is done, so it's never held for long.
+    Chain transfers by passing the last result back in as crc, like crc32c().
+*/
+
+void dma_crc_attach(uint channel, dma_channel_config *config, uint32_t crc);
+uint32_t dma_crc_detach(void);
+int dma_crc_is_attached(void);
+uint32_t dma_crc32(uint32_t crc, const void *data, uint32_t len);
+uint32_t dma_crc32_copy(uint32_t crc, void *dst, const void *src, uint32_t len);
@@ -0,0 +1,109 @@
+#include <stdint.h>
+#include <string.h>
+#include "flash_delta.h"
+#include "flash_util.h"
+#include "util.h"
+#include "error.h"
+
+void flash_delta_start(struct flash_delta *delta, int verify)
+{
+    delta->verify = verify;
+    delta->sector = -1;
+    delta->needs_erase = 0;
+    delta->changed_pages = 0;
+    delta->sectors_written = 0;
+    delta->sectors_skipped = 0;
+}
+
+/*
+    Read the sector back and check it matches what's staged, including pages that were
+    only erased
+*/
+static int verify_sector(struct flash_delta *delta)
+{
+    uint8_t rd_buf[SPI_FLASH_PAGE_SIZE];
+    for (uint32_t i = 0; i < FLASH_DELTA_SECTOR_SIZE; i += sizeof(rd_buf)) {
+        if (spi_flash_read(delta->sector + i, rd_buf, sizeof(rd_buf))) return -1;
+        if (memcmp(rd_buf, delta->buf + i, sizeof(rd_buf))) return -1;
+    }
+    return 0;
+}
+
+/*
+    Write the staged sector to flash if it's changed, then verify it.
+
+    Returns -1 on a programming or verify error
+*/
+int flash_delta_flush(struct flash_delta *delta)
+{
+    int rtn = 0;
+    if (delta->sector < 0) return 0;
+
+    if (!delta->changed_pages) {
+        delta->sectors_skipped++;
+    } else {
+        if (delta->needs_erase) {
+            if (spi_flash_sector_erase_blocking(delta->sector)) rtn = -1;
+            if (spi_flash_write_buffer(delta->sector, delta->buf, FLASH_DELTA_SECTOR_SIZE)) rtn = -1;
+        } else {
+            // only clearing bits, so the changed pages can be programmed over the old data
+            for (uint32_t page = 0; page < FLASH_DELTA_PAGES_PER_SECTOR; page++) {
+                if (!(delta->changed_pages & (1 << page))) continue;
+                if (spi_flash_write_buffer(delta->sector + page * SPI_FLASH_PAGE_SIZE,
+                    delta->buf + page * SPI_FLASH_PAGE_SIZE, SPI_FLASH_PAGE_SIZE)) rtn = -1;
+            }
+        }
+        if (delta->verify && verify_sector(delta)) {
+            PRINT_ERR("Verify error @ %lX", delta->sector);
+            rtn = -1;
+        }
+        delta->sectors_written++;
+    }
+
+    delta->sector = -1;
+    delta->needs_erase = 0;
+    delta->changed_pages = 0;
+    return rtn;
+}
+
+/*
+    Stage len bytes for addr. Moving to a different sector flushes the
+    currently staged one.
+
+    Returns -1 if flushing the previous sector failed
+*/
+int flash_delta_write(struct flash_delta *delta, uint32_t addr, const uint8_t *data, uint32_t len)
+{
+    int rtn = 0;
+    while (len) {
+        uint32_t sector = addr & ~(FLASH_DELTA_SECTOR_SIZE - 1);
+        uint32_t offset = addr - sector;
+        uint32_t chunk = min(len, FLASH_DELTA_SECTOR_SIZE - offset);
+
+        if (delta->sector != (int32_t)sector) {
+            if (flash_delta_flush(delta)) rtn = -1;
+            // start from what's in flash, so parts of the sector that aren't written are kept
+            if (spi_flash_read(sector, delta->buf, FLASH_DELTA_SECTOR_SIZE)) {
+                // don't know what's there, so rewrite all of it
+                PRINT_ERR("Read error @ %lX", sector);
+                memset(delta->buf, 0xFF, FLASH_DELTA_SECTOR_SIZE);
+                delta->changed_pages = 0xFFFF;
+                delta->needs_erase = 1;
+            }
+            delta->sector = sector;
+        }
+
+        for (uint32_t i = 0; i < chunk; i++) {
+            uint8_t old = delta->buf[offset + i];
+            if (old == data[i]) continue;
+            if ((old & data[i]) != data[i]) delta->needs_erase = 1;
+            delta->changed_pages |= 1 << ((offset + i) / SPI_FLASH_PAGE_SIZE);
+        }
+        memcpy(delta->buf + offset, data, chunk);
+
+        addr += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+    return rtn;
+}
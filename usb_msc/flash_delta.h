@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include "flash_util.h"
+
+#define FLASH_DELTA_SECTOR_SIZE CONST_4k
+#define FLASH_DELTA_PAGES_PER_SECTOR (FLASH_DELTA_SECTOR_SIZE / SPI_FLASH_PAGE_SIZE)
+
+/*
+    Delta flashing for an image being written to flash
+
+    Incoming data is staged one 4k sector at a time on top of what's already in flash.
+    When the writes move on to another sector, the staged sector is only erased/programmed
+    if it actually changed, so re-uploading a mostly unchanged image only touches the sectors
+    that differ. If a change only clears bits, the changed pages are programmed without an erase.
+*/
+struct flash_delta {
+    int32_t sector; // address of the staged sector, -1 if none
+    uint8_t needs_erase; // staged data sets a bit that's currently cleared in flash
+    uint16_t changed_pages; // bitmask of pages that differ from flash
+    uint32_t sectors_written;
+    uint32_t sectors_skipped;
+    uint8_t verify; // read back written sectors
+    uint8_t buf[FLASH_DELTA_SECTOR_SIZE];
+};
+
+void flash_delta_start(struct flash_delta *delta, int verify);
+int flash_delta_write(struct flash_delta *delta, uint32_t addr, const uint8_t *data, uint32_t len);
+int flash_delta_flush(struct flash_delta *delta);
@@ -0,0 +1,263 @@
+#include <stdint.h>
+#include <string.h>
+#include "pico/time.h"
+#include "flash_erase.h"
+#include "flash_util.h"
+#include "util.h"
+#include "error.h"
+
+static const uint32_t ERASE_SIZES[] = {CONST_4k, CONST_32k, CONST_64k}; // indexed by enum spi_flash_erase_type
+
+static int block_is_prepared(struct flash_erase_sched *sched, uint32_t block)
+{
+    return sched->prepared[block / 8] & (1 << (block % 8));
+}
+
+static void block_set_prepared(struct flash_erase_sched *sched, uint32_t block)
+{
+    sched->prepared[block / 8] |= (1 << (block % 8));
+}
+
+/*
+    Cheapest (by typical time) way to erase the part of [start, end) inside the region of
+    the given erase type at base. Anything outside of [start, end) may only be erased if it's below 
+    limit. 
+    
+    If emit is set, the chosen erases are added to plan.
+    Returns the typical time in ms, or UINT32_MAX if it can't be done
+*/
+static uint32_t plan_region(const struct spi_flash_caps *caps, enum spi_flash_erase_type type, uint32_t base,
+    uint32_t start, uint32_t end, uint32_t limit, struct flash_erase_plan *plan, int emit)
+{
+    uint32_t size = ERASE_SIZES[type];
+    if ((base + size <= start) || (base >= end)) return 0; // nothing in here to erase
+
+    uint32_t whole_cost = UINT32_MAX;
+    if ((base >= start) && (base + size <= limit) && (caps->erase_supported & (1 << type))) {
+        whole_cost = caps->erase_times[type].typ_ms;
+    }
+
+    if (type != SPI_FLASH_ERASE_4K) {
+        enum spi_flash_erase_type sub_type = type - 1;
+        uint32_t split_cost = 0;
+        for (uint32_t sub = base; sub < base + size; sub += ERASE_SIZES[sub_type]) {
+            uint32_t cost = plan_region(caps, sub_type, sub, start, end, limit, NULL, 0);
+            if (cost == UINT32_MAX) {
+                split_cost = UINT32_MAX;
+                break;
+            }
+            split_cost += cost;
+        }
+
+        if (split_cost < whole_cost) {
+            if (emit) {
+                for (uint32_t sub = base; sub < base + size; sub += ERASE_SIZES[sub_type]) {
+                    plan_region(caps, sub_type, sub, start, end, limit, plan, 1);
+                }
+            }
+            return split_cost;
+        }
+    }
+
+    if (whole_cost == UINT32_MAX) return UINT32_MAX;
+    if (emit && (plan->num_ops < FLASH_ERASE_PLAN_MAX_OPS)) {
+        plan->ops[plan->num_ops].type = type;
+        plan->ops[plan->num_ops].addr = base;
+        plan->num_ops++;
+    }
+    return whole_cost;
+}
+
+/*
+    Plan the erases needed to clear [start, end), which must be within one 64k block, using 4k, 32k
+    and 64k erases (whichever the chip supports). Erasing past end is allowed up to limit (i.e. the rest of the block is don't care), 
+    which lets a 32k or 64k erase be used when it's faster than a bunch of 4k erases.
+
+    start must be 4k aligned and limit must be at least end rounded up to 4k.
+    Returns -1 if that isn't the case, or the chip has no erase that can do it
+*/
+int flash_erase_plan_block(enum spi_flash_chip chip, uint32_t start, uint32_t end, uint32_t limit, struct flash_erase_plan *plan)
+{
+    uint32_t block = start & ~(FLASH_ERASE_BLOCK_SIZE - 1);
+
+    plan->num_ops = 0;
+    plan->est_ms = 0;
+    if (sector_alignment(start) || (end <= start) || (end > block + FLASH_ERASE_BLOCK_SIZE)) return -1;
+    if (limit < ((end + CONST_4k - 1) & ~(CONST_4k - 1))) return -1;
+
+    plan->est_ms = plan_region(spi_flash_get_caps(chip), SPI_FLASH_ERASE_64K, block, start, end, limit, plan, 1);
+    return (plan->est_ms == UINT32_MAX) ? -1 : 0;
+}
+
+/*
+    Run the erases in plan, waiting for each one
+*/
+static int run_plan(struct flash_erase_plan *plan)
+{
+    for (uint8_t i = 0; i < plan->num_ops; i++) {
+        if (spi_flash_erase_nonblocking(plan->ops[i].type, plan->ops[i].addr)) return -1;
+        while (spi_flash_is_busy());
+    }
+    return 0;
+}
+
+/*
+    Erase [addr, addr + len) on the current flash using the cheapest mix of erases.
+    Anything from addr + len up to limit may also be erased. Uses a chip erase if the
+    range covers the whole chip.
+
+    Blocks until finished. The estimated and actual times are logged
+*/
+int flash_erase_range(uint32_t addr, uint32_t len, uint32_t limit)
+{
+    enum spi_flash_chip chip = spi_flash_get_current_chip();
+    uint32_t end = addr + len;
+    uint32_t est_ms = 0;
+    uint32_t start_us = time_us_32();
+    struct flash_erase_plan plan;
+
+    if (!len) return 0;
+    if ((addr == 0) && (end >= spi_flash_get_size(chip))) {
+        plan.ops[0].type = SPI_FLASH_ERASE_CHIP;
+        plan.ops[0].addr = 0;
+        plan.num_ops = 1;
+        est_ms = spi_flash_get_erase_times(chip)[SPI_FLASH_ERASE_CHIP].typ_ms;
+        if (run_plan(&plan)) return -1;
+    } else {
+        for (uint32_t cur = addr; cur < end; cur = (cur & ~(FLASH_ERASE_BLOCK_SIZE - 1)) + FLASH_ERASE_BLOCK_SIZE) {
+            uint32_t block_end = (cur & ~(FLASH_ERASE_BLOCK_SIZE - 1)) + FLASH_ERASE_BLOCK_SIZE;
+            if (flash_erase_plan_block(chip, cur, min(end, block_end), min(limit, block_end), &plan)) return -1;
+            if (run_plan(&plan)) return -1;
+            est_ms += plan.est_ms;
+        }
+    }
+
+    PRINT_INFO("Erase %lX-%lX est %lums took %lums", addr, end, est_ms, (time_us_32() - start_us) / 1000);
+    return 0;
+}
+
+static void sched_erase_done(struct flash_job *job)
+{
+    if (job->state == FLASH_JOB_ERROR) PRINT_ERR("Erase err @ %lX", job->addr);
+}
+
+/*
+    Queue the erase of one block of the image. The last block is only erased as far as needed.
+    If all the scheduler's jobs are still queued, runs the job queue until one frees up
+*/
+static int sched_erase_block(struct flash_erase_sched *sched, uint32_t block)
+{
+    struct flash_erase_sched_job *erase = NULL;
+    uint32_t block_addr = sched->base + block * FLASH_ERASE_BLOCK_SIZE;
+    uint32_t block_end = block_addr + FLASH_ERASE_BLOCK_SIZE;
+
+    uint32_t start_us = time_us_32();
+    while (!erase) {
+        for (uint8_t i = 0; i < FLASH_ERASE_SCHED_JOBS; i++) {
+            if (!flash_job_is_busy(&sched->jobs[i].job)) {
+                erase = &sched->jobs[i];
+                break;
+            }
+        }
+        if (!erase) flash_job_task();
+    }
+    sched->wait_us += time_us_32() - start_us;
+
+    if (flash_erase_plan_block(sched->chip, block_addr, min(block_end, sched->end), block_end, &erase->plan)) return -1;
+    sched->est_ms += erase->plan.est_ms;
+    erase->job = (struct flash_job){.type = FLASH_JOB_ERASE, .chip = sched->chip, .baud = sched->baud,
+        .addr = block_addr, .plan = &erase->plan, .cb = sched_erase_done};
+    return flash_job_submit(&erase->job);
+}
+
+/*
+    Reset the scheduler for a new image of len bytes at base on chip. Nothing is erased until
+    something is written. The last image's erases must be finished
+*/
+void flash_erase_sched_start(struct flash_erase_sched *sched, enum spi_flash_chip chip, uint32_t baud, uint32_t base, uint32_t len)
+{
+    memset(sched, 0x00, sizeof(*sched));
+    sched->chip = chip;
+    sched->baud = baud;
+    sched->base = base;
+    sched->end = base + len;
+    sched->num_blocks = min((len + FLASH_ERASE_BLOCK_SIZE - 1) / FLASH_ERASE_BLOCK_SIZE, FLASH_ERASE_MAX_BLOCKS);
+}
+
+/*
+    Check if any of the scheduler's erases are still queued or running
+*/
+int flash_erase_sched_is_busy(struct flash_erase_sched *sched)
+{
+    for (uint8_t i = 0; i < FLASH_ERASE_SCHED_JOBS; i++) {
+        if (flash_job_is_busy(&sched->jobs[i].job)) return 1;
+    }
+    return 0;
+}
+
+/*
+    Run the job queue until the scheduler's erases are finished
+*/
+void flash_erase_sched_wait(struct flash_erase_sched *sched)
+{
+    uint32_t start_us = time_us_32();
+    while (flash_erase_sched_is_busy(sched)) flash_job_task();
+    sched->wait_us += time_us_32() - start_us;
+}
+
+/*
+    Mark the 64k block at addr as already erased (e.g. by the idle pre-erase), so the
+    scheduler never erases it
+*/
+void flash_erase_sched_skip(struct flash_erase_sched *sched, uint32_t addr)
+{
+    if (addr < sched->base) return;
+    uint32_t block = (addr - sched->base) / FLASH_ERASE_BLOCK_SIZE;
+    if (block < sched->num_blocks) block_set_prepared(sched, block);
+}
+
+/*
+    Make sure everything from addr to addr + len is erased before it's programmed, by queueing
+    erases for any of it that isn't yet. Programs submitted to the job queue afterwards run
+    after them, so this doesn't wait for the chip.
+
+    Returns -1 if the range is outside the image, or an erase couldn't be queued
+*/
+int flash_erase_sched_prepare(struct flash_erase_sched *sched, uint32_t addr, uint32_t len)
+{
+    if ((addr < sched->base) || !len) return -1;
+
+    uint32_t first = (addr - sched->base) / FLASH_ERASE_BLOCK_SIZE;
+    uint32_t last = (addr + len - 1 - sched->base) / FLASH_ERASE_BLOCK_SIZE;
+    if (last >= sched->num_blocks) return -1;
+
+    for (uint32_t block = first; block <= last; block++) {
+        if (block_is_prepared(sched, block)) continue;
+        if (sched_erase_block(sched, block)) return -1;
+        block_set_prepared(sched, block);
+    }
+    return 0;
+}
+
+/*
+    Queue the erase of the next block that isn't erased within FLASH_ERASE_AHEAD_BLOCKS of
+    cursor (the address just past the last write).
+
+    Does nothing if one of the scheduler's erases is still queued or running, so the
+    erases stay just ahead of the programs rather than all being queued at once
+*/
+int flash_erase_sched_ahead(struct flash_erase_sched *sched, uint32_t cursor)
+{
+    if ((cursor < sched->base) || !sched->num_blocks) return -1;
+    if (flash_erase_sched_is_busy(sched)) return 0;
+
+    uint32_t cur_block = (cursor - sched->base) / FLASH_ERASE_BLOCK_SIZE;
+    uint32_t last = min(cur_block + FLASH_ERASE_AHEAD_BLOCKS, sched->num_blocks - 1);
+    for (uint32_t block = cur_block; block <= last; block++) {
+        if (block_is_prepared(sched, block)) continue;
+        if (sched_erase_block(sched, block)) return -1;
+        block_set_prepared(sched, block);
+        break;
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <stdint.h>
+#include "flash_util.h"
+#include "flash_job.h"
+
+#define FLASH_ERASE_BLOCK_SIZE CONST_64k
+#define FLASH_ERASE_MAX_BLOCKS 512 // 32MB of flash
+#define FLASH_ERASE_AHEAD_BLOCKS 2 // how far ahead of the write cursor to erase
+#define FLASH_ERASE_PLAN_MAX_OPS (FLASH_ERASE_BLOCK_SIZE / CONST_4k)
+#define FLASH_ERASE_SCHED_JOBS 3 // block erases queued at once, counts against FLASH_JOB_QUEUE_LEN
+
+struct flash_erase_op {
+    enum spi_flash_erase_type type;
+    uint32_t addr;
+};
+
+/*
+    Erases used to cover (part of) one 64k block, or the whole chip
+*/
+struct flash_erase_plan {
+    struct flash_erase_op ops[FLASH_ERASE_PLAN_MAX_OPS];
+    uint8_t num_ops;
+    uint32_t est_ms; // typical time for all ops
+};
+
+struct flash_erase_sched_job {
+    struct flash_job job;
+    struct flash_erase_plan plan;
+};
+
+/*
+    Erase scheduling for an image being written to flash
+
+    Instead of erasing the whole image up front, blocks are erased just ahead of the write cursor,
+    so the erase runs while the host sends the next data. Blocks that are written out of order 
+    are erased on demand.
+
+    Erases are flash jobs on the image's chip, queued ahead of the programs that need them, so
+    nothing here waits for the chip. The job queue runs them in order.
+*/
+struct flash_erase_sched {
+    enum spi_flash_chip chip;
+    uint32_t baud;
+    uint32_t base; // start of the image, must be 64k aligned
+    uint32_t end; // end of the image
+    uint32_t num_blocks; // number of 64k blocks the image covers
+    uint32_t est_ms; // typical time of all erases done so far
+    uint32_t wait_us; // time spent blocked waiting for a free job
+    uint8_t prepared[FLASH_ERASE_MAX_BLOCKS / 8]; // blocks erased, or queued to be, for this image
+    struct flash_erase_sched_job jobs[FLASH_ERASE_SCHED_JOBS];
+};
+
+void flash_erase_sched_start(struct flash_erase_sched *sched, enum spi_flash_chip chip, uint32_t baud, uint32_t base, uint32_t len);
+int flash_erase_sched_prepare(struct flash_erase_sched *sched, uint32_t addr, uint32_t len);
+int flash_erase_sched_ahead(struct flash_erase_sched *sched, uint32_t cursor);
+void flash_erase_sched_wait(struct flash_erase_sched *sched);
+int flash_erase_sched_is_busy(struct flash_erase_sched *sched);
+void flash_erase_sched_skip(struct flash_erase_sched *sched, uint32_t addr);
+
+int flash_erase_plan_block(enum spi_flash_chip chip, uint32_t start, uint32_t end, uint32_t limit, struct flash_erase_plan *plan);
+int flash_erase_range(uint32_t addr, uint32_t len, uint32_t limit);
@@ -0,0 +1,92 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "flash_fingerprint.h"
+#include "flash_util.h"
+#include "crc32.h"
+#include "util.h"
+
+/*
+    Address of the slot's record sector. The idle pre-erase keeps its progress here too
+*/
+uint32_t flash_fingerprint_sector(uint32_t slot_base)
+{
+    return slot_base + FLASH_SLOT_SIZE - FLASH_FINGERPRINT_SECTOR_SIZE;
+}
+
+static uint32_t record_crc(const struct flash_fingerprint *fp)
+{
+    return crc32c(0, (const uint8_t *)fp, offsetof(struct flash_fingerprint, record_crc));
+}
+
+/*
+    Fill in the UF2 header summary from any block of the upload. len and crc are left for the caller
+*/
+void flash_fingerprint_from_block(const struct UF2_Block *blk, struct flash_fingerprint *fp)
+{
+    memset(fp, 0, sizeof(*fp));
+    fp->magic = FLASH_FINGERPRINT_MAGIC;
+    fp->family_id = blk->fileSize;
+    fp->target_addr = blk->targetAddr - blk->blockNo * blk->payloadSize;
+    fp->payload_size = blk->payloadSize;
+    fp->num_blocks = blk->numBlocks;
+}
+
+int flash_fingerprint_header_matches(const struct flash_fingerprint *a, const struct flash_fingerprint *b)
+{
+    return (a->family_id == b->family_id) && (a->target_addr == b->target_addr) &&
+        (a->payload_size == b->payload_size) && (a->num_blocks == b->num_blocks);
+}
+
+/*
+    Read the record for the slot at slot_base on the current flash
+
+    Returns -1 if there isn't a valid one
+*/
+int flash_fingerprint_read(uint32_t slot_base, struct flash_fingerprint *fp)
+{
+    uint32_t addr = flash_fingerprint_sector(slot_base);
+    if (addr + FLASH_FINGERPRINT_SECTOR_SIZE > spi_flash_get_size(spi_flash_get_current_chip())) return -1;
+    if (spi_flash_read(addr, (uint8_t *)fp, sizeof(*fp))) return -1;
+    if (fp->magic != FLASH_FINGERPRINT_MAGIC) return -1;
+    if (fp->record_crc != record_crc(fp)) return -1;
+    return 0;
+}
+
+/*
+    Replace the record for the slot at slot_base on the current flash
+
+    Returns -1 if the image runs into the record sector or the write fails
+*/
+int flash_fingerprint_write(uint32_t slot_base, struct flash_fingerprint *fp)
+{
+    uint32_t addr = flash_fingerprint_sector(slot_base);
+    if (fp->len > FLASH_SLOT_SIZE - FLASH_FINGERPRINT_SECTOR_SIZE) return -1;
+    if (addr + FLASH_FINGERPRINT_SECTOR_SIZE > spi_flash_get_size(spi_flash_get_current_chip())) return -1;
+
+    fp->magic = FLASH_FINGERPRINT_MAGIC;
+    fp->record_crc = record_crc(fp);
+    if (spi_flash_sector_erase_blocking(addr)) return -1;
+    return spi_flash_page_program_blocking(addr, (uint8_t *)fp, sizeof(*fp));
+}
+
+/*
+    Remove the record for the slot at slot_base, e.g. when the image written can't be fingerprinted
+*/
+int flash_fingerprint_clear(uint32_t slot_base)
+{
+    struct flash_fingerprint fp;
+    if (flash_fingerprint_read(slot_base, &fp)) return 0; // nothing to clear
+    return spi_flash_sector_erase_blocking(flash_fingerprint_sector(slot_base));
+}
+
+/*
+    Check len bytes of data against what's in flash at addr
+*/
+int flash_fingerprint_block_matches(uint32_t addr, const uint8_t *data, uint32_t len)
+{
+    uint8_t rd_buf[sizeof(((struct UF2_Block *)0)->data)];
+    if (len > sizeof(rd_buf)) return 0;
+    if (spi_flash_read(addr, rd_buf, len)) return 0;
+    return !memcmp(rd_buf, data, len);
+}
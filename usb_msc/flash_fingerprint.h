@@ -0,0 +1,46 @@
+#pragma once
+#include <stdint.h>
+#include "uf2.h"
+#include "flash_util.h"
+#include "sha256.h"
+
+#define FLASH_SLOT_SIZE (10 * 1024 * 1024)
+#define FLASH_FINGERPRINT_SECTOR_SIZE CONST_4k
+#define FLASH_FINGERPRINT_MAGIC 0x32465046 // "FPF2"
+
+enum flash_fingerprint_flags {
+    FLASH_FINGERPRINT_SHA_VALID = 0x01, // sha256 is of the image
+    FLASH_FINGERPRINT_SHA_VERIFIED = 0x02, // and matched the UF2's SHA-2 tag
+};
+
+/*
+    Record of the image last written to a flash slot
+
+    Kept in the last 4k sector of a bitstream slot. The firmware flash isn't given one, as it's
+    the FPGA design's to use. The UF2 header summary is checked against the first
+    block of an upload to decide whether it might be the same image, and the length and CRC32C 
+    (over the payloads in block order) against the whole upload.
+
+    The SHA-256 is over the same data. If the UF2 carried a SHA-2 tag and it matched, 
+    FLASH_FINGERPRINT_SHA_VERIFIED is set, so the image doesn't need hashing again.
+*/
+struct flash_fingerprint {
+    uint32_t magic;
+    uint32_t family_id;
+    uint32_t target_addr; // of block 0
+    uint32_t payload_size;
+    uint32_t num_blocks;
+    uint32_t len;
+    uint32_t crc;
+    uint32_t flags;
+    uint8_t sha256[SHA256_LEN];
+    uint32_t record_crc; // crc32c of everything above
+};
+
+void flash_fingerprint_from_block(const struct UF2_Block *blk, struct flash_fingerprint *fp);
+int flash_fingerprint_header_matches(const struct flash_fingerprint *a, const struct flash_fingerprint *b);
+int flash_fingerprint_read(uint32_t slot_base, struct flash_fingerprint *fp);
+int flash_fingerprint_write(uint32_t slot_base, struct flash_fingerprint *fp);
+int flash_fingerprint_clear(uint32_t slot_base);
+uint32_t flash_fingerprint_sector(uint32_t slot_base);
+int flash_fingerprint_block_matches(uint32_t addr, const uint8_t *data, uint32_t len);
@@ -0,0 +1,204 @@
+#include <stdint.h>
+#include <string.h>
+#include "flash_job.h"
+#include "flash_util.h"
+#include "flash_erase.h"
+#include "util.h"
+
+/*
+    Flash job queue
+
+    Each flash has its own queue, run in the order jobs were submitted. flash_job_task() is 
+    called from the main loop and moves a job along by one step, never waiting on the chip:
+    page programs go out one page per call, and erases/reads are started and then checked on.
+    DMA reads finish in the DMA IRQ, which flags the job for the next call. Erases run in the
+    background, so reads from outside the queue suspend them rather than wait.
+
+    While one chip is busy erasing or programming, the bus is handed to the other chip's
+    queue, so work on both flashes overlaps.
+*/
+
+enum flash_job_step {
+    FLASH_JOB_STEP_WAIT, // waiting on the chip or DMA
+    FLASH_JOB_STEP_PROGRESS,
+    FLASH_JOB_STEP_FINISHED
+};
+
+static struct flash_job *JOB_QUEUE[SPI_FLASH_NUM_CHIPS][FLASH_JOB_QUEUE_LEN];
+static uint8_t JOB_QUEUE_HEAD[SPI_FLASH_NUM_CHIPS] = {0};
+static uint8_t JOB_QUEUE_COUNT[SPI_FLASH_NUM_CHIPS] = {0};
+static enum spi_flash_chip JOB_CHIP = SPI_FLASH_BITSTREAM; // chip whose queue is being run
+
+static struct flash_job *DMA_JOB = NULL; // job with a DMA read in flight
+static uint8_t VERIFY_BUF[FLASH_JOB_VERIFY_CHUNK];
+
+static void flash_job_dma_done(void)
+{
+    if (DMA_JOB) DMA_JOB->dma_done = 1;
+}
+
+static int flash_job_start_read(struct flash_job *job, uint32_t addr, uint8_t *data, uint32_t len)
+{
+    DMA_JOB = job;
+    job->dma_done = 0;
+    job->started = 1;
+    if (job->type == FLASH_JOB_CRC) return spi_flash_read_dma_crc(addr, data, len, flash_job_dma_done, &job->crc);
+    return spi_flash_read_dma(addr, data, len, flash_job_dma_done);
+}
+
+/*
+    Next verify/CRC read, up to the end of the page so that it lines up with what was programmed
+*/
+static uint32_t flash_job_read_chunk(struct flash_job *job)
+{
+    uint32_t addr = job->addr + job->done;
+    return min(sizeof(VERIFY_BUF) - (addr & (sizeof(VERIFY_BUF) - 1)), job->len - job->done);
+}
+
+static enum flash_job_step flash_job_fail(struct flash_job *job)
+{
+    job->state = FLASH_JOB_ERROR;
+    return FLASH_JOB_STEP_FINISHED;
+}
+
+/*
+    Move job along without waiting on the flash
+*/
+static enum flash_job_step flash_job_step(struct flash_job *job)
+{
+    if (job->state == FLASH_JOB_QUEUED) {
+        job->state = FLASH_JOB_RUNNING;
+        job->done = 0;
+        job->started = 0;
+        job->dma_done = 0;
+    }
+
+    if (spi_flash_dma_is_busy()) return FLASH_JOB_STEP_WAIT; // our read, or someone else's, is still going
+    spi_flash_select(job->chip, job->baud);
+
+    switch (job->type) {
+        case FLASH_JOB_ERASE: {
+            if (spi_flash_is_busy()) return FLASH_JOB_STEP_WAIT;
+            uint32_t num_ops = job->plan ? job->plan->num_ops : 1;
+            if (job->done >= num_ops) return FLASH_JOB_STEP_FINISHED;
+
+            enum spi_flash_erase_type type = job->plan ? job->plan->ops[job->done].type : job->erase_type;
+            uint32_t addr = job->plan ? job->plan->ops[job->done].addr : job->addr;
+            if (spi_flash_erase_background(type, addr)) return flash_job_fail(job);
+            job->started = 1;
+            job->done++;
+            return FLASH_JOB_STEP_PROGRESS;
+        }
+
+        case FLASH_JOB_PROGRAM: {
+            if (spi_flash_is_busy()) return FLASH_JOB_STEP_WAIT;
+            if (job->done >= job->len) return FLASH_JOB_STEP_FINISHED;
+
+            uint32_t page_size = spi_flash_get_caps(job->chip)->page_size;
+            uint32_t addr = job->addr + job->done;
+            uint32_t chunk = min(page_size - (addr & (page_size - 1)), job->len - job->done);
+            if (spi_flash_page_program_nonblocking(addr, job->data + job->done, chunk)) return flash_job_fail(job);
+            job->done += chunk;
+            return FLASH_JOB_STEP_PROGRESS;
+        }
+
+        case FLASH_JOB_READ:
+            if (!job->started) {
+                if (flash_job_start_read(job, job->addr, job->data, job->len)) return flash_job_fail(job);
+            }
+            if (!job->dma_done) return FLASH_JOB_STEP_WAIT;
+            job->done = job->len;
+            return FLASH_JOB_STEP_FINISHED;
+
+        case FLASH_JOB_VERIFY:
+        case FLASH_JOB_CRC: {
+            uint32_t chunk = flash_job_read_chunk(job);
+            if (job->started) {
+                if (!job->dma_done) return FLASH_JOB_STEP_WAIT;
+                if ((job->type == FLASH_JOB_VERIFY) && memcmp(VERIFY_BUF, job->data + job->done, chunk)) {
+                    return flash_job_fail(job);
+                }
+                job->done += chunk;
+                job->started = 0;
+                chunk = flash_job_read_chunk(job);
+            }
+
+            // all 0xFF pages weren't programmed, the erase already left them that way
+            while ((job->type == FLASH_JOB_VERIFY) && chunk && spi_flash_is_erased(job->data + job->done, chunk)) {
+                job->done += chunk;
+                chunk = flash_job_read_chunk(job);
+            }
+            if (job->done >= job->len) return FLASH_JOB_STEP_FINISHED;
+            if (flash_job_start_read(job, job->addr + job->done, VERIFY_BUF, chunk)) return flash_job_fail(job);
+            return FLASH_JOB_STEP_PROGRESS;
+        }
+
+        default:
+            return flash_job_fail(job);
+    }
+}
+
+/*
+    Add job to the end of its chip's queue. Returns -1 if the queue is full
+*/
+int flash_job_submit(struct flash_job *job)
+{
+    enum spi_flash_chip chip = job->chip;
+    if ((chip >= SPI_FLASH_NUM_CHIPS) || (JOB_QUEUE_COUNT[chip] >= FLASH_JOB_QUEUE_LEN)) return -1;
+
+    job->state = FLASH_JOB_QUEUED;
+    JOB_QUEUE[chip][(JOB_QUEUE_HEAD[chip] + JOB_QUEUE_COUNT[chip]) % FLASH_JOB_QUEUE_LEN] = job;
+    JOB_QUEUE_COUNT[chip]++;
+    return 0;
+}
+
+static int flash_job_total(void)
+{
+    int total = 0;
+    for (uint8_t chip = 0; chip < SPI_FLASH_NUM_CHIPS; chip++) total += JOB_QUEUE_COUNT[chip];
+    return total;
+}
+
+/*
+    Advance the job at the front of one chip's queue by one step. Call often, e.g. from the main loop
+
+    Sticks with the same chip until it has to wait on the flash, then gives the other
+    chip a turn. Returns the number of jobs still queued
+*/
+int flash_job_task(void)
+{
+    enum spi_flash_chip chip = JOB_CHIP;
+    if (!JOB_QUEUE_COUNT[chip]) chip = (chip + 1) % SPI_FLASH_NUM_CHIPS;
+    if (!JOB_QUEUE_COUNT[chip]) return 0;
+    JOB_CHIP = chip;
+
+    struct flash_job *job = JOB_QUEUE[chip][JOB_QUEUE_HEAD[chip]];
+    enum flash_job_step step = flash_job_step(job);
+    if (step == FLASH_JOB_STEP_FINISHED) {
+        if (job->state != FLASH_JOB_ERROR) job->state = FLASH_JOB_DONE;
+        if (DMA_JOB == job) DMA_JOB = NULL;
+        JOB_QUEUE_HEAD[chip] = (JOB_QUEUE_HEAD[chip] + 1) % FLASH_JOB_QUEUE_LEN;
+        JOB_QUEUE_COUNT[chip]--;
+        if (job->cb) job->cb(job);
+    } else if ((step == FLASH_JOB_STEP_WAIT) && !spi_flash_dma_is_busy()) {
+        // chip is busy on its own, let the other one use the bus meanwhile
+        JOB_CHIP = (chip + 1) % SPI_FLASH_NUM_CHIPS;
+    }
+    return flash_job_total();
+}
+
+/*
+    Run the queue until it's empty
+*/
+void flash_job_drain(void)
+{
+    while (flash_job_task());
+}
+
+/*
+    Check if job is waiting in the queue or running
+*/
+int flash_job_is_busy(struct flash_job *job)
+{
+    return (job->state == FLASH_JOB_QUEUED) || (job->state == FLASH_JOB_RUNNING);
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <stdint.h>
+#include "flash_util.h"
+
+#define FLASH_JOB_QUEUE_LEN 20
+#define FLASH_JOB_VERIFY_CHUNK SPI_FLASH_PAGE_SIZE
+
+enum flash_job_type {
+    FLASH_JOB_ERASE,
+    FLASH_JOB_PROGRAM,
+    FLASH_JOB_READ,
+    FLASH_JOB_VERIFY,
+    FLASH_JOB_CRC // CRC-32 (DMA sniffer) of what's in flash, into crc
+};
+
+enum flash_job_state {
+    FLASH_JOB_IDLE = 0, // not submitted
+    FLASH_JOB_QUEUED,
+    FLASH_JOB_RUNNING,
+    FLASH_JOB_DONE,
+    FLASH_JOB_ERROR
+};
+
+struct flash_job;
+struct flash_erase_plan;
+typedef void (*flash_job_cb)(struct flash_job *job);
+
+/*
+    One queued flash operation
+
+    The job (and data) belong to whoever submits it and have to stay valid until
+    it's DONE or ERROR
+*/
+struct flash_job {
+    enum flash_job_type type;
+    enum spi_flash_chip chip;
+    uint32_t baud;
+    uint32_t addr;
+    uint32_t len;
+    uint8_t *data; // source for program/verify, destination for read
+    uint32_t crc; // starting crc for FLASH_JOB_CRC, result once done
+    enum spi_flash_erase_type erase_type;
+    const struct flash_erase_plan *plan; // for FLASH_JOB_ERASE, erases to run in turn instead of erase_type at addr
+    flash_job_cb cb; // called from flash_job_task() when the job finishes, can be NULL
+    void *ctx;
+
+    // managed by the queue
+    volatile enum flash_job_state state;
+    uint32_t done; // bytes finished, or erases started
+    uint8_t started; // erase sent/DMA read started
+    volatile uint8_t dma_done; // set from the DMA IRQ
+};
+
+int flash_job_submit(struct flash_job *job);
+int flash_job_task(void);
+void flash_job_drain(void);
+int flash_job_is_busy(struct flash_job *job);
@@ -0,0 +1,204 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "bsp/board.h"
+#include "flash_pre_erase.h"
+#include "flash_util.h"
+#include "config.h"
+#include "util.h"
+#include "error.h"
+
+extern struct config_options CONFIG;
+extern uint32_t FLASH_BITSTREAM_OFFSET[FLASH_PRE_ERASE_SLOTS];
+
+struct pre_erase_slot {
+    uint8_t stale; // no bitstream found in it
+    uint8_t claimed; // being written/written to since boot, leave it alone
+    uint8_t loaded; // map has been read from flash
+    uint8_t done;
+    struct flash_pre_erase_map map;
+};
+
+static struct pre_erase_slot PRE_ERASE_SLOT[FLASH_PRE_ERASE_SLOTS];
+static int8_t ERASING_SLOT = -1;
+static int16_t ERASING_BLOCK = -1; // -1 is the record sector
+static uint32_t LAST_USB_MS = 0;
+
+static uint32_t block_addr(uint8_t slot, uint16_t block)
+{
+    return FLASH_BITSTREAM_OFFSET[slot] + block * FLASH_ERASE_BLOCK_SIZE;
+}
+
+static uint32_t map_addr(uint8_t slot)
+{
+    return flash_fingerprint_sector(FLASH_BITSTREAM_OFFSET[slot]) + FLASH_PRE_ERASE_MAP_OFFSET;
+}
+
+static int block_is_erased(struct pre_erase_slot *s, uint16_t block)
+{
+    return (s->map.magic == FLASH_PRE_ERASE_MAP_MAGIC) && !(s->map.not_erased[block / 8] & (1 << (block % 8)));
+}
+
+/*
+    Read the slot's map from flash. A missing map means nothing is known to be erased
+*/
+static void load_map(uint8_t slot)
+{
+    struct pre_erase_slot *s = &PRE_ERASE_SLOT[slot];
+    if (s->loaded) return;
+    if (spi_flash_read(map_addr(slot), (uint8_t *)&s->map, sizeof(s->map)) ||
+        (s->map.magic != FLASH_PRE_ERASE_MAP_MAGIC)) {
+        memset(&s->map, 0xFF, sizeof(s->map));
+    }
+    s->loaded = 1;
+}
+
+/*
+    Record a finished erase in flash. Programming only clears bits, so no erase is needed
+*/
+static void mark_erased(uint8_t slot, int16_t block)
+{
+    struct pre_erase_slot *s = &PRE_ERASE_SLOT[slot];
+    if (block < 0) {
+        // fresh record sector, the fingerprint went with it
+        s->map.magic = FLASH_PRE_ERASE_MAP_MAGIC;
+        spi_flash_page_program_blocking(map_addr(slot), (uint8_t *)&s->map.magic, sizeof(s->map.magic));
+        return;
+    }
+    uint8_t *byte = &s->map.not_erased[block / 8];
+    *byte &= ~(1 << (block % 8));
+    spi_flash_page_program_blocking(map_addr(slot) + offsetof(struct flash_pre_erase_map, not_erased) + block / 8,
+        byte, 1);
+}
+
+static int slot_wanted(uint8_t slot, int active_slot)
+{
+    struct pre_erase_slot *s = &PRE_ERASE_SLOT[slot];
+    if (s->claimed || s->done || (slot == active_slot)) return 0;
+    return s->stale || (CONFIG.scratch_slots & (1 << slot));
+}
+
+/*
+    Flag a slot with no bitstream in it as free to erase
+*/
+void flash_pre_erase_mark_stale(uint8_t slot)
+{
+    if (slot < FLASH_PRE_ERASE_SLOTS) PRE_ERASE_SLOT[slot].stale = 1;
+}
+
+/*
+    Call on any USB MSC traffic, the task holds off until it's been quiet for a while
+*/
+void flash_pre_erase_usb_activity(void)
+{
+    LAST_USB_MS = board_millis();
+}
+
+/*
+    Check on/start the next pre-erase. Never waits on the flash, call from the main loop when
+    nothing else needs the flash. active_slot (the one the FPGA is programmed from) is left alone
+*/
+void flash_pre_erase_task(int active_slot)
+{
+    if (board_millis() - LAST_USB_MS < FLASH_PRE_ERASE_IDLE_MS) return;
+
+    if (ERASING_SLOT >= 0) {
+        spi_flash_select(SPI_FLASH_BITSTREAM, CONFIG.flash_prog_speed);
+        if (spi_flash_is_busy()) return;
+        mark_erased(ERASING_SLOT, ERASING_BLOCK);
+        ERASING_SLOT = -1;
+    }
+
+    for (uint8_t slot = 0; slot < FLASH_PRE_ERASE_SLOTS; slot++) {
+        struct pre_erase_slot *s = &PRE_ERASE_SLOT[slot];
+        if (!slot_wanted(slot, active_slot)) continue;
+
+        spi_flash_select(SPI_FLASH_BITSTREAM, CONFIG.flash_prog_speed);
+        if (block_addr(slot, FLASH_PRE_ERASE_BLOCKS) + FLASH_ERASE_BLOCK_SIZE > spi_flash_get_size(SPI_FLASH_BITSTREAM)) {
+            s->done = 1;
+            continue;
+        }
+        load_map(slot);
+
+        int16_t block = -1;
+        if (s->map.magic == FLASH_PRE_ERASE_MAP_MAGIC) {
+            for (block = 0; (block < FLASH_PRE_ERASE_BLOCKS) && block_is_erased(s, block); block++);
+            if (block >= FLASH_PRE_ERASE_BLOCKS) {
+                PRINT_INFO("Slot %u pre-erased", slot);
+                s->done = 1;
+                continue;
+            }
+        } else {
+            PRINT_INFO("Pre-erasing slot %u", slot);
+        }
+
+        int err;
+        if (block < 0) {
+            err = spi_flash_erase_background(SPI_FLASH_ERASE_4K, flash_fingerprint_sector(FLASH_BITSTREAM_OFFSET[slot]));
+        } else {
+            err = spi_flash_erase_background(SPI_FLASH_ERASE_64K, block_addr(slot, block));
+        }
+        if (err) {
+            s->done = 1; // chip can't do it
+            continue;
+        }
+        ERASING_SLOT = slot;
+        ERASING_BLOCK = block;
+        return;
+    }
+}
+
+/*
+    Drop the slot's map from flash so that none of it is trusted after a reset. With an erase
+    suspended, the magic is programmed away instead of waiting to erase the record sector. The
+    next pre-erase of the slot starts with a fresh record sector either way
+*/
+static void drop_map(uint8_t slot, int suspended)
+{
+    uint32_t zero = 0;
+    memset(&PRE_ERASE_SLOT[slot].map, 0xFF, sizeof(PRE_ERASE_SLOT[slot].map));
+    if (suspended) {
+        spi_flash_page_program_suspended(map_addr(slot), (uint8_t *)&zero, sizeof(zero));
+        return;
+    }
+    spi_flash_sector_erase_blocking(flash_fingerprint_sector(FLASH_BITSTREAM_OFFSET[slot]));
+}
+
+/*
+    An upload to the bitstream slot at slot_base is starting. Marks its pre-erased blocks in sched
+    (if not NULL), then drops the map from flash before anything is written.
+
+    Called from the USB write callback, so an erase still running (on any slot) is suspended
+    rather than waited for, and is resumed by the first flash job that needs the chip. If it's
+    on the claimed slot its block counts as not erased. Without sched the upload reads the slot's
+    old contents, so an erase on it is resumed and reads wait for it instead.
+
+    Returns the number of blocks that were pre-erased
+*/
+uint32_t flash_pre_erase_claim(uint32_t slot_base, struct flash_erase_sched *sched)
+{
+    uint32_t num_erased = 0;
+    spi_flash_select(SPI_FLASH_BITSTREAM, CONFIG.flash_prog_speed);
+    int suspended = (ERASING_SLOT >= 0) && (spi_flash_erase_suspend() > 0);
+
+    for (uint8_t slot = 0; slot < FLASH_PRE_ERASE_SLOTS; slot++) {
+        struct pre_erase_slot *s = &PRE_ERASE_SLOT[slot];
+        if (FLASH_BITSTREAM_OFFSET[slot] != slot_base) continue;
+        s->claimed = 1;
+
+        int erasing = (ERASING_SLOT == slot);
+        if (erasing) ERASING_SLOT = -1;
+        load_map(slot);
+        if (s->map.magic == FLASH_PRE_ERASE_MAP_MAGIC) {
+            for (uint16_t block = 0; block < FLASH_PRE_ERASE_BLOCKS; block++) {
+                if (!block_is_erased(s, block)) continue;
+                if (sched) flash_erase_sched_skip(sched, block_addr(slot, block));
+                num_erased++;
+            }
+            drop_map(slot, suspended);
+        }
+        if (erasing && !sched) spi_flash_erase_foreground();
+        break;
+    }
+    return num_erased;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+#include "flash_util.h"
+#include "flash_erase.h"
+#include "flash_fingerprint.h"
+
+#define FLASH_PRE_ERASE_SLOTS 3
+#define FLASH_PRE_ERASE_BLOCKS (FLASH_SLOT_SIZE / FLASH_ERASE_BLOCK_SIZE - 1) // last block holds the record sector
+#define FLASH_PRE_ERASE_IDLE_MS 2000 // how long USB has to be quiet before starting
+#define FLASH_PRE_ERASE_MAP_MAGIC 0x4D455246 // "FREM"
+#define FLASH_PRE_ERASE_MAP_OFFSET 256 // in the record sector, after the fingerprint
+
+/*
+    Idle time erasing of bitstream slots
+
+    Scratch slots (CONFIG.scratch_slots) and slots without a bitstream in them are erased
+    64k at a time with a background erase while USB is quiet, so a later upload to them
+    can skip erasing.
+
+    Progress is kept in the slot's record sector as a bitmap of erased blocks. A block's bit is
+    only cleared after its erase finishes and the whole map is erased before anything is written to
+    the slot, so a reset can't leave a block marked erased that isn't.
+
+    Only the bitstream flash is done, as the firmware flash is in use by the running FPGA design.
+*/
+struct flash_pre_erase_map {
+    uint32_t magic;
+    uint8_t not_erased[(FLASH_PRE_ERASE_BLOCKS + 7) / 8]; // bit cleared once the block is erased
+};
+
+void flash_pre_erase_mark_stale(uint8_t slot);
+void flash_pre_erase_usb_activity(void);
+void flash_pre_erase_task(int active_slot);
+uint32_t flash_pre_erase_claim(uint32_t slot_base, struct flash_erase_sched *sched);
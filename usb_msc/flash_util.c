@@ -1,8 +1,15 @@
 #include <stdint.h>
+#include <string.h>
 #include "hardware/spi.h"
 #include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "pico/time.h"
 #include "fpga_program.h"
 #include "flash_util.h"
+#include "qspi_flash.h"
+#include "dma_crc.h"
+#include "sfdp.h"
+#include "error.h"
 #include "util.h"
 
 // both SPI flashes use the same peripheral on different IO pins
@@ -14,8 +21,13 @@ enum spi_flash_commands {
     SPI_CMD_READ_DATA_4ADDR = 0x13, // 0x13
     SPI_CMD_READ_DATA_FAST = 0x0B,
     SPI_CMD_READ_DATA_4ADDR_FAST = 0x0C,
+    SPI_CMD_READ_DATA_4ADDR_QUAD_OUT = 0x6C,
     SPI_CMD_PAGE_PROGRAM = 0x02,
     SPI_CMD_PAGE_4ADDR_PROGRAM = 0x12, // 0x12
+    SPI_CMD_PAGE_4ADDR_QUAD_PROGRAM = 0x34,
+    SPI_CMD_PAGE_QUAD_PROGRAM = 0x32,
+    SPI_CMD_READ_DATA_QUAD_OUT = 0x6B,
+    SPI_CMD_SECTOR_ERASE = 0x20,
     SPI_CMD_SECTOR_ERASE_4ADDR = 0x21,
 
     SPI_CMD_READ_STATUS1 = 0x05,
@@ -31,12 +43,19 @@ enum spi_flash_commands {
     SPI_CMD_EXIT_4BYTE_ADDR_MODE = 0xE9,
 
     SPI_CMD_64K_BLOCK_ERASE = 0xDC, // 0xDC
+    SPI_CMD_64K_BLOCK_ERASE_3ADDR = 0xD8,
     SPI_CMD_32K_BLOCK_ERASE = 0x52,
     SPI_CMD_CHIP_ERASE = 0xC7,
 
     SPI_CMD_WRITE_EXT_ADDR = 0xC5,
     SPI_CMD_READ_EXT_ADDR = 0xC8,
 
+    SPI_CMD_READ_JEDEC_ID = 0x9F,
+    SPI_CMD_VOLATILE_SR_WRITE_ENABLE = 0x50,
+    SPI_CMD_READ_SFDP = 0x5A,
+    SPI_CMD_ERASE_SUSPEND = 0x75,
+    SPI_CMD_ERASE_RESUME = 0x7A,
+
 };
 
 
@@ -44,20 +63,83 @@ enum spi_flash_commands {
 
 const uint32_t BITSTREAM_FLASH_OFFSETS[] = {0x00, 0x00, 0x00};
 
-void delay_short(void)
-{
-    for (volatile uint32_t i = 0; i < 50; i++);
-}
-
 // each bitstream 32MB apart
 #define BITSTREAM_FLASH_OFFSET 0x2000000
 
 static volatile uint8_t RD_WR_BUF_A[RD_WR_BUF];
 static volatile uint8_t RD_WR_BUF_B[RD_WR_BUF];
-dma_channel_config bs_spi_dma_config;
+dma_channel_config bs_spi_dma_config; // RX channel, flash_spi DR -> memory
 int bs_spi_dma = -1;
+dma_channel_config bs_spi_dma_tx_config; // TX channel, clocks out dummy bytes for the RX channel
+dma_channel_config bs_spi_dma_tx_buf_config; // TX channel, clocks out a buffer (page program)
+int bs_spi_dma_tx = -1;
 spi_inst_t *flash_spi = spi0;
 
+struct spi_flash_read_config {
+    enum spi_flash_read_mode mode;
+    uint8_t dummy_bytes; // only used for fast read, the hardware SPI can only do multiples of 8 clocks
+};
+
+static struct spi_flash_read_config FLASH_READ_CONFIG[SPI_FLASH_NUM_CHIPS] = {
+    {SPI_FLASH_READ_AUTO, SPI_FLASH_DEFAULT_DUMMY_BYTES},
+    {SPI_FLASH_READ_AUTO, SPI_FLASH_DEFAULT_DUMMY_BYTES},
+};
+
+/*
+    Whether each chip is used in quad mode. Only the firmware flash has D2/D3 connected
+    -1 means we haven't checked yet
+*/
+static int FLASH_QUAD[SPI_FLASH_NUM_CHIPS] = {0, -1};
+
+static enum spi_flash_chip CURRENT_FLASH = SPI_FLASH_BITSTREAM;
+
+/*
+    Both flashes are W25Q256JV parts, defaults from the datasheet. Replaced by SFDP
+    where the chip has it
+*/
+#define SPI_FLASH_DEFAULT_CAPS { \
+    .size = 32 * 1024 * 1024, \
+    .page_size = SPI_FLASH_PAGE_SIZE, \
+    .addr_bytes = 4, \
+    .erase_supported = (1 << SPI_FLASH_ERASE_NUM_TYPES) - 1, \
+    .erase_times = {{45, 400}, {120, 1600}, {150, 2000}, {80000, 400000}}, \
+    .quad_read_dummy_bytes = 1, \
+    .quad_enable = SPI_FLASH_QE_UNKNOWN, \
+    .erase_suspend = 1, \
+    .suspend_opcode = SPI_CMD_ERASE_SUSPEND, \
+    .resume_opcode = SPI_CMD_ERASE_RESUME, \
+    .suspend_latency_us = 20, \
+    .resume_interval_us = 100 \
+}
+
+static struct spi_flash_caps FLASH_CAPS[SPI_FLASH_NUM_CHIPS] = {SPI_FLASH_DEFAULT_CAPS, SPI_FLASH_DEFAULT_CAPS};
+
+struct spi_flash_erase_state {
+    uint8_t pending; // a nonblocking erase has been started and we haven't seen the chip go idle since
+    uint8_t background; // nobody is waiting on the erase, reads can suspend it
+    uint8_t suspended;
+    uint32_t resume_us; // when it was last resumed
+};
+
+static struct spi_flash_erase_state FLASH_ERASE[SPI_FLASH_NUM_CHIPS] = {0};
+
+// set when a nonblocking page program has been started and we haven't seen the chip go idle since
+static int FLASH_WRITE_PENDING[SPI_FLASH_NUM_CHIPS] = {0};
+static uint32_t CURRENT_FLASH_BAUD = 0; // actual baud, not what was asked for
+static uint32_t FLASH_BUS_REQ_BAUD = 0; // what was asked for
+static int FLASH_BUS_OWNED = 0; // flash_spi and CURRENT_FLASH's IO are set up
+
+static void spi_flash_first_use(void);
+
+static uint8_t spi_dma_tx_dummy = 0x00;
+static volatile int spi_flash_frame_in_flight = 0;
+
+static struct spi_flash_write_stats FLASH_WRITE_STATS = {.min_us = UINT32_MAX};
+static struct spi_flash_cmd_stats FLASH_CMD_STATS = {0};
+static volatile int spi_flash_dma_busy = 0;
+static spi_flash_dma_cb spi_flash_dma_done_cb = NULL;
+static uint32_t *spi_flash_dma_crc = NULL; // where to put the sniffed CRC, if the read is sniffed
+
 enum bitstream_spi_pins {
     BS_SPI_DI = 23,
     BS_SPI_DO = 20,
@@ -65,57 +147,83 @@ enum bitstream_spi_pins {
     BS_SPI_CS = 21
 };
 
-enum firmware_spi_pins {
-    FW_SPI_DI = 3, // QSPI_D0
-    FW_SPI_DO = 0, // QSPI_D1
-    FW_SPI_CLK = 2, // QSPI_SCLK
-    FW_SPI_CS = 1, //QSPI_CS
-    // NOTE: For single bit SPI, set these both high
-    FW_SPI_W_NEN = 4, // QSPI_D2/write enable (low)
-    FW_SPI_NHOLD = 5 // QSPI_D3/hold (low)
-};
-
 int SPI_FLASH_CS_PIN = 0;
 
 void spi_write_extended_addr_reg(uint8_t addr)
 {
     spi_flash_write_enable();
-    uint8_t cmd = SPI_CMD_WRITE_EXT_ADDR;
-
-    spi_cs_put(0);
-    spi_write_blocking(flash_spi, &cmd, 1);
-    spi_write_blocking(flash_spi, &addr, 1);
-    spi_cs_put(1);
-
+    struct spi_flash_cmd cmd = {.opcode = SPI_CMD_WRITE_EXT_ADDR, .tx = &addr, .tx_len = 1};
+    spi_flash_cmd_exec(&cmd);
 }
 
 uint8_t spi_read_extended_addr_reg(void)
 {
     uint8_t addr = 0;
-    uint8_t cmd = SPI_CMD_READ_EXT_ADDR;
-    spi_cs_put(0);
-    spi_write_blocking(flash_spi, &cmd, 1);
-    spi_read_blocking(flash_spi, 0x00, &addr, 1);
-    spi_cs_put(1);
+    struct spi_flash_cmd cmd = {.opcode = SPI_CMD_READ_EXT_ADDR, .rx = &addr, .rx_len = 1};
+    spi_flash_cmd_exec(&cmd);
     return addr;
 }
 
 void enter_4byte_mode(void)
 {
-    uint8_t cmd = SPI_CMD_ENTER_4BYTE_ADDR_MODE;
-    // gpio_put(SPI_FLASH_CS_PIN, 0);
+    struct spi_flash_cmd cmd = {.opcode = SPI_CMD_ENTER_4BYTE_ADDR_MODE};
+    spi_flash_cmd_exec(&cmd);
+}
+
+/*
+    Drive the flash CS pin
+
+    gpio_put() is a single SIO write and spi_*_blocking() don't return until the last bit has
+    been clocked out, so CS setup and hold times are met without any delay. Only the minimum
+    CS high time between commands needs a wait.
+*/
+void spi_cs_put(uint8_t val)
+{
+    gpio_put(SPI_FLASH_CS_PIN, val);
+    if (val) busy_wait_at_least_cycles(SPI_FLASH_CS_HIGH_CYCLES);
+}
+
+/*
+    Run cmd as a single CS frame: opcode, address (big endian, addr_len bytes), dummy bytes,
+    then tx data out and rx data in.
+
+    Returns -1 if the address or dummy length is invalid
+*/
+int spi_flash_cmd_exec(const struct spi_flash_cmd *cmd)
+{
+    uint8_t hdr[1 + 4 + SPI_FLASH_MAX_DUMMY_BYTES];
+    uint8_t addr_u8[] = {BE_U32_TO_4U8(cmd->addr)}; // ensure proper endianness
+    uint8_t hdr_len = 1;
+
+    if ((cmd->addr_len > sizeof(addr_u8)) || (cmd->dummy_len > SPI_FLASH_MAX_DUMMY_BYTES)) return -1;
+    while (spi_flash_dma_busy); // a DMA read (e.g. from a queued job) still owns the bus
+
+    hdr[0] = cmd->opcode;
+    memcpy(hdr + hdr_len, addr_u8 + sizeof(addr_u8) - cmd->addr_len, cmd->addr_len);
+    hdr_len += cmd->addr_len;
+    memset(hdr + hdr_len, 0x00, cmd->dummy_len);
+    hdr_len += cmd->dummy_len;
+
+    uint32_t start_us = time_us_32();
     spi_cs_put(0);
-    spi_write_blocking(flash_spi, &cmd, 1);
+    spi_write_blocking(flash_spi, hdr, hdr_len);
+    if (cmd->tx_len) spi_write_blocking(flash_spi, cmd->tx, cmd->tx_len);
+    if (cmd->rx_len) spi_read_blocking(flash_spi, 0x00, cmd->rx, cmd->rx_len);
     spi_cs_put(1);
-    // gpio_put(SPI_FLASH_CS_PIN, 1);
 
+    FLASH_CMD_STATS.cmds++;
+    FLASH_CMD_STATS.total_us += time_us_32() - start_us;
+    return 0;
 }
 
-void spi_cs_put(uint8_t val)
+void spi_flash_reset_cmd_stats(void)
 {
-    delay_short();
-    gpio_put(SPI_FLASH_CS_PIN, val);
-    delay_short();
+    memset(&FLASH_CMD_STATS, 0x00, sizeof(FLASH_CMD_STATS));
+}
+
+const struct spi_flash_cmd_stats *spi_flash_get_cmd_stats(void)
+{
+    return &FLASH_CMD_STATS;
 }
 
 /*
@@ -123,8 +231,10 @@ void spi_cs_put(uint8_t val)
 */
 void bitstream_init_spi(uint32_t baud)
 {
+    while (spi_flash_dma_is_busy()); // don't pull the bus out from under a DMA read
     spi_deinit(flash_spi);
-    spi_init(flash_spi, baud);
+    CURRENT_FLASH_BAUD = spi_init(flash_spi, baud);
+    CURRENT_FLASH = SPI_FLASH_BITSTREAM;
 
     release_spi_io();
 
@@ -143,7 +253,12 @@ void bitstream_init_spi(uint32_t baud)
     gpio_put(BS_SPI_CS, 1);
     SPI_FLASH_CS_PIN = BS_SPI_CS;
 
+    FLASH_BUS_OWNED = 1;
+    FLASH_BUS_REQ_BAUD = baud;
+    FLASH_CMD_STATS.bus_switches++;
+
     // enter_4byte_mode();
+    spi_flash_first_use();
 }
 
 /*
@@ -151,8 +266,10 @@ void bitstream_init_spi(uint32_t baud)
 */
 void firmware_init_spi(uint32_t baud)
 {
+    while (spi_flash_dma_is_busy()); // don't pull the bus out from under a DMA read
     spi_deinit(flash_spi);
-    spi_init(flash_spi, baud);
+    CURRENT_FLASH_BAUD = spi_init(flash_spi, baud);
+    CURRENT_FLASH = SPI_FLASH_FIRMWARE;
 
     release_spi_io();
 
@@ -184,13 +301,109 @@ void firmware_init_spi(uint32_t baud)
     gpio_put(FW_SPI_CS, 1);
     SPI_FLASH_CS_PIN = FW_SPI_CS;
 
-    // hold FPGA in reset and tristate its IO pins
+    FLASH_BUS_OWNED = 1;
+    FLASH_BUS_REQ_BAUD = baud;
+    FLASH_CMD_STATS.bus_switches++;
+
+    spi_flash_first_use();
+}
+
+/*
+    Move flash_spi over to the other chip's pins without reinitialising anything else
+
+    The old chip's CS stays driven high and the FPGA stays off the firmware flash pins, so 
+    both chips can have erases/programs running and be switched between quickly.
+    Only valid while the bus is owned (i.e. one of the init funcs has been called and 
+    release_spi_io() hasn't)
+*/
+static void spi_flash_swap_chip(enum spi_flash_chip chip)
+{
+    while (spi_flash_dma_is_busy()); // don't pull the bus out from under a DMA read
+
+    if (chip == SPI_FLASH_FIRMWARE) {
+        gpio_set_function(BS_SPI_DI, GPIO_FUNC_NULL);
+        gpio_set_function(BS_SPI_DO, GPIO_FUNC_NULL);
+        gpio_set_function(BS_SPI_CLK, GPIO_FUNC_NULL);
+
+        fpga_set_sw_nrst(0); // hold FPGA software in reset
+        fpga_set_io_tristate(1); // tristate FPGA pins
+
+        gpio_init(FW_SPI_W_NEN);
+        gpio_put(FW_SPI_W_NEN, 1); // set before driving so the pins never glitch low
+        gpio_set_dir(FW_SPI_W_NEN, GPIO_OUT);
+        gpio_init(FW_SPI_NHOLD);
+        gpio_put(FW_SPI_NHOLD, 1);
+        gpio_set_dir(FW_SPI_NHOLD, GPIO_OUT);
+        gpio_init(FW_SPI_CS);
+        gpio_put(FW_SPI_CS, 1);
+        gpio_set_dir(FW_SPI_CS, GPIO_OUT);
+
+        gpio_set_function(FW_SPI_DI, GPIO_FUNC_SPI);
+        gpio_set_function(FW_SPI_DO, GPIO_FUNC_SPI);
+        gpio_set_function(FW_SPI_CLK, GPIO_FUNC_SPI);
+        SPI_FLASH_CS_PIN = FW_SPI_CS;
+    } else {
+        gpio_set_function(FW_SPI_DI, GPIO_FUNC_NULL);
+        gpio_set_function(FW_SPI_DO, GPIO_FUNC_NULL);
+        gpio_set_function(FW_SPI_CLK, GPIO_FUNC_NULL);
+
+        gpio_init(BS_SPI_CS);
+        gpio_put(BS_SPI_CS, 1);
+        gpio_set_dir(BS_SPI_CS, GPIO_OUT);
+
+        gpio_set_function(BS_SPI_DI, GPIO_FUNC_SPI);
+        gpio_set_function(BS_SPI_DO, GPIO_FUNC_SPI);
+        gpio_set_function(BS_SPI_CLK, GPIO_FUNC_SPI);
+        SPI_FLASH_CS_PIN = BS_SPI_CS;
+    }
+
+    CURRENT_FLASH = chip;
+    FLASH_CMD_STATS.chip_swaps++;
+    spi_flash_first_use();
+}
+
+/*
+    Probe the current flash and turn on quad mode the first time it's used
+*/
+static void spi_flash_first_use(void)
+{
+    if (!FLASH_CAPS[CURRENT_FLASH].probed) spi_flash_probe();
+    if (FLASH_QUAD[CURRENT_FLASH] < 0) {
+        FLASH_QUAD[CURRENT_FLASH] = spi_flash_enable_quad();
+    }
+}
+
+/*
+    Clock flash_spi actually ended up at, which can be lower than what was asked for
+*/
+uint32_t spi_flash_get_baud(void)
+{
+    return CURRENT_FLASH_BAUD;
+}
 
+/*
+    Give flash_spi to chip at baud. The bus and IO are only reinitialised if the baud
+    changes or the IO has been released since. Switching between chips at the same baud
+    just moves the SPI pins over.
+*/
+void spi_flash_select(enum spi_flash_chip chip, uint32_t baud)
+{
+    if (FLASH_BUS_OWNED && (FLASH_BUS_REQ_BAUD == baud)) {
+        if (CURRENT_FLASH != chip) spi_flash_swap_chip(chip);
+        return;
+    }
+
+    if (chip == SPI_FLASH_FIRMWARE) {
+        firmware_init_spi(baud);
+    } else {
+        bitstream_init_spi(baud);
+    }
 }
 
 void release_spi_io(void)
 {
     // spi_deinit(flash_spi);
+    FLASH_BUS_OWNED = 0;
 
     // disable BS_SPI pins
     gpio_set_function(BS_SPI_DI , GPIO_FUNC_NULL);
@@ -216,17 +429,179 @@ void release_spi_io(void)
 */
 uint16_t spi_flash_read_id(void)
 {
-    uint8_t cmd = 0x90;
     uint16_t read_data = 0;
+    struct spi_flash_cmd cmd = {.opcode = 0x90, .dummy_len = 2, .rx = (void *)&read_data, .rx_len = 2};
 
-    spi_cs_put(0);
-    spi_write_blocking(flash_spi, &cmd, 1);
+    spi_flash_cmd_exec(&cmd);
+    return read_data;
+}
 
-    spi_read_blocking(flash_spi, 0x00, (void *)&read_data, 2); // dummy read
-    spi_read_blocking(flash_spi, 0x00, (void *)&read_data, 2);
-    spi_cs_put(1);
+/*
+    Read JEDEC manufacturer ID (top byte), memory type and capacity
+*/
+uint32_t spi_flash_read_jedec_id(void)
+{
+    uint8_t id[3] = {0};
+    struct spi_flash_cmd cmd = {.opcode = SPI_CMD_READ_JEDEC_ID, .rx = id, .rx_len = sizeof(id)};
 
-    return read_data;
+    spi_flash_cmd_exec(&cmd);
+
+    return (id[0] << 16) | (id[1] << 8) | id[2];
+}
+
+static uint8_t spi_flash_read_status2(void)
+{
+    uint8_t rtn = 0;
+    struct spi_flash_cmd cmd = {.opcode = SPI_CMD_READ_STATUS2, .rx = &rtn, .rx_len = 1};
+
+    spi_flash_cmd_exec(&cmd);
+
+    return rtn;
+}
+
+static void spi_flash_read_sfdp(uint32_t addr, uint8_t *data, uint32_t len)
+{
+    struct spi_flash_cmd cmd = {.opcode = SPI_CMD_READ_SFDP, .addr = addr, .addr_len = 3, .dummy_len = 1,
+        .rx = data, .rx_len = len};
+    spi_flash_cmd_exec(&cmd);
+}
+
+/*
+    Fill in caps from the SFDP basic flash parameter table
+*/
+static void spi_flash_apply_sfdp(struct spi_flash_caps *caps, const struct sfdp_info *info)
+{
+    static const uint32_t erase_sizes[] = {CONST_4k, CONST_32k, CONST_64k}; // indexed by enum spi_flash_erase_type
+
+    caps->from_sfdp = 1;
+    caps->size = info->size;
+    caps->addr_bytes = (info->addr_mode == SFDP_ADDR_3BYTE) ? 3 : 4;
+    if (info->page_size) caps->page_size = min(info->page_size, SPI_FLASH_PAGE_SIZE);
+
+    // only erases SFDP lists are used, we have our own opcodes for them
+    caps->erase_supported = 1 << SPI_FLASH_ERASE_CHIP;
+    for (uint8_t type = SPI_FLASH_ERASE_4K; type < SPI_FLASH_ERASE_CHIP; type++) {
+        for (uint8_t i = 0; i < SFDP_NUM_ERASE_TYPES; i++) {
+            if (info->erase[i].size != erase_sizes[type]) continue;
+            caps->erase_supported |= 1 << type;
+            if (info->erase[i].typ_ms) {
+                caps->erase_times[type].typ_ms = info->erase[i].typ_ms;
+                caps->erase_times[type].max_ms = info->erase[i].max_ms;
+            }
+        }
+    }
+    if (info->chip_erase_typ_ms) {
+        caps->erase_times[SPI_FLASH_ERASE_CHIP].typ_ms = info->chip_erase_typ_ms;
+        caps->erase_times[SPI_FLASH_ERASE_CHIP].max_ms = info->chip_erase_max_ms;
+    }
+
+    if (info->dwords >= 13) {
+        caps->erase_suspend = info->erase_suspend;
+        if (info->erase_suspend) {
+            caps->suspend_opcode = info->suspend_opcode;
+            caps->resume_opcode = info->resume_opcode;
+            caps->suspend_latency_us = info->suspend_latency_us;
+            caps->resume_interval_us = info->resume_interval_us;
+        }
+    }
+
+    // hardware SPI sends the dummy clocks, so they have to be whole bytes
+    caps->quad_enable = SPI_FLASH_QE_NONE;
+    uint8_t dummy_clocks = info->fast_read_114_dummy_clocks;
+    if (info->fast_read_114 && !(dummy_clocks % 8) && ((dummy_clocks / 8) <= SPI_FLASH_MAX_DUMMY_BYTES)) {
+        caps->quad_read_dummy_bytes = dummy_clocks / 8;
+        switch (info->qer) {
+            case 1: case 4: case 5:
+                caps->quad_enable = SPI_FLASH_QE_SR2_WRSR;
+                break;
+            case 6:
+                caps->quad_enable = SPI_FLASH_QE_SR2_WRSR2;
+                break;
+            case 0xFF: // table too old to say
+                caps->quad_enable = SPI_FLASH_QE_UNKNOWN;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/*
+    Read the JEDEC ID and SFDP of the current flash and fill in its caps. Anything
+    SFDP doesn't give (or everything, if there's no SFDP) keeps the defaults.
+
+    Returns -1 if no valid SFDP was found
+*/
+int spi_flash_probe(void)
+{
+    struct spi_flash_caps *caps = &FLASH_CAPS[CURRENT_FLASH];
+    uint8_t sfdp[SFDP_BFPT_MAX_DWORDS * 4];
+    uint32_t bfpt_addr = 0, dwords = 0;
+    struct sfdp_info info;
+
+    caps->probed = 1;
+    caps->jedec_id = spi_flash_read_jedec_id();
+
+    spi_flash_read_sfdp(0, sfdp, SFDP_HEADER_LEN + SFDP_MAX_PARAM_HEADERS * SFDP_PARAM_HEADER_LEN);
+    if (sfdp_find_bfpt(sfdp, SFDP_HEADER_LEN + SFDP_MAX_PARAM_HEADERS * SFDP_PARAM_HEADER_LEN, &bfpt_addr, &dwords)) {
+        PRINT_INFO("Flash %u ID %06lX, no SFDP", CURRENT_FLASH, caps->jedec_id);
+        return -1;
+    }
+
+    spi_flash_read_sfdp(bfpt_addr, sfdp, dwords * 4);
+    if (sfdp_parse_bfpt(sfdp, dwords, &info)) {
+        PRINT_INFO("Flash %u ID %06lX, bad SFDP", CURRENT_FLASH, caps->jedec_id);
+        return -1;
+    }
+    spi_flash_apply_sfdp(caps, &info);
+
+    PRINT_INFO("Flash %u ID %06lX, %luMB, erase %X, QE %u", CURRENT_FLASH, caps->jedec_id, caps->size >> 20,
+        caps->erase_supported, caps->quad_enable);
+    return 0;
+}
+
+/*
+    Check if the current flash can do quad SPI and set its quad enable bit if so.
+
+    How QE is set comes from SFDP. Without that, only parts that keep QE in bit 1 of status 
+    register 2 (Winbond, GigaDevice) are recognised.
+    QE is set in the volatile copy of the status register, so this needs to be done again after
+    a power cycle, but doesn't wear out the status register.
+
+    Returns 1 if the chip is now in quad mode, 0 otherwise
+*/
+int spi_flash_enable_quad(void)
+{
+    struct spi_flash_caps *caps = &FLASH_CAPS[CURRENT_FLASH];
+    enum spi_flash_quad_enable qe = caps->quad_enable;
+
+    if (qe == SPI_FLASH_QE_UNKNOWN) {
+        uint8_t mfr = caps->jedec_id >> 16;
+        qe = ((mfr == SPI_FLASH_MFR_WINBOND) || (mfr == SPI_FLASH_MFR_GIGADEVICE)) ? SPI_FLASH_QE_SR2_WRSR2 : SPI_FLASH_QE_NONE;
+    }
+    if (qe == SPI_FLASH_QE_NONE) return 0;
+
+    uint8_t sr2 = spi_flash_read_status2();
+    if (!(sr2 & SPI_FLASH_STATUS2_QE)) {
+        uint8_t new_sr[] = {spi_flash_read_status(), sr2 | SPI_FLASH_STATUS2_QE};
+        struct spi_flash_cmd wren = {.opcode = SPI_CMD_VOLATILE_SR_WRITE_ENABLE};
+        struct spi_flash_cmd cmd = {.opcode = SPI_CMD_WRITE_STATUS2, .tx = new_sr + 1, .tx_len = 1};
+
+        if (qe == SPI_FLASH_QE_SR2_WRSR) {
+            cmd.opcode = SPI_CMD_WRITE_STATUS1;
+            cmd.tx = new_sr;
+            cmd.tx_len = sizeof(new_sr);
+        }
+
+        spi_flash_cmd_exec(&wren);
+        spi_flash_cmd_exec(&cmd);
+        while (spi_flash_is_busy());
+
+        if (!(spi_flash_read_status2() & SPI_FLASH_STATUS2_QE)) return 0;
+    }
+
+    qspi_flash_init();
+    return 1;
 }
 
 /*
@@ -281,7 +656,99 @@ int spi_flash_poll_write_enable(void)
 */
 int spi_flash_is_busy(void) 
 {
-    return spi_flash_read_status() & SPI_FLASH_STATUS_BUSY;
+    struct spi_flash_erase_state *erase = &FLASH_ERASE[CURRENT_FLASH];
+
+    // a suspended erase isn't busy, but whoever's asking is waiting on it
+    if (erase->suspended) spi_flash_erase_resume();
+
+    int busy = spi_flash_read_status() & SPI_FLASH_STATUS_BUSY;
+    if (!busy) {
+        erase->pending = 0;
+        erase->background = 0;
+        FLASH_WRITE_PENDING[CURRENT_FLASH] = 0;
+    }
+    return busy;
+}
+
+/*
+    If a nonblocking page program was started on the current flash, wait for it to finish
+*/
+static void spi_flash_wait_write(void)
+{
+    if (!FLASH_WRITE_PENDING[CURRENT_FLASH]) return;
+    while (spi_flash_is_busy());
+}
+
+/*
+    If a nonblocking erase was started on the current flash, wait for it to finish.
+
+    The chip ignores reads and writes while it's erasing, so this needs to be done before
+    talking to it
+*/
+void spi_flash_wait_erase(void)
+{
+    if (!FLASH_ERASE[CURRENT_FLASH].pending) return;
+    while (spi_flash_is_busy());
+}
+
+/*
+    Get the current flash ready to be read.
+
+    Reads take priority over background erases (see spi_flash_erase_background()), which
+    are suspended if the chip supports it. Anything else has to finish first
+*/
+static void spi_flash_prepare_read(void)
+{
+    struct spi_flash_erase_state *erase = &FLASH_ERASE[CURRENT_FLASH];
+    spi_flash_wait_write();
+    if (!erase->pending || erase->suspended) return;
+    if (erase->background && (spi_flash_erase_suspend() > 0)) return;
+    spi_flash_wait_erase();
+}
+
+/*
+    Suspend the erase running on the current flash so that it can be read. It's resumed
+    by spi_flash_erase_resume(), or whenever something waits on the erase.
+
+    Waits for the chip's minimum resume to suspend interval first, so back to back reads
+    can't starve the erase.
+
+    Returns 1 if the erase is suspended, 0 if there's no erase running and -1 if the
+    chip can't suspend erases
+*/
+int spi_flash_erase_suspend(void)
+{
+    struct spi_flash_erase_state *erase = &FLASH_ERASE[CURRENT_FLASH];
+    const struct spi_flash_caps *caps = &FLASH_CAPS[CURRENT_FLASH];
+
+    if (erase->suspended) return 1;
+    if (!erase->pending) return 0;
+    if (!caps->erase_suspend) return -1;
+
+    while ((time_us_32() - erase->resume_us) < caps->resume_interval_us);
+
+    struct spi_flash_cmd cmd = {.opcode = caps->suspend_opcode};
+    spi_flash_cmd_exec(&cmd);
+    busy_wait_us_32(caps->suspend_latency_us);
+    while (spi_flash_read_status() & SPI_FLASH_STATUS_BUSY);
+
+    // if the erase finished just before the suspend, the resume is ignored by the chip
+    erase->suspended = 1;
+    return 1;
+}
+
+/*
+    Resume a suspended erase on the current flash
+*/
+void spi_flash_erase_resume(void)
+{
+    struct spi_flash_erase_state *erase = &FLASH_ERASE[CURRENT_FLASH];
+    if (!erase->suspended) return;
+
+    struct spi_flash_cmd cmd = {.opcode = FLASH_CAPS[CURRENT_FLASH].resume_opcode};
+    spi_flash_cmd_exec(&cmd);
+    erase->suspended = 0;
+    erase->resume_us = time_us_32();
 }
 
 int spi_flash_is_write_enabled(void)
@@ -294,16 +761,10 @@ int spi_flash_is_write_enabled(void)
 */
 enum spi_flash_status1 spi_flash_read_status(void)
 {
-    uint8_t cmd = SPI_CMD_READ_STATUS1;
     uint8_t rtn = 0;
+    struct spi_flash_cmd cmd = {.opcode = SPI_CMD_READ_STATUS1, .rx = &rtn, .rx_len = 1};
 
-    spi_cs_put(0);
-
-    spi_write_blocking(flash_spi, &cmd, 1);
-    spi_read_blocking(flash_spi, 0x00, &rtn, 1);
-
-    spi_cs_put(1);
-
+    spi_flash_cmd_exec(&cmd);
     return rtn;
 }
 
@@ -314,10 +775,11 @@ enum spi_flash_status1 spi_flash_read_status(void)
 */
 int spi_flash_write_enable(void)
 {
-    uint8_t cmd = SPI_CMD_WRITE_ENABLE;
-    spi_cs_put(0);
-    spi_write_blocking(flash_spi, &cmd, 1);
-    spi_cs_put(1);
+    // WREN is ignored while the chip is busy
+    spi_flash_wait_erase();
+    spi_flash_wait_write();
+    struct spi_flash_cmd cmd = {.opcode = SPI_CMD_WRITE_ENABLE};
+    spi_flash_cmd_exec(&cmd);
 
     // check that write enable status is set
     while (!spi_flash_is_write_enabled());
@@ -332,24 +794,81 @@ int spi_flash_write_enable(void)
 */
 int spi_flash_sector_erase_blocking(uint32_t addr)
 {
-    uint8_t cmd = SPI_CMD_SECTOR_ERASE_4ADDR;
-    uint8_t addr_u8[] = {BE_U32_TO_4U8(addr)}; // ensure proper endianness
+    if (spi_flash_erase_nonblocking(SPI_FLASH_ERASE_4K, addr)) return -1;
 
-    if (spi_flash_write_enable()) return -1;
+    // wait for erase to finish
+    while (spi_flash_is_busy());
+    return 0;
+}
 
-    spi_cs_put(0);
-    spi_write_blocking(flash_spi, &cmd, 1);
+/*
+    Start an erase of type at addr. Does not block until the erase is finished. 
+    
+    Subsequent operations should check that the erase is finished (via the busy status) before 
+    talking to the chip
 
-    spi_write_blocking(flash_spi, addr_u8, 4);
+    There's no 4 byte address version of the 32k erase, so the top address byte goes in
+    the extended address register for that one
 
-    spi_cs_put(1);
+    Returns -1 if the chip doesn't support type
+*/
+int spi_flash_erase_nonblocking(enum spi_flash_erase_type type, uint32_t addr)
+{
+    const struct spi_flash_caps *caps = &FLASH_CAPS[CURRENT_FLASH];
+    struct spi_flash_cmd cmd = {.addr = addr, .addr_len = caps->addr_bytes};
+
+    if ((type >= SPI_FLASH_ERASE_NUM_TYPES) || !(caps->erase_supported & (1 << type))) return -1;
+
+    switch (type) {
+        case SPI_FLASH_ERASE_4K:
+            cmd.opcode = (caps->addr_bytes == 4) ? SPI_CMD_SECTOR_ERASE_4ADDR : SPI_CMD_SECTOR_ERASE;
+            break;
+        case SPI_FLASH_ERASE_32K:
+            if (caps->addr_bytes == 4) spi_write_extended_addr_reg(addr >> 24);
+            cmd.opcode = SPI_CMD_32K_BLOCK_ERASE;
+            cmd.addr_len = 3;
+            break;
+        case SPI_FLASH_ERASE_64K:
+            cmd.opcode = (caps->addr_bytes == 4) ? SPI_CMD_64K_BLOCK_ERASE : SPI_CMD_64K_BLOCK_ERASE_3ADDR;
+            break;
+        case SPI_FLASH_ERASE_CHIP:
+            cmd.opcode = SPI_CMD_CHIP_ERASE;
+            cmd.addr_len = 0;
+            break;
+        default:
+            return -1;
+    }
+
+    if (spi_flash_write_enable()) return -1;
+    if (spi_flash_cmd_exec(&cmd)) return -1;
+    FLASH_ERASE[CURRENT_FLASH].pending = 1;
+    FLASH_ERASE[CURRENT_FLASH].background = 0;
+    FLASH_ERASE[CURRENT_FLASH].resume_us = time_us_32();
 
-    // wait for erase to finish
-    // spi_flash_poll_busy();
-    while (spi_flash_is_busy());
     return 0;
 }
 
+/*
+    Start an erase that nothing is waiting on. Reads of the chip suspend it
+    instead of waiting for it to finish
+*/
+int spi_flash_erase_background(enum spi_flash_erase_type type, uint32_t addr)
+{
+    if (spi_flash_erase_nonblocking(type, addr)) return -1;
+    FLASH_ERASE[CURRENT_FLASH].background = 1;
+    return 0;
+}
+
+/*
+    Stop treating the erase on the current flash as a background erase, so that reads wait for
+    it to finish instead of suspending it. Resumes it if it's suspended
+*/
+void spi_flash_erase_foreground(void)
+{
+    spi_flash_erase_resume();
+    FLASH_ERASE[CURRENT_FLASH].background = 0;
+}
+
 /*
     Erases a block (64k) of flash memory specified by addr. 
     
@@ -358,83 +877,432 @@ int spi_flash_sector_erase_blocking(uint32_t addr)
 */
 int spi_flash_64k_erase_nonblocking(uint32_t addr)
 {
-    uint8_t cmd = SPI_CMD_64K_BLOCK_ERASE;
+    return spi_flash_erase_nonblocking(SPI_FLASH_ERASE_64K, addr);
+}
+
+/*
+    Typical and max erase times for chip, indexed by enum spi_flash_erase_type
+*/
+const struct spi_flash_erase_time *spi_flash_get_erase_times(enum spi_flash_chip chip)
+{
+    return FLASH_CAPS[chip].erase_times;
+}
+
+uint32_t spi_flash_get_size(enum spi_flash_chip chip)
+{
+    return FLASH_CAPS[chip].size;
+}
+
+const struct spi_flash_caps *spi_flash_get_caps(enum spi_flash_chip chip)
+{
+    return &FLASH_CAPS[chip];
+}
+
+enum spi_flash_chip spi_flash_get_current_chip(void)
+{
+    return CURRENT_FLASH;
+}
+
+/*
+    Select the read command used for chip
+
+    dummy_bytes is the number of dummy bytes (8 clocks each) sent after the address for fast read.
+    Returns -1 if dummy_bytes is out of range
+*/
+int spi_flash_set_read_mode(enum spi_flash_chip chip, enum spi_flash_read_mode mode, uint8_t dummy_bytes)
+{
+    if (chip >= SPI_FLASH_NUM_CHIPS) return -1;
+    if (dummy_bytes > SPI_FLASH_MAX_DUMMY_BYTES) return -1;
+
+    FLASH_READ_CONFIG[chip].mode = mode;
+    FLASH_READ_CONFIG[chip].dummy_bytes = dummy_bytes;
+    return 0;
+}
+
+/*
+    Quad output fast read. Command, address and dummy byte go out on D0, data comes back on D0-D3
+*/
+static void spi_flash_quad_read(uint32_t addr, uint8_t *data, uint32_t len)
+{
+    const struct spi_flash_caps *caps = &FLASH_CAPS[CURRENT_FLASH];
+    uint8_t cmd[1 + 4 + SPI_FLASH_MAX_DUMMY_BYTES];
     uint8_t addr_u8[] = {BE_U32_TO_4U8(addr)}; // ensure proper endianness
 
-    if (spi_flash_write_enable()) return -1;
+    cmd[0] = (caps->addr_bytes == 4) ? SPI_CMD_READ_DATA_4ADDR_QUAD_OUT : SPI_CMD_READ_DATA_QUAD_OUT;
+    memcpy(cmd + 1, addr_u8 + sizeof(addr_u8) - caps->addr_bytes, caps->addr_bytes);
+    memset(cmd + 1 + caps->addr_bytes, 0x00, caps->quad_read_dummy_bytes);
 
     spi_cs_put(0);
+    spi_write_blocking(flash_spi, cmd, 1 + caps->addr_bytes + caps->quad_read_dummy_bytes);
+    qspi_flash_read(data, len, CURRENT_FLASH_BAUD);
+    spi_cs_put(1);
+}
 
-    spi_write_blocking(flash_spi, &cmd, 1);
-    spi_write_blocking(flash_spi, addr_u8, 4);
+/*
+    Build the command, address and dummy bytes for a read of the current flash into cmd
+
+    Returns the number of bytes to send
+*/
+static uint8_t spi_flash_build_read_cmd(uint32_t addr, uint8_t *cmd)
+{
+    struct spi_flash_read_config *cfg = &FLASH_READ_CONFIG[CURRENT_FLASH];
+    enum spi_flash_read_mode mode = cfg->mode;
+    uint8_t addr_bytes = FLASH_CAPS[CURRENT_FLASH].addr_bytes;
+    uint8_t addr_u8[] = {BE_U32_TO_4U8(addr)}; // ensure proper endianness
+
+    if (mode == SPI_FLASH_READ_AUTO) {
+        mode = (CURRENT_FLASH_BAUD > SPI_FLASH_NORMAL_READ_MAX_BAUD) ? SPI_FLASH_READ_FAST : SPI_FLASH_READ_NORMAL;
+    }
+
+    if (addr_bytes == 4) {
+        cmd[0] = (mode == SPI_FLASH_READ_FAST) ? SPI_CMD_READ_DATA_4ADDR_FAST : SPI_CMD_READ_DATA_4ADDR;
+    } else {
+        cmd[0] = (mode == SPI_FLASH_READ_FAST) ? SPI_CMD_READ_DATA_FAST : SPI_CMD_READ_DATA;
+    }
+    memcpy(cmd + 1, addr_u8 + sizeof(addr_u8) - addr_bytes, addr_bytes);
+    if (mode != SPI_FLASH_READ_FAST) return 1 + addr_bytes;
+
+    memset(cmd + 1 + addr_bytes, 0x00, cfg->dummy_bytes);
+    return 1 + addr_bytes + cfg->dummy_bytes;
+}
+
+/*
+    DMA completion handler for flash reads
+
+    The RX channel finishes last (every byte clocked out has to come back in), so once it's
+    done the transfer is over and CS can be released
+*/
+static void spi_flash_dma_irq_handler(void)
+{
+    if (!dma_channel_get_irq0_status(bs_spi_dma)) return; // shared IRQ, might not be ours
+    dma_channel_acknowledge_irq0(bs_spi_dma);
 
     spi_cs_put(1);
+    if (spi_flash_dma_crc) {
+        *spi_flash_dma_crc = dma_crc_detach();
+        spi_flash_dma_crc = NULL;
+    }
+    spi_flash_dma_busy = 0;
+    if (spi_flash_dma_done_cb) spi_flash_dma_done_cb();
+}
+
+/*
+    Claim and configure the DMA channels used for flash reads
+
+    RX channel moves flash_spi's DR into memory, TX channel repeatedly writes a dummy 0x00 into DR
+    so that the SPI peripheral keeps clocking. Both are paced by the SPI DREQs.
+*/
+void spi_flash_init_dma(void)
+{
+    if (bs_spi_dma >= 0) return;
+
+    bs_spi_dma = dma_claim_unused_channel(true);
+    bs_spi_dma_tx = dma_claim_unused_channel(true);
+
+    bs_spi_dma_config = dma_channel_get_default_config(bs_spi_dma);
+    channel_config_set_transfer_data_size(&bs_spi_dma_config, DMA_SIZE_8);
+    channel_config_set_dreq(&bs_spi_dma_config, spi_get_dreq(flash_spi, false));
+    channel_config_set_read_increment(&bs_spi_dma_config, false);
+    channel_config_set_write_increment(&bs_spi_dma_config, true);
+
+    bs_spi_dma_tx_config = dma_channel_get_default_config(bs_spi_dma_tx);
+    channel_config_set_transfer_data_size(&bs_spi_dma_tx_config, DMA_SIZE_8);
+    channel_config_set_dreq(&bs_spi_dma_tx_config, spi_get_dreq(flash_spi, true));
+    channel_config_set_read_increment(&bs_spi_dma_tx_config, false);
+    channel_config_set_write_increment(&bs_spi_dma_tx_config, false);
+
+    bs_spi_dma_tx_buf_config = bs_spi_dma_tx_config;
+    channel_config_set_read_increment(&bs_spi_dma_tx_buf_config, true);
+
+    dma_channel_set_irq0_enabled(bs_spi_dma, true);
+    irq_add_shared_handler(DMA_IRQ_0, spi_flash_dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+}
+
+/*
+    Check if a DMA flash read is still running
+*/
+int spi_flash_dma_is_busy(void)
+{
+    return spi_flash_dma_busy;
+}
+
+static int spi_flash_start_read_dma(uint32_t addr, uint8_t *data, uint32_t len, spi_flash_dma_cb cb, uint32_t *crc)
+{
+    uint8_t cmd[1 + 4 + SPI_FLASH_MAX_DUMMY_BYTES];
+
+    if (spi_flash_dma_busy) return -1;
+    spi_flash_prepare_read();
+
+    if (FLASH_QUAD[CURRENT_FLASH] > 0) {
+        // PIO quad reads block until they are done
+        spi_flash_quad_read(addr, data, len);
+        if (crc) *crc = dma_crc32(*crc, data, len);
+        if (cb) cb();
+        return 0;
+    }
+
+    spi_flash_init_dma();
+
+    uint8_t cmd_len = spi_flash_build_read_cmd(addr, cmd);
+
+    spi_cs_put(0);
+    spi_write_blocking(flash_spi, cmd, cmd_len); // also drains the RX FIFO for us
+
+    if (!len) {
+        spi_cs_put(1);
+        if (cb) cb();
+        return 0;
+    }
+
+    spi_flash_dma_done_cb = cb;
+    spi_flash_dma_crc = crc;
+    spi_flash_dma_busy = 1;
+
+    dma_channel_config rx_config = bs_spi_dma_config;
+    if (crc) dma_crc_attach(bs_spi_dma, &rx_config, *crc);
+
+    dma_channel_configure(bs_spi_dma, &rx_config, data, &spi_get_hw(flash_spi)->dr, len, false);
+    dma_channel_configure(bs_spi_dma_tx, &bs_spi_dma_tx_config, &spi_get_hw(flash_spi)->dr, &spi_dma_tx_dummy, len, false);
+
+    // start both at once so TX can't overrun the RX FIFO before RX is running
+    dma_start_channel_mask((1u << bs_spi_dma) | (1u << bs_spi_dma_tx));
 
     return 0;
 }
 
+/*
+    Start a read of len bytes from SPI flash at addr into data using DMA. 
+
+    Returns immediately after the command and address are sent. CS is released and cb 
+    (if not NULL) is called from the DMA IRQ once all the data has arrived. data must not be 
+    touched until then.
+
+    Returns -1 if a DMA read is already in progress
+*/
+int spi_flash_read_dma(uint32_t addr, uint8_t *data, uint32_t len, spi_flash_dma_cb cb)
+{
+    return spi_flash_start_read_dma(addr, data, len, cb, NULL);
+}
+
+/*
+    Same as spi_flash_read_dma(), but the DMA sniffer also runs the data through CRC-32 on its
+    way in. *crc is the starting value and gets the result once the read is done (before cb is 
+    called), so a read can be chained on from the last one
+*/
+int spi_flash_read_dma_crc(uint32_t addr, uint8_t *data, uint32_t len, spi_flash_dma_cb cb, uint32_t *crc)
+{
+    return spi_flash_start_read_dma(addr, data, len, cb, crc);
+}
+
 /*
     Read len memory from SPI flash from addr into data.
+
+    Blocks until the read is finished
 */
 int spi_flash_read(uint32_t addr, uint8_t *data, uint32_t len)
 {
-    uint8_t cmd = SPI_CMD_READ_DATA_4ADDR;
+    while (spi_flash_dma_is_busy()); // let a queued job's read finish first
+    if (spi_flash_read_dma(addr, data, len, NULL)) return -1;
+    while (spi_flash_dma_is_busy());
+
+    return 0;
+}
+
+/*
+    Blocking read that also updates *crc (CRC-32, see dma_crc.h) with the data read
+*/
+int spi_flash_read_crc(uint32_t addr, uint8_t *data, uint32_t len, uint32_t *crc)
+{
+    while (spi_flash_dma_is_busy());
+    if (spi_flash_read_dma_crc(addr, data, len, NULL, crc)) return -1;
+    while (spi_flash_dma_is_busy());
+
+    return 0;
+}
+
+/*
+    Build a page program frame (command, address, data) for addr in frame
+
+    Returns the length of the frame
+*/
+static uint16_t spi_flash_stage_page(volatile uint8_t *frame, uint32_t addr, const uint8_t *data, uint16_t len)
+{
+    uint8_t addr_bytes = FLASH_CAPS[CURRENT_FLASH].addr_bytes;
     uint8_t addr_u8[] = {BE_U32_TO_4U8(addr)}; // ensure proper endianness
 
+    if (addr_bytes == 4) {
+        frame[0] = (FLASH_QUAD[CURRENT_FLASH] > 0) ? SPI_CMD_PAGE_4ADDR_QUAD_PROGRAM : SPI_CMD_PAGE_4ADDR_PROGRAM;
+    } else {
+        frame[0] = (FLASH_QUAD[CURRENT_FLASH] > 0) ? SPI_CMD_PAGE_QUAD_PROGRAM : SPI_CMD_PAGE_PROGRAM;
+    }
+    memcpy((uint8_t *)frame + 1, addr_u8 + sizeof(addr_u8) - addr_bytes, addr_bytes);
+    memcpy((uint8_t *)frame + 1 + addr_bytes, data, len);
+    return len + 1 + addr_bytes;
+}
+
+/*
+    Clock out a frame built by spi_flash_stage_page(). Write enable must already be set.
+
+    Single bit frames are sent by DMA so that the next page can be staged while this one goes
+    out. spi_flash_wait_program_frame() must be called before anything else uses the bus.
+*/
+static void spi_flash_send_program_frame(volatile uint8_t *frame, uint16_t frame_len)
+{
     spi_cs_put(0);
-    spi_write_blocking(flash_spi, &cmd, 1);
 
-    spi_write_blocking(flash_spi, addr_u8, 4);
+    if (FLASH_QUAD[CURRENT_FLASH] > 0) {
+        uint8_t hdr_len = 1 + FLASH_CAPS[CURRENT_FLASH].addr_bytes;
+        spi_write_blocking(flash_spi, (uint8_t *)frame, hdr_len);
+        qspi_flash_write((uint8_t *)frame + hdr_len, frame_len - hdr_len, CURRENT_FLASH_BAUD);
+        spi_cs_put(1);
+        return;
+    }
 
-    // need a dummy byte for fast read
-    // cmd = 0x00;
-    // spi_write_blocking(flash_spi, &cmd, 1); 
+    spi_flash_frame_in_flight = 1;
+    dma_channel_configure(bs_spi_dma_tx, &bs_spi_dma_tx_buf_config, &spi_get_hw(flash_spi)->dr,
+        frame, frame_len, true);
+}
 
-    spi_read_blocking(flash_spi, 0x00, data, len);
+/*
+    Wait for a frame from spi_flash_send_program_frame() to finish and release CS
+*/
+static void spi_flash_wait_program_frame(void)
+{
+    if (!spi_flash_frame_in_flight) return;
+
+    dma_channel_wait_for_finish_blocking(bs_spi_dma_tx);
+    while (spi_is_busy(flash_spi));
+
+    // nothing was reading RX during the transfer, so drain it and clear the overrun
+    while (spi_is_readable(flash_spi)) (void)spi_get_hw(flash_spi)->dr;
+    spi_get_hw(flash_spi)->icr = SPI_SSPICR_RORIC_BITS;
 
     spi_cs_put(1);
+    spi_flash_frame_in_flight = 0;
+}
 
-    return 0;
+static void spi_flash_record_page(uint32_t latency_us)
+{
+    FLASH_WRITE_STATS.pages++;
+    FLASH_WRITE_STATS.total_us += latency_us;
+    FLASH_WRITE_STATS.min_us = min(FLASH_WRITE_STATS.min_us, latency_us);
+    FLASH_WRITE_STATS.max_us = max(FLASH_WRITE_STATS.max_us, latency_us);
+}
+
+void spi_flash_reset_write_stats(void)
+{
+    memset(&FLASH_WRITE_STATS, 0x00, sizeof(FLASH_WRITE_STATS));
+    FLASH_WRITE_STATS.min_us = UINT32_MAX;
+}
+
+const struct spi_flash_write_stats *spi_flash_get_write_stats(void)
+{
+    return &FLASH_WRITE_STATS;
 }
 
 /*
-    Writes up to 1 page (256 bytes) of memory into the SPI flash
+    Check if data is all 0xFF (i.e. the same as erased flash), a word at a time
+*/
+int spi_flash_is_erased(const uint8_t *data, uint32_t len)
+{
+    // bytes until data is word aligned
+    while (len && ((uintptr_t)data & 0x03)) {
+        if (*data++ != 0xFF) return 0;
+        len--;
+    }
 
-    Will write len + 1 bytes
+    const uint32_t *words = (const uint32_t *)data;
+    for (; len >= 4; len -= 4) {
+        if (*words++ != 0xFFFFFFFF) return 0;
+    }
+
+    data = (const uint8_t *)words;
+    while (len--) {
+        if (*data++ != 0xFF) return 0;
+    }
+    return 1;
+}
+
+/*
+    Starts a write of up to 1 page (256 bytes) of memory into the SPI flash
 
     Note that writes cannot cross page boundries, meaning writes that start
     on byte 0-255 cannot continue on to byte 256+. If this function is specified to
     write beyond a page boundary, the attempt will be aborted and -1 will be returned.
+
+    All 0xFF data is already there after an erase, so it's skipped and counted in the write stats.
+
+    Does not wait for the program to finish, check the busy status before talking to the chip again
 */
-int spi_flash_page_program_blocking(uint32_t addr, uint8_t *data, uint16_t len)
+int spi_flash_page_program_nonblocking(uint32_t addr, uint8_t *data, uint16_t len)
 {
-    uint16_t write_len = len;
-    // write_len++;
-
-    // addr & ~0xFF should be start of page, so +0x100 should be next page
-    if ((addr + (uint32_t)write_len) > ((addr & ~(uint32_t)0xFF) + (uint32_t)0x100)) return -1; // ensure write does not go past end of page
+    uint32_t page_size = FLASH_CAPS[CURRENT_FLASH].page_size;
+    if ((addr + (uint32_t)len) > ((addr & ~(page_size - 1)) + page_size)) return -1; // ensure write does not go past end of page
+    if (spi_flash_is_erased(data, len)) {
+        FLASH_WRITE_STATS.skipped_bytes += len;
+        return 0;
+    }
 
-    uint8_t cmd = SPI_CMD_PAGE_4ADDR_PROGRAM;
-    uint8_t addr_u8[] = {BE_U32_TO_4U8(addr)}; // ensure proper endianness
+    while (spi_flash_dma_is_busy());
+    spi_flash_init_dma();
+    uint16_t frame_len = spi_flash_stage_page(RD_WR_BUF_A, addr, data, len);
 
     if (spi_flash_write_enable()) return -1; // ensure write is enabled
 
-    spi_cs_put(0);
-    spi_write_blocking(flash_spi, &cmd, 1);
+    spi_flash_send_program_frame(RD_WR_BUF_A, frame_len);
+    spi_flash_wait_program_frame();
+    FLASH_WRITE_PENDING[CURRENT_FLASH] = 1;
 
-    spi_write_blocking(flash_spi, addr_u8, 4);
+    return 0;
+}
 
-    spi_write_blocking(flash_spi, data, len);
+/*
+    Writes up to 1 page (256 bytes) of memory into the SPI flash
 
-    spi_cs_put(1);
+    See spi_flash_page_program_nonblocking(). Blocks until the write is finished
+*/
+int spi_flash_page_program_blocking(uint32_t addr, uint8_t *data, uint16_t len)
+{
+    if (spi_flash_page_program_nonblocking(addr, data, len)) return -1;
 
     // wait for write to finish
-    // spi_flash_poll_busy();
     while (spi_flash_is_busy());
 
     return 0;
 }
 
+/*
+    Program up to a page while the erase on the current flash is suspended (see
+    spi_flash_erase_suspend()), without waiting for the erase. addr mustn't be in the block
+    being erased.
+
+    Blocks until the program is finished and leaves the erase suspended. Returns -1 if
+    there's no suspended erase
+*/
+int spi_flash_page_program_suspended(uint32_t addr, uint8_t *data, uint16_t len)
+{
+    uint32_t page_size = FLASH_CAPS[CURRENT_FLASH].page_size;
+    if (!FLASH_ERASE[CURRENT_FLASH].suspended) return -1;
+    if ((addr + (uint32_t)len) > ((addr & ~(page_size - 1)) + page_size)) return -1;
+
+    while (spi_flash_dma_is_busy());
+    spi_flash_init_dma();
+    uint16_t frame_len = spi_flash_stage_page(RD_WR_BUF_A, addr, data, len);
+
+    // not spi_flash_write_enable(), that waits for the erase
+    struct spi_flash_cmd cmd = {.opcode = SPI_CMD_WRITE_ENABLE};
+    spi_flash_cmd_exec(&cmd);
+    while (!spi_flash_is_write_enabled());
+
+    spi_flash_send_program_frame(RD_WR_BUF_A, frame_len);
+    spi_flash_wait_program_frame();
+
+    // spi_flash_is_busy() would resume the erase
+    while (spi_flash_read_status() & SPI_FLASH_STATUS_BUSY);
+    return 0;
+}
+
 /*
     Checks flash memory for a bitstream beginning at offset
 */
@@ -450,12 +1318,7 @@ Takes a while (like 2 minutes)
 */
 int spi_flash_chip_erase_blocking(void)
 {
-    if (spi_flash_write_enable()) return -1; // ensure write is enabled
-
-    uint8_t cmd = SPI_CMD_CHIP_ERASE;
-    spi_cs_put(0);
-    spi_write_blocking(flash_spi, &cmd, 1);
-    spi_cs_put(1);
+    if (spi_flash_erase_nonblocking(SPI_FLASH_ERASE_CHIP, 0)) return -1;
 
     while (spi_flash_is_busy());
     return 0;
@@ -463,17 +1326,62 @@ int spi_flash_chip_erase_blocking(void)
 
 /*
     Writes an arbitrary amount of data to the flash chip
+
+    Pages are pipelined: while one page is being sent and programmed, the next is staged
+    (command, address and data) in the other buffer so that it can go out as soon as the
+    chip stops being busy. Per-page timing is recorded in the write stats.
 */
 int spi_flash_write_buffer(uint32_t addr, uint8_t *buf, uint32_t len)
 {
+    volatile uint8_t *stage_bufs[] = {RD_WR_BUF_A, RD_WR_BUF_B};
+    uint8_t cur_buf = 0;
     uint32_t bytes_written = 0;
-    int rtn = 0;
+    uint32_t page_start_us = 0;
+    uint32_t ready_us = 0;
+    int page_in_flight = 0;
+    uint32_t page_size = FLASH_CAPS[CURRENT_FLASH].page_size;
+
+    while (spi_flash_dma_is_busy());
+    spi_flash_init_dma();
     while (bytes_written < len) {
-        uint32_t next_page = (addr + 256) & ~0xFF;
-        uint16_t to_write = min(next_page - addr, len);
-        if (rtn = spi_flash_page_program_blocking(addr, buf + bytes_written, to_write), rtn) return rtn;
+        uint32_t next_page = (addr + page_size) & ~(page_size - 1);
+        uint16_t to_write = min(next_page - addr, len - bytes_written);
+
+        // erased flash is already 0xFF, nothing to program
+        if (spi_flash_is_erased(buf + bytes_written, to_write)) {
+            FLASH_WRITE_STATS.skipped_bytes += to_write;
+            addr += to_write;
+            bytes_written += to_write;
+            continue;
+        }
+
+        // stage while the last page goes out/programs
+        uint16_t frame_len = spi_flash_stage_page(stage_bufs[cur_buf], addr, buf + bytes_written, to_write);
+
+        spi_flash_wait_program_frame();
+        if (page_in_flight) {
+            while (spi_flash_is_busy());
+            ready_us = time_us_32();
+            spi_flash_record_page(ready_us - page_start_us);
+        }
+
+        if (spi_flash_write_enable()) return -1;
+        spi_flash_send_program_frame(stage_bufs[cur_buf], frame_len);
+
+        uint32_t now_us = time_us_32();
+        if (page_in_flight) FLASH_WRITE_STATS.gap_us += now_us - ready_us;
+        page_start_us = now_us;
+        page_in_flight = 1;
+
+        cur_buf ^= 1;
         addr += to_write;
         bytes_written += to_write;
     }
+
+    spi_flash_wait_program_frame();
+    if (page_in_flight) {
+        while (spi_flash_is_busy());
+        spi_flash_record_page(time_us_32() - page_start_us);
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -13,19 +13,168 @@ enum spi_flash_status1 {
     SPI_FLASH_STATUS_PROTECT = 0b10000000,
 };
 
+enum spi_flash_chip {
+    SPI_FLASH_BITSTREAM = 0,
+    SPI_FLASH_FIRMWARE,
+    SPI_FLASH_NUM_CHIPS
+};
+
+/*
+    Read command used by spi_flash_read()
+
+    AUTO uses normal read (0x13) when the bus is slow enough for it and fast read (0x0C)
+    otherwise
+*/
+enum spi_flash_read_mode {
+    SPI_FLASH_READ_AUTO = 0,
+    SPI_FLASH_READ_NORMAL,
+    SPI_FLASH_READ_FAST
+};
+
+// max clock for the normal read command, fast read must be used above this
+#define SPI_FLASH_NORMAL_READ_MAX_BAUD 50000000
+#define SPI_FLASH_DEFAULT_DUMMY_BYTES 1 // 8 dummy clocks
+#define SPI_FLASH_MAX_DUMMY_BYTES 4
+
+enum spi_flash_status2 {
+    SPI_FLASH_STATUS2_QE = 0b10, // quad enable on Winbond/GigaDevice parts
+};
+
+enum spi_flash_manufacturer {
+    SPI_FLASH_MFR_WINBOND = 0xEF,
+    SPI_FLASH_MFR_GIGADEVICE = 0xC8,
+};
+
+enum firmware_spi_pins {
+    FW_SPI_DI = 3, // QSPI_D0
+    FW_SPI_DO = 0, // QSPI_D1
+    FW_SPI_CLK = 2, // QSPI_SCLK
+    FW_SPI_CS = 1, //QSPI_CS
+    // NOTE: For single bit SPI, set these both high
+    FW_SPI_W_NEN = 4, // QSPI_D2/write enable (low)
+    FW_SPI_NHOLD = 5 // QSPI_D3/hold (low)
+};
+
+enum spi_flash_erase_type {
+    SPI_FLASH_ERASE_4K = 0,
+    SPI_FLASH_ERASE_32K,
+    SPI_FLASH_ERASE_64K,
+    SPI_FLASH_ERASE_CHIP,
+    SPI_FLASH_ERASE_NUM_TYPES
+};
+
+struct spi_flash_erase_time {
+    uint32_t typ_ms;
+    uint32_t max_ms;
+};
+
+#define SPI_FLASH_PAGE_SIZE 256 // largest page size we handle
+#define SPI_FLASH_PROGRAM_HDR_LEN 5 // command + 4 byte address
+
+/*
+    How quad mode gets turned on
+*/
+enum spi_flash_quad_enable {
+    SPI_FLASH_QE_UNKNOWN = 0, // not in SFDP, go by manufacturer
+    SPI_FLASH_QE_NONE, // no quad support we can use
+    SPI_FLASH_QE_SR2_WRSR2, // QE is status register 2 bit 1, written with write status 2 (0x31)
+    SPI_FLASH_QE_SR2_WRSR, // QE is status register 2 bit 1, written with write status (0x01) along with SR1
+};
+
+/*
+    What a flash chip can do. Filled in from JEDEC ID/SFDP by spi_flash_probe(), the defaults
+    are for the W25Q256JV
+*/
+struct spi_flash_caps {
+    uint32_t jedec_id;
+    uint32_t size;
+    uint16_t page_size;
+    uint8_t addr_bytes; // 4 if the 4 byte address commands are supported, 3 otherwise
+    uint8_t erase_supported; // bit for each enum spi_flash_erase_type
+    struct spi_flash_erase_time erase_times[SPI_FLASH_ERASE_NUM_TYPES];
+    uint8_t quad_read_dummy_bytes; // for quad output fast read
+    enum spi_flash_quad_enable quad_enable;
+    uint8_t erase_suspend; // erase suspend/resume supported
+    uint8_t suspend_opcode;
+    uint8_t resume_opcode;
+    uint32_t suspend_latency_us; // max time from suspend to the chip being readable
+    uint32_t resume_interval_us; // min time from resume to the next suspend, so the erase makes progress
+    uint8_t probed;
+    uint8_t from_sfdp;
+};
+
+/*
+    Page program timing from spi_flash_write_buffer()
+*/
+struct spi_flash_write_stats {
+    uint32_t pages;
+    uint32_t total_us; // from sending the page to the chip no longer being busy
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t gap_us; // time between a page finishing and the next one being sent
+    uint32_t skipped_bytes; // all 0xFF data that didn't need programming
+};
+
+/*
+    A single flash command, sent in one CS frame by spi_flash_cmd_exec()
+*/
+struct spi_flash_cmd {
+    uint8_t opcode;
+    uint8_t addr_len; // address bytes: 0, 3 or 4
+    uint8_t dummy_len; // dummy bytes (8 clocks each) after the address
+    uint32_t addr;
+    const uint8_t *tx; // written after the header
+    uint32_t tx_len;
+    uint8_t *rx; // read after tx
+    uint32_t rx_len;
+};
+
+struct spi_flash_cmd_stats {
+    uint32_t cmds;
+    uint32_t total_us; // CS low to CS high, summed over all commands
+    uint32_t bus_switches; // times flash_spi and its IO were reinitialised
+    uint32_t chip_swaps; // times flash_spi was moved between chips without reinitialising
+};
+
+// minimum CS high time between commands is 50ns on the parts we use, this covers up to 160MHz sys clock
+#define SPI_FLASH_CS_HIGH_CYCLES 8
+
 #define CONST_64k 0x10000
 #define CONST_32k 0x8000
 #define CONST_4k  0x1000
 
+typedef void (*spi_flash_dma_cb)(void);
+
 int spi_flash_read(uint32_t addr, uint8_t *data, uint32_t len); // use fast read?
+int spi_flash_read_crc(uint32_t addr, uint8_t *data, uint32_t len, uint32_t *crc);
+void spi_flash_init_dma(void);
+int spi_flash_read_dma(uint32_t addr, uint8_t *data, uint32_t len, spi_flash_dma_cb cb);
+int spi_flash_read_dma_crc(uint32_t addr, uint8_t *data, uint32_t len, spi_flash_dma_cb cb, uint32_t *crc);
+int spi_flash_dma_is_busy(void);
+int spi_flash_set_read_mode(enum spi_flash_chip chip, enum spi_flash_read_mode mode, uint8_t dummy_bytes);
 
 // writes always go from addr to page end
 int spi_flash_page_program_blocking(uint32_t addr, uint8_t *data, uint16_t len);
+int spi_flash_page_program_nonblocking(uint32_t addr, uint8_t *data, uint16_t len);
 int spi_flash_sector_erase_blocking(uint32_t addr);
 void bitstream_init_spi(uint32_t baud);
 void firmware_init_spi(uint32_t baud);
+void spi_flash_select(enum spi_flash_chip chip, uint32_t baud);
 int spi_flash_is_busy(void);
+void spi_flash_wait_erase(void);
 int spi_flash_64k_erase_nonblocking(uint32_t addr);
+int spi_flash_erase_nonblocking(enum spi_flash_erase_type type, uint32_t addr);
+const struct spi_flash_erase_time *spi_flash_get_erase_times(enum spi_flash_chip chip);
+uint32_t spi_flash_get_size(enum spi_flash_chip chip);
+uint32_t spi_flash_get_baud(void);
+const struct spi_flash_caps *spi_flash_get_caps(enum spi_flash_chip chip);
+int spi_flash_probe(void);
+int spi_flash_erase_background(enum spi_flash_erase_type type, uint32_t addr);
+int spi_flash_erase_suspend(void);
+void spi_flash_erase_resume(void);
+void spi_flash_erase_foreground(void);
+int spi_flash_page_program_suspended(uint32_t addr, uint8_t *data, uint16_t len);
+enum spi_flash_chip spi_flash_get_current_chip(void);
 void enter_4byte_mode(void);
 // int spi_flash_poll_busy(void);
 // int spi_flash_poll_write_enable(void);
@@ -36,7 +185,15 @@ uint8_t spi_read_extended_addr_reg(void);
 int spi_flash_write_enable(void);
 void spi_cs_put(uint8_t val);
 int spi_flash_write_buffer(uint32_t addr, uint8_t *buf, uint32_t len);
+int spi_flash_is_erased(const uint8_t *data, uint32_t len);
+void spi_flash_reset_write_stats(void);
+int spi_flash_cmd_exec(const struct spi_flash_cmd *cmd);
+void spi_flash_reset_cmd_stats(void);
+const struct spi_flash_cmd_stats *spi_flash_get_cmd_stats(void);
+const struct spi_flash_write_stats *spi_flash_get_write_stats(void);
 void release_spi_io(void);
+uint32_t spi_flash_read_jedec_id(void);
+int spi_flash_enable_quad(void);
 
 
 inline uint32_t sector_alignment(uint32_t addr)
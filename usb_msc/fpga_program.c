@@ -1,7 +1,10 @@
 #include <stdint.h>
+#include <string.h>
 #include "fpga_program.h"
 #include "hardware/dma.h"
 #include "hardware/spi.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
 #include "util.h"
 // GPIO7 = FPGA_DONE
 // GPIO8 = FPGA_INITB
@@ -44,15 +47,31 @@ void fpga_program_sendbyte(uint8_t databyte)
     spi_write_blocking(spi1, &databyte, 1);
 }
 
-int fpga_program_sendchunk(uint8_t *data, uint32_t len)
-{
-    return spi_write_blocking(spi1, data, len);
-}
-static volatile uint8_t FPGA_WRITE_BUF[512];
+/*
+    DMA streaming to the FPGA
+
+    Two buffers take turns: one is filled (by the CPU or another DMA) while this DMA sends the
+    other. Each finished buffer raises DMA_IRQ_1, which frees it and starts the other one if
+    it's been filled, so the filler only has to keep buffers coming. Buffers are claimed with
+    fpga_dma_get_buf() and sent in the order they were claimed, so the next one can be claimed
+    before the last one's been submitted.
+*/
+static uint8_t FPGA_DMA_BUF[2][FPGA_BUF_SIZE];
+static volatile uint32_t FPGA_DMA_LEN[2]; // bytes queued in each buffer, 0 when it's free
+static volatile int FPGA_DMA_SENDING = -1; // buffer the DMA is on, -1 if idle
+static int FPGA_DMA_FILL = 0; // oldest claimed buffer, the next fpga_dma_submit()
+static volatile int FPGA_DMA_CLAIMED = 0; // buffers claimed but not submitted yet
 dma_channel_config fpga_dma_config;
 int fpga_dma = -1;
 
 
+static uint32_t FPGA_BAUD = 0; // actual baud, not what was asked for
+
+uint32_t fpga_program_get_baud(void)
+{
+    return FPGA_BAUD;
+}
+
 void fpga_program_init(uint32_t baud)
 {
     // set prog high
@@ -62,7 +81,7 @@ void fpga_program_init(uint32_t baud)
     FPGA_DONE_PIN_SETUP();
 
     spi_deinit(spi1);
-    spi_init(spi1, baud);
+    FPGA_BAUD = spi_init(spi1, baud);
 
     gpio_set_function(11, GPIO_FUNC_SPI); // TX pin
     gpio_set_function(10, GPIO_FUNC_SPI); // CLK pin
@@ -160,8 +179,31 @@ uint32_t get_bitstream_length(uint8_t *bitstream, uint16_t len)
     return bs_len;
 }
 
+static void fpga_dma_start(int buf)
+{
+    FPGA_DMA_SENDING = buf;
+    dma_channel_configure(fpga_dma, &fpga_dma_config, &spi_get_hw(spi1)->dr,
+        FPGA_DMA_BUF[buf], FPGA_DMA_LEN[buf], true);
+}
+
+static void fpga_dma_irq_handler(void)
+{
+    if (!dma_channel_get_irq1_status(fpga_dma)) return; // shared IRQ, might not be ours
+    dma_channel_acknowledge_irq1(fpga_dma);
+
+    int next = FPGA_DMA_SENDING ^ 1;
+    FPGA_DMA_LEN[FPGA_DMA_SENDING] = 0;
+    if (FPGA_DMA_LEN[next]) {
+        fpga_dma_start(next);
+    } else {
+        FPGA_DMA_SENDING = -1;
+    }
+}
+
 void fpga_init_dma(void)
 {
+    if (fpga_dma >= 0) return;
+
     fpga_dma = dma_claim_unused_channel(true);
     fpga_dma_config = dma_channel_get_default_config(fpga_dma);
 
@@ -169,21 +211,80 @@ void fpga_init_dma(void)
     channel_config_set_dreq(&fpga_dma_config, spi_get_dreq(spi1, true));
     channel_config_set_write_increment(&fpga_dma_config, false);
     channel_config_set_read_increment(&fpga_dma_config, true);
+
+    dma_channel_set_irq1_enabled(fpga_dma, true);
+    irq_add_shared_handler(DMA_IRQ_1, fpga_dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_1, true);
 }
 
-int32_t fpga_send_dma(uint8_t *buf, uint16_t len)
+/*
+    Claim the next buffer to fill (FPGA_BUF_SIZE bytes), or NULL if both are claimed, queued
+    or sending
+*/
+uint8_t *fpga_dma_get_buf(void)
 {
-    if (!is_fpga_dma_ready()) return -1;
+    uint8_t *buf = NULL;
+    fpga_init_dma();
+
+    // fpga_dma_submit() can be called from an IRQ
+    uint32_t irq_state = save_and_disable_interrupts();
+    int next = FPGA_DMA_FILL ^ FPGA_DMA_CLAIMED;
+    if ((FPGA_DMA_CLAIMED < 2) && !FPGA_DMA_LEN[next]) {
+        FPGA_DMA_CLAIMED++;
+        buf = FPGA_DMA_BUF[next];
+    }
+    restore_interrupts(irq_state);
+    return buf;
+}
 
-    len = min(len, sizeof(FPGA_WRITE_BUF));
-    memcpy(FPGA_WRITE_BUF, buf, len);
+/*
+    Queue the oldest buffer from fpga_dma_get_buf() to be sent, with len bytes in it. With len 0
+    the buffer is handed back without sending anything
+*/
+int fpga_dma_submit(uint32_t len)
+{
+    int buf = FPGA_DMA_FILL;
+    if ((len > FPGA_BUF_SIZE) || !FPGA_DMA_CLAIMED) return -1;
+
+    // the IRQ can't be allowed to finish the other buffer between setting len and checking for idle
+    uint32_t irq_state = save_and_disable_interrupts();
+    FPGA_DMA_LEN[buf] = len;
+    FPGA_DMA_FILL = buf ^ 1;
+    FPGA_DMA_CLAIMED--;
+    if (len && (FPGA_DMA_SENDING < 0)) fpga_dma_start(buf);
+    restore_interrupts(irq_state);
+    return 0;
+}
 
-    dma_channel_configure(fpga_dma, &fpga_dma_config, &spi_get_hw(spi1)->dr,
-        FPGA_WRITE_BUF, len, true);
+/*
+    Wait until everything queued has been clocked out to the FPGA
+*/
+void fpga_dma_wait(void)
+{
+    while (FPGA_DMA_SENDING >= 0);
+    while (spi_is_busy(spi1));
+
+    // nothing reads spi1's RX while the DMA writes, so clear out what it picked up
+    while (spi_is_readable(spi1)) (void)spi_get_hw(spi1)->dr;
+    spi_get_hw(spi1)->icr = SPI_SSPICR_RORIC_BITS;
+}
+
+int32_t fpga_send_dma(uint8_t *buf, uint16_t len)
+{
+    if (!len) return 0;
+    uint8_t *dma_buf = fpga_dma_get_buf();
+    if (!dma_buf) return -1;
+
+    len = min(len, FPGA_BUF_SIZE);
+    memcpy(dma_buf, buf, len);
+    if (fpga_dma_submit(len)) return -1;
     return len;
 }
 
+/*
+    Check if there's a free buffer for fpga_send_dma()/fpga_dma_get_buf()
+*/
 int is_fpga_dma_ready(void)
 {
-    return dma_channel_is_busy(fpga_dma);
-}
\ No newline at end of file
+    return (FPGA_DMA_CLAIMED < 2) && !FPGA_DMA_LEN[FPGA_DMA_FILL ^ FPGA_DMA_CLAIMED];
+}
@@ -18,11 +18,12 @@
 #define FPGA_DONE_PIN_SETUP() do {gpio_init(FPGA_DONE_PIN); gpio_set_dir(FPGA_DONE_PIN, GPIO_IN);} while(0)
 #define FPGA_ISDONE() gpio_get(FPGA_DONE_PIN)
 
-#define FPGA_BUF_SIZE 512
+#define FPGA_BUF_SIZE 4096 // each of the two DMA buffers
 
 void fpga_program_sendbyte(uint8_t databyte);
 
 void fpga_program_init(uint32_t baud);
+uint32_t fpga_program_get_baud(void);
 
 void fpga_program_setup1(void);
 
@@ -35,9 +36,11 @@ int find_bitstream_len_offset(uint8_t *bitstream, uint16_t len);
 void fpga_init_dma(void);
 
 int32_t fpga_send_dma(uint8_t *buf, uint16_t len);
+uint8_t *fpga_dma_get_buf(void);
+int fpga_dma_submit(uint32_t len);
+void fpga_dma_wait(void);
 
 int is_fpga_dma_ready(void);
-int fpga_program_sendchunk(uint8_t *data, uint32_t len);
 uint32_t get_bitstream_length(uint8_t *bitstream, uint16_t len);
 void fpga_erase(void);
 void fpga_setup_nrst_preq(void);
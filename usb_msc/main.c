@@ -17,6 +17,10 @@
 #include "fat_util.h"
 #include "config.h"
 #include "flash_util.h"
+#include "flash_job.h"
+#include "flash_pre_erase.h"
+#include "flash_fingerprint.h"
+#include "autotune.h"
 #include "util.h"
 #include "error.h"
 #include "crc32.h"
@@ -173,6 +177,7 @@ void check_flash_for_bitstreams(void)
         else
         {
             PRINT_INFO("No bitstream in slot %d", i);
+            flash_pre_erase_mark_stale(i);
         }
     }
     // release_spi_io();
@@ -202,6 +207,79 @@ void check_flash_for_firmware(void)
     release_spi_io();
 }
 
+/*
+    Length of the bitstream at offset in the bitstream flash, 0 if there isn't one
+*/
+uint32_t flash_bitstream_length(uint32_t offset)
+{
+    spi_flash_select(SPI_FLASH_BITSTREAM, CONFIG.flash_prog_speed);
+    spi_flash_read(offset, TEST_RD_BUF, 256); // whatever, just duplicate the reads...
+    return get_bitstream_length(TEST_RD_BUF, 256);
+}
+
+static volatile uint32_t FPGA_CHUNK_LEN; // chunk the flash DMA is filling
+
+// flash DMA IRQ: the chunk's in, hand it to the FPGA DMA
+static void fpga_chunk_read_done(void)
+{
+    fpga_dma_submit(FPGA_CHUNK_LEN);
+}
+
+/*
+    Program the FPGA at CONFIG.fpga_prog_speed with the bs_len byte bitstream at offset
+
+    Returns the crc32c of what was sent. Check FPGA_ISDONE() for whether it worked
+
+    Both sides are DMA: the flash fills one buffer while the other is clocked out to the FPGA,
+    and each buffer is handed over from the flash DMA IRQ, so the load takes about as long as
+    the slower bus. The next buffer is claimed while the flash is still busy, so its read starts
+    as soon as the last one's done. The crc is done on the CPU over each filled buffer while the
+    next read runs. The log line says which bus was the slow one
+*/
+uint32_t program_bitstream_from_flash(uint32_t offset, uint32_t bs_len)
+{
+    uint32_t start_us = time_us_32();
+    spi_flash_select(SPI_FLASH_BITSTREAM, CONFIG.flash_prog_speed);
+    fpga_program_init(CONFIG.fpga_prog_speed);
+    fpga_erase();
+
+    uint32_t stream_us = time_us_32();
+    uint32_t flash_wait_us = 0, fpga_wait_us = 0;
+    uint32_t flash_addr = offset;
+    uint32_t crc = 0x00;
+    uint8_t *filled = NULL; // last buffer the flash DMA was given
+    uint32_t filled_len = 0;
+    while (bs_len) {
+        uint8_t *buf;
+        uint32_t wait_us = time_us_32();
+        while (!(buf = fpga_dma_get_buf()));
+        fpga_wait_us += time_us_32() - wait_us;
+
+        wait_us = time_us_32();
+        while (spi_flash_dma_is_busy()); // one read at a time
+        flash_wait_us += time_us_32() - wait_us;
+
+        uint32_t read_len = min(FPGA_BUF_SIZE, bs_len);
+        FPGA_CHUNK_LEN = read_len;
+        spi_flash_read_dma(flash_addr, buf, read_len, fpga_chunk_read_done);
+        if (filled) crc = crc32c(crc, filled, filled_len);
+        filled = buf;
+        filled_len = read_len;
+        bs_len -= read_len;
+        flash_addr += read_len;
+        // PRINT_DEBUG("Prog %lX bytes, %lX left", read_len, bs_len);
+    }
+    while (spi_flash_dma_is_busy());
+    if (filled) crc = crc32c(crc, filled, filled_len);
+
+    uint32_t drain_us = time_us_32();
+    fpga_dma_wait();
+    uint32_t end_us = time_us_32();
+    PRINT_INFO("FPGA load %luus: setup %lu, stream %lu (wait flash %lu, FPGA %lu), drain %lu", end_us - start_us,
+        stream_us - start_us, drain_us - stream_us, flash_wait_us, fpga_wait_us, end_us - drain_us);
+    return crc;
+}
+
 /*
     Check the slot currently selected by the bitstream select switch
 
@@ -209,28 +287,18 @@ void check_flash_for_firmware(void)
 */
 void startup_program_bitstream(void)
 {
-    bitstream_init_spi(20E6);
     uint32_t bitstream_offset = flash_get_bitstream_offset();
     int slot = read_bitstream_select_pins();
-    spi_flash_read(bitstream_offset, TEST_RD_BUF, 256); // whatever, just duplicate the reads...
-    uint32_t bs_len = get_bitstream_length(TEST_RD_BUF, 256);
+    uint32_t bs_len = flash_bitstream_length(bitstream_offset);
 
     if (bs_len > 0) {
         // TODO: calc/record CRC
-        fpga_program_init(20E6);
-        fpga_erase();
         PRINT_INFO("Bitstream in flash @ %lX, programming %lX bytes...", bitstream_offset, bs_len);
-        uint32_t flash_addr = bitstream_offset;
-        uint32_t crc = 0x00;
-        while (bs_len) {
-            uint32_t read_len = min(sizeof(TEST_RD_BUF), bs_len);
-            spi_flash_read(flash_addr, TEST_RD_BUF, read_len);
-            fpga_program_sendchunk(TEST_RD_BUF, read_len);
-            crc = crc32c(crc, TEST_RD_BUF, read_len);
-            bs_len -= read_len;
-            flash_addr += read_len;
-            // PRINT_DEBUG("Prog %lX bytes, %lX left", read_len, bs_len);
+        struct flash_fingerprint fp;
+        if (!flash_fingerprint_read(bitstream_offset, &fp) && (fp.flags & FLASH_FINGERPRINT_SHA_VERIFIED)) {
+            PRINT_INFO("SHA-256 verified at upload"); // no need to hash it again
         }
+        uint32_t crc = program_bitstream_from_flash(bitstream_offset, bs_len);
         PRINT_INFO("Finished programming CRC=%lX", crc);
         if (FPGA_ISDONE()) {
             PRINT_INFO("Bitstream prog success");
@@ -270,6 +338,7 @@ int main()
     // bitstream_init_spi(20E6);
 #ifdef TESTING_BUILD
     test_crc(0);
+    test_sha256(0);
 // this stops USB from working for some reason...
 // test_basic_flash(0);
 #endif
@@ -283,6 +352,8 @@ int main()
     check_flash_for_firmware();
 
     PRINT_INFO("Using slot %d", read_bitstream_select_pins());
+    set_default_config(&CONFIG);
+    autotune_apply(&CONFIG); // tuned speeds, if AUTOTUNE has been run before
 
     startup_program_bitstream();
     BS_SELECT_STATE.current_position = read_bitstream_select_pins();
@@ -292,7 +363,6 @@ int main()
     gpio_set_dir(FPGA_CONFIG_LED, GPIO_OUT);
 
     // Write default config values to CONFIG.txt
-    set_default_config(&CONFIG);
     write_config_to_file(get_filesystem(), &CONFIG);
 
     // Try parsing default config to make sure it works
@@ -307,6 +377,13 @@ int main()
 
     while (true) {
         tud_task(); // tinyusb device task
+        if (!flash_job_task()) { // queued flash programs/verifies from USB writes
+            if (CONFIG.autotune) {
+                CONFIG.autotune = false; // once per AUTOTUNE=YES written to OPTIONS
+                autotune_start();
+            }
+            if (!autotune_task(&CONFIG)) flash_pre_erase_task(read_bitstream_select_pins());
+        }
         led_blinking_task();
 
         BS_SELECT_STATE.current_position = read_bitstream_select_pins();
@@ -1,2 +1,6 @@
 #pragma once
-void set_err_led(int on);
\ No newline at end of file
+void set_err_led(int on);
+uint32_t flash_get_bitstream_offset(void);
+uint32_t flash_bitstream_length(uint32_t offset);
+uint32_t program_bitstream_from_flash(uint32_t offset, uint32_t bs_len);
+void startup_program_bitstream(void);
\ No newline at end of file
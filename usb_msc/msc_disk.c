@@ -15,8 +15,16 @@
 #include <stdlib.h>
 #include "error.h"
 #include "crc32.h"
+#include "dma_crc.h"
+#include "sha256.h"
 #include "tests.h"
 #include "uf2.h"
+#include "flash_erase.h"
+#include "flash_delta.h"
+#include "flash_fingerprint.h"
+#include "flash_pre_erase.h"
+#include "autotune.h"
+#include "flash_job.h"
 #include "tusb_config.h"
 
 
@@ -26,7 +34,11 @@ uint32_t SPI_FLASH_BUF_INDEX = 0;
 struct config_options CONFIG = {.dirty = 1, 
                                 .fpga_prog_speed = CONF_DEFAULT_FPGA_PROG_SPEED,
                                 .flash_prog_speed = CONF_DEFAULT_FLASH_PROG_SPEED,
-                                .prog_flash = CONF_DEFAULT_FLASH_PROG_SPEED};
+                                .prog_flash = CONF_DEFAULT_FLASH_PROG_SPEED,
+                                .delta_flash = CONF_DEFAULT_DELTA_FLASH,
+                                .scratch_slots = CONF_DEFAULT_SCRATCH_SLOTS,
+                                .verify = CONF_DEFAULT_VERIFY,
+                                .autotune = CONF_DEFAULT_AUTOTUNE};
 
 extern uint32_t blink_interval_ms;
 extern uint32_t FLASH_BITSTREAM_OFFSET[3];
@@ -110,6 +122,8 @@ bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, boo
 // callback when PC wants to read from our filesystem
 int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize)
 {
+    flash_pre_erase_usb_activity();
+
     // out of ramdisk
     if (lba >= DISK_REAL_SECTOR_NUM)
     {
@@ -172,7 +186,7 @@ uint8_t TEST_RD_BUF[CFG_TUD_MSC_EP_BUFSIZE]; // buffer for reading flash data in
 // uint8_t LAST_SECTOR[DISK_CLUSTER_SIZE];
 
 /*
-    Read firmware from flash and calc its CRC
+    Read firmware from flash and calc its crc32c
 */
 uint32_t firmware_calc_crc(uint32_t addr)
 {
@@ -190,7 +204,7 @@ uint32_t firmware_calc_crc(uint32_t addr)
 }
 
 /*
-    Read bitstream from flash and calc its CRC
+    Read bitstream from flash and calc its crc32c
 */
 uint32_t fpga_flash_calc_crc32(uint32_t addr)
 {
@@ -221,17 +235,227 @@ void startup_program_bitstream(void); // only here because of below hack to stop
 int bitstream_prog_in_progress = 0;
 int firmware_prog_in_progress = 0;
 
+#define UF2_MAX_BLOCKS (FLASH_SLOT_SIZE / 256) // a slot's worth of the smallest payloads we'll see
+
 struct flash_prog_state {
     int in_progress;
     uint32_t blocks_left;
-    uint32_t crc;
+    uint8_t received[UF2_MAX_BLOCKS / 8]; // blocks handed to flash, so a resent one can be skipped
+    uint32_t crc; // crc32c of the blocks before the last one, see uf2_crc_add_block()
+    uint32_t last_crc; // crc32c of the last block
+    uint32_t last_len;
     uint32_t offset;
     int is_bitstream;
     uint32_t block_size;
+    struct flash_erase_sched erase;
+    int delta; // only writing sectors that changed
+    struct flash_delta delta_state;
+    int same; // matches the slot's fingerprint and flash so far, so nothing's been written
+    int crc_valid; // crc/last_crc are of what's been received
+    struct sha256 sha; // of blocks 0 to sha_next - 1
+    uint32_t sha_next; // blocks after this that already arrived are hashed from flash at the end
+    int sha_tag_found;
+    uint8_t sha_tag[SHA256_LEN]; // from the UF2's SHA-2 extension tag
+    uint32_t len; // bytes received
+    int resumed; // blocks have been resent
+    enum config_verify verify;
+    uint32_t run_addr; // programmed data waiting for a crc check, for VERIFY=SECTOR/IMAGE
+    uint32_t run_len;
+    uint32_t run_crc; // CRC-32 (sniffed as the run is copied for programming), compared with a FLASH_JOB_CRC of the run
+    uint32_t start_ms;
+    struct flash_fingerprint fp;
 };
 
 struct flash_prog_state BITSTREAM_STATE = {}, FIRMWARE_STATE = {};
 
+static int uf2_block_received(struct flash_prog_state *state, uint32_t block)
+{
+    return state->received[block / 8] & (1 << (block % 8));
+}
+
+/*
+    Add (or, since it's an XOR, take back out) a block's crc32c to the image crc, so blocks can
+    arrive in any order. Each one's crc is shifted along by the length of the blocks after it.
+
+    The last block can be short and everything else gets shifted by its length, so it's kept
+    separately until the end. The others all have to be block_size long
+*/
+static void uf2_crc_add_block(struct flash_prog_state *state, uint32_t block, uint32_t crc, uint32_t len)
+{
+    if (block == state->fp.num_blocks - 1) {
+        state->last_crc ^= crc;
+        state->last_len = len;
+        return;
+    }
+    if (len != state->block_size) state->crc_valid = 0;
+    state->crc ^= crc32c_combine(crc, 0, (state->fp.num_blocks - 2 - block) * state->block_size);
+}
+
+/*
+    UF2 payloads waiting to be programmed and verified by the flash job queue. The payload
+    is copied, since the USB buffer gets reused once the write callback returns
+*/
+struct uf2_write_slot {
+    struct flash_job program;
+    struct flash_job verify;
+    uint8_t data[sizeof(((struct UF2_Block *)0)->data)];
+};
+
+#define UF2_CRC_CHECKS 4
+#define UF2_WRITE_SLOTS ((FLASH_JOB_QUEUE_LEN - UF2_CRC_CHECKS - FLASH_ERASE_SCHED_JOBS) / 2)
+static struct uf2_write_slot UF2_WRITE_SLOT[UF2_WRITE_SLOTS];
+
+static void uf2_write_job_done(struct flash_job *job)
+{
+    if (job->state != FLASH_JOB_ERROR) return;
+    if (job->type == FLASH_JOB_VERIFY) {
+        PRINT_ERR("Verify error @ %lX", job->addr);
+    } else {
+        PRINT_ERR("FW prog err @ %lX", job->addr);
+    }
+}
+
+/*
+    Queue a program (and with verify set, a verify) of len bytes of data at addr. If all the
+    slots are busy, runs the job queue until one frees up. With crc set, the data's copied
+    into the slot by DMA with the sniffer on, continuing *crc
+*/
+static int uf2_queue_write(enum spi_flash_chip chip, uint32_t addr, const uint8_t *data, uint32_t len, int verify, uint32_t *crc)
+{
+    struct uf2_write_slot *slot = NULL;
+    if (len > sizeof(slot->data)) return -1;
+
+    while (!slot) {
+        for (uint8_t i = 0; i < UF2_WRITE_SLOTS; i++) {
+            if (!flash_job_is_busy(&UF2_WRITE_SLOT[i].program) && !flash_job_is_busy(&UF2_WRITE_SLOT[i].verify)) {
+                slot = &UF2_WRITE_SLOT[i];
+                break;
+            }
+        }
+        if (!slot) flash_job_task();
+    }
+
+    if (crc) {
+        *crc = dma_crc32_copy(*crc, slot->data, data, len);
+    } else {
+        memcpy(slot->data, data, len);
+    }
+    slot->program = (struct flash_job){.type = FLASH_JOB_PROGRAM, .chip = chip, .baud = CONFIG.flash_prog_speed,
+        .addr = addr, .len = len, .data = slot->data, .cb = uf2_write_job_done};
+    slot->verify = slot->program;
+    slot->verify.type = FLASH_JOB_VERIFY;
+
+    if (flash_job_submit(&slot->program)) return -1;
+    if (verify && flash_job_submit(&slot->verify)) return -1;
+    return 0;
+}
+
+/*
+    Crc check of a run of programmed data, compared against the crc of what was sent
+*/
+struct uf2_crc_check {
+    struct flash_job job;
+    uint32_t expected;
+};
+
+static struct uf2_crc_check UF2_CRC_CHECK[UF2_CRC_CHECKS];
+
+static void uf2_crc_check_done(struct flash_job *job)
+{
+    struct uf2_crc_check *check = job->ctx;
+    if ((job->state == FLASH_JOB_ERROR) || (job->crc != check->expected)) {
+        PRINT_ERR("Verify error %lX-%lX", job->addr, job->addr + job->len);
+    }
+}
+
+/*
+    Queue a crc check of the state's run. Jobs for a chip run in order, so it's checked 
+    after the run's programs are done
+*/
+static int uf2_flush_run(struct flash_prog_state *state)
+{
+    struct uf2_crc_check *check = NULL;
+    if (!state->run_len) return 0;
+
+    while (!check) {
+        for (uint8_t i = 0; i < UF2_CRC_CHECKS; i++) {
+            if (!flash_job_is_busy(&UF2_CRC_CHECK[i].job)) {
+                check = &UF2_CRC_CHECK[i];
+                break;
+            }
+        }
+        if (!check) flash_job_task();
+    }
+
+    check->expected = state->run_crc;
+    check->job = (struct flash_job){.type = FLASH_JOB_CRC, .chip = state->is_bitstream ? SPI_FLASH_BITSTREAM : SPI_FLASH_FIRMWARE,
+        .baud = CONFIG.flash_prog_speed, .addr = state->run_addr, .len = state->run_len, .cb = uf2_crc_check_done, .ctx = check};
+    state->run_len = 0;
+    return flash_job_submit(&check->job);
+}
+
+/*
+    Queue the programs for len bytes of data at addr as part of the state's run. The run is
+    checked when the data stops being contiguous, and with VERIFY=SECTOR, at the end of each
+    4k sector
+*/
+static int uf2_write_run(struct flash_prog_state *state, uint32_t addr, const uint8_t *data, uint32_t len)
+{
+    enum spi_flash_chip chip = state->is_bitstream ? SPI_FLASH_BITSTREAM : SPI_FLASH_FIRMWARE;
+    int rtn = 0;
+    if (state->run_len && (addr != state->run_addr + state->run_len)) rtn = uf2_flush_run(state);
+
+    while (len) {
+        uint32_t chunk = len;
+        if (state->verify == CONF_VERIFY_SECTOR) chunk = min(len, CONST_4k - sector_alignment(addr));
+        if (!state->run_len) {
+            state->run_addr = addr;
+            state->run_crc = 0;
+        }
+        rtn |= uf2_queue_write(chip, addr, data, chunk, 0, &state->run_crc);
+        state->run_len += chunk;
+        addr += chunk;
+        data += chunk;
+        len -= chunk;
+        if ((state->verify == CONF_VERIFY_SECTOR) && !sector_alignment(addr)) rtn |= uf2_flush_run(state);
+    }
+    return rtn;
+}
+
+/*
+    Finish the upload's SHA-256 into sha. Blocks that arrived ahead of order are hashed from
+    flash, so this has to be after everything's been written. Checked against the UF2's SHA-2 
+    tag if there was one.
+
+    Returns the FLASH_FINGERPRINT_SHA_* flags for the slot record
+*/
+static uint32_t uf2_sha_finish(struct flash_prog_state *state, uint8_t sha[SHA256_LEN])
+{
+    memset(sha, 0, SHA256_LEN);
+    if (!state->crc_valid) return 0; // blocks aren't all block_size, so flash can't be walked
+
+    uint32_t addr = state->sha_next * state->block_size;
+    uint32_t end = (state->fp.num_blocks - 1) * state->block_size + state->last_len;
+    if (addr < end) PRINT_INFO("SHA-256 reading back %lu blocks", state->fp.num_blocks - state->sha_next);
+    while (addr < end) {
+        uint32_t chunk = min(sizeof(TEST_RD_BUF), end - addr);
+        spi_flash_read(state->offset + addr, TEST_RD_BUF, chunk);
+        sha256_update(&state->sha, TEST_RD_BUF, chunk);
+        addr += chunk;
+    }
+    sha256_final(&state->sha, sha);
+
+    if (!state->sha_tag_found) return FLASH_FINGERPRINT_SHA_VALID;
+    if (memcmp(sha, state->sha_tag, SHA256_LEN)) {
+        PRINT_ERR("SHA-256 mismatch");
+        return FLASH_FINGERPRINT_SHA_VALID;
+    }
+    PRINT_INFO("SHA-256 verified");
+    return FLASH_FINGERPRINT_SHA_VALID | FLASH_FINGERPRINT_SHA_VERIFIED;
+}
+
+static const char *UF2_VERIFY_NAMES[CONF_VERIFY_NUM] = {"none", "block", "sector", "image"};
+
 #define BITSTREAM_FIRMWARE_STRING (state->is_bitstream ? "BITSTREAM" : "FIRMWARE")
 
 /*
@@ -239,6 +463,9 @@ struct flash_prog_state BITSTREAM_STATE = {}, FIRMWARE_STATE = {};
 */
 int flash_program_uf2(uint32_t lba, uint8_t *buffer, uint32_t bufsize)
 {
+    struct flash_prog_state *last_state = NULL; // flash the bus is currently set up for
+    uint32_t write_cursor = 0;
+
     for (uint32_t i = 0; i < bufsize; i += 512) {
         // get current block
         struct UF2_Block *cur_blk = (struct UF2_Block *)(buffer + i);
@@ -250,17 +477,38 @@ int flash_program_uf2(uint32_t lba, uint8_t *buffer, uint32_t bufsize)
             struct flash_prog_state *state;
             if (cur_blk->fileSize == SONATA_BITSTREAM_ID) {
                 state = &BITSTREAM_STATE;
-                bitstream_init_spi(CONFIG.flash_prog_speed);
+                spi_flash_select(SPI_FLASH_BITSTREAM, CONFIG.flash_prog_speed);
                 state->is_bitstream = 1;
             } else if (cur_blk->fileSize == SONATA_FIRMWARE_ID) {
                 state = &FIRMWARE_STATE;
-                firmware_init_spi(CONFIG.flash_prog_speed);
+                spi_flash_select(SPI_FLASH_FIRMWARE, CONFIG.flash_prog_speed);
                 state->is_bitstream = 0;
             } else {
                 PRINT_ERR("Unknown file id %lX", cur_blk->fileSize);
                 return -1;
             }
 
+            if ((cur_blk->blockNo >= cur_blk->numBlocks) || (cur_blk->blockNo >= UF2_MAX_BLOCKS) ||
+                (cur_blk->payloadSize > sizeof(cur_blk->data))) {
+                PRINT_ERR("Bad block %lu/%lu", cur_blk->blockNo, cur_blk->numBlocks);
+                continue;
+            }
+
+            /*
+                An upload left in progress (e.g. the host disconnected partway through) is picked 
+                back up if the same image is sent again, otherwise it's dropped
+            */
+            if (state->in_progress) {
+                struct flash_fingerprint hdr;
+                flash_fingerprint_from_block(cur_blk, &hdr);
+                if (!flash_fingerprint_header_matches(&hdr, &state->fp)) {
+                    PRINT_INFO("Dropping unfinished upload");
+                    flash_job_drain();
+                    spi_flash_select(state->is_bitstream ? SPI_FLASH_BITSTREAM : SPI_FLASH_FIRMWARE, CONFIG.flash_prog_speed);
+                    state->in_progress = 0;
+                }
+            }
+
             /*
                 if we haven't started programming this flash, erase it, reset the state,
                 and erase the FPGA
@@ -268,8 +516,21 @@ int flash_program_uf2(uint32_t lba, uint8_t *buffer, uint32_t bufsize)
             if (!state->in_progress) {
                 state->in_progress = 1;
                 state->blocks_left = cur_blk->numBlocks;
+                state->resumed = 0;
+                state->verify = CONFIG.verify;
+                state->run_len = 0;
+                state->start_ms = board_millis();
+                memset(state->received, 0x00, sizeof(state->received));
                 state->crc = 0;
+                state->last_crc = 0;
+                state->last_len = 0;
+                state->crc_valid = 1;
+                sha256_init(&state->sha);
+                state->sha_next = 0;
+                state->sha_tag_found = 0;
                 state->block_size = cur_blk->payloadSize;
+                spi_flash_reset_write_stats();
+                spi_flash_reset_cmd_stats();
 
                 /*
                     NOTE: Something the FPGA is doing seems to be messing up FW flash, 
@@ -289,13 +550,36 @@ int flash_program_uf2(uint32_t lba, uint8_t *buffer, uint32_t bufsize)
                 state->offset = uf2_target_addr_to_base_offset(cur_blk);
 
                 /*
-                    Erase entirety of flash that we need to write to
+                    In delta mode, only sectors that differ from what's in flash are erased and written.
+                    Otherwise, flash is erased as we go, just ahead of where we're writing
+                */
+                state->delta = CONFIG.delta_flash;
+
+                /*
+                    If the slot's fingerprint says the same image is already there, nothing 
+                    is erased or written unless a block turns out to differ. Only bitstream slots
+                    have one, the firmware flash belongs to the FPGA design
                 */
-                uint32_t num_bytes = uf2_get_filesize(cur_blk);
-                for (uint32_t j = 0; j < num_bytes; j += CONST_64k) {
-                    spi_flash_64k_erase_nonblocking(j + state->offset);
-                    // PRINT_INFO("Erasing %lX", j + state->offset);
-                    while (spi_flash_is_busy());
+                struct flash_fingerprint stored;
+                state->len = 0;
+                flash_fingerprint_from_block(cur_blk, &state->fp);
+                state->same = state->is_bitstream && !flash_fingerprint_read(state->offset, &stored) &&
+                    flash_fingerprint_header_matches(&stored, &state->fp);
+
+                if (state->same) {
+                    state->fp = stored;
+                } else if (state->delta) {
+                    flash_delta_start(&state->delta_state, state->verify != CONF_VERIFY_NONE);
+                } else {
+                    flash_erase_sched_start(&state->erase, state->is_bitstream ? SPI_FLASH_BITSTREAM : SPI_FLASH_FIRMWARE,
+                        CONFIG.flash_prog_speed, state->offset, uf2_get_filesize(cur_blk));
+                }
+
+                // blocks erased while idle don't need erasing again
+                if (state->is_bitstream) {
+                    uint32_t pre_erased = flash_pre_erase_claim(state->offset,
+                        (state->same || state->delta) ? NULL : &state->erase);
+                    if (pre_erased) PRINT_INFO("%lu blocks pre-erased", pre_erased);
                 }
             }
 
@@ -303,32 +587,181 @@ int flash_program_uf2(uint32_t lba, uint8_t *buffer, uint32_t bufsize)
                 write to flash, update the crc, read it back, and verify it
             */
             uint32_t addr = state->offset + cur_blk->blockNo * state->block_size;
-            if (spi_flash_write_buffer(addr, cur_blk->data, cur_blk->payloadSize))  {
-                PRINT_ERR("FW prog err @ %lX", addr);
+            int resent = uf2_block_received(state, cur_blk->blockNo);
+            int skip = 0;
+
+            /*
+                A block that's already been received is skipped if flash matches it. If it
+                doesn't, the image has changed: the old block's crc is swapped for the new one's
+                and the rest is written with delta, since the block is already programmed and 
+                the erase scheduler won't erase it again
+            */
+            uint32_t blk_crc = crc32c(0, cur_blk->data, cur_blk->payloadSize);
+            if (resent) {
+                uint8_t old[sizeof(cur_blk->data)];
+                uf2_flush_run(state);
+                if (state->delta && flash_delta_flush(&state->delta_state)) {
+                    PRINT_ERR("Delta prog err @ %lX", state->delta_state.sector);
+                }
+                flash_job_drain(); // its program/verify may still be queued
+                spi_flash_select(state->is_bitstream ? SPI_FLASH_BITSTREAM : SPI_FLASH_FIRMWARE, CONFIG.flash_prog_speed);
+                spi_flash_read(addr, old, cur_blk->payloadSize);
+                if (!memcmp(old, cur_blk->data, cur_blk->payloadSize)) {
+                    skip = 1;
+                } else {
+                    PRINT_INFO("Image differs @ %lX", addr);
+                    uf2_crc_add_block(state, cur_blk->blockNo, crc32c(0, old, cur_blk->payloadSize), cur_blk->payloadSize);
+                    uf2_crc_add_block(state, cur_blk->blockNo, blk_crc, cur_blk->payloadSize);
+                    if (cur_blk->blockNo < state->sha_next) {
+                        // the old block is already hashed, so redo it all from flash at the end
+                        sha256_init(&state->sha);
+                        state->sha_next = 0;
+                    }
+                    if (!state->delta) {
+                        state->same = 0;
+                        state->delta = 1;
+                        flash_delta_start(&state->delta_state, state->verify != CONF_VERIFY_NONE);
+                    }
+                }
+            } else {
+                uf2_crc_add_block(state, cur_blk->blockNo, blk_crc, cur_blk->payloadSize);
+                state->len += cur_blk->payloadSize;
+            }
+
+            // SHA-256 can't be combined like the crc, so only blocks that arrive in order are hashed now
+            if (cur_blk->blockNo == state->sha_next) {
+                sha256_update(&state->sha, cur_blk->data, cur_blk->payloadSize);
+                state->sha_next++;
+            }
+            struct extension_tag tag;
+            if (!uf2_get_sha(cur_blk, &tag) && (tag.total_size == 4 + SHA256_LEN)) {
+                memcpy(state->sha_tag, tag.data, SHA256_LEN);
+                state->sha_tag_found = 1;
+            }
+
+            if (state->same && !skip && !flash_fingerprint_block_matches(addr, cur_blk->data, cur_blk->payloadSize)) {
+                /*
+                    Every block so far matched flash, so only what's left needs writing. The 
+                    erase scheduler would wipe matched blocks sharing a sector, so use delta
+                */
+                PRINT_INFO("Image differs @ %lX", addr);
+                state->same = 0;
+                state->delta = 1;
+                flash_delta_start(&state->delta_state, state->verify != CONF_VERIFY_NONE);
             }
-            
-            // NOTE: can't do CRC since data can be out of order
-            // state->crc = crc32c(state->crc, cur_blk->data, cur_blk->payloadSize);
 
-            spi_flash_read(addr, TEST_RD_BUF, cur_blk->payloadSize);
+            if (skip || state->same) {
+                // already in flash
+            } else if (state->delta) {
+                // verified when the sector is flushed
+                if (flash_delta_write(&state->delta_state, addr, cur_blk->data, cur_blk->payloadSize)) {
+                    PRINT_ERR("Delta prog err near %lX", addr);
+                }
+            } else {
+                if (flash_erase_sched_prepare(&state->erase, addr, cur_blk->payloadSize)) {
+                    PRINT_ERR("Erase err @ %lX", addr);
+                }
 
-            if (memcmp(cur_blk->data, TEST_RD_BUF, cur_blk->payloadSize)) {
-                PRINT_ERR("Verify error @ %lX", addr);
+                /*
+                    Erase, program and verify run from the main loop, in that order, so USB keeps
+                    getting serviced while the flash is busy
+                */
+                if (state->verify >= CONF_VERIFY_SECTOR) {
+                    if (uf2_write_run(state, addr, cur_blk->data, cur_blk->payloadSize)) PRINT_ERR("FW prog err @ %lX", addr);
+                } else if (uf2_queue_write(state->is_bitstream ? SPI_FLASH_BITSTREAM : SPI_FLASH_FIRMWARE, addr,
+                    cur_blk->data, cur_blk->payloadSize, state->verify == CONF_VERIFY_BLOCK, NULL)) {
+                    PRINT_ERR("FW prog err @ %lX", addr);
+                }
+            }
+            if (resent) {
+                if (!state->resumed) PRINT_INFO("Resuming upload @ block %lu", cur_blk->blockNo);
+                state->resumed = 1;
+            } else {
+                state->received[cur_blk->blockNo / 8] |= (1 << (cur_blk->blockNo % 8));
+                state->blocks_left--;
             }
-            state->blocks_left--;
+            last_state = state;
+            write_cursor = addr + cur_blk->payloadSize;
 
             /*
                 if this is the last block, calc the crc of what's in flash,
                 release the IO, and reprogram the FPGA
             */
-            if (state->blocks_left == 0) {
+            if ((state->blocks_left == 0) && !resent) {
+                const struct spi_flash_write_stats *wr_stats = spi_flash_get_write_stats();
                 state->in_progress = 0;
-                
-                release_spi_io(); // release SPI IO so that FPGA runs again
-                startup_program_bitstream(); // reprogram the fpga
+
+                uf2_flush_run(state);
+                flash_job_drain(); // everything has to be in flash before the FPGA gets it back
+                spi_flash_select(state->is_bitstream ? SPI_FLASH_BITSTREAM : SPI_FLASH_FIRMWARE, CONFIG.flash_prog_speed);
+
+                state->crc = crc32c_combine(state->crc, state->last_crc, state->last_len);
+                if (state->crc_valid) PRINT_INFO("Image crc32c %lX", state->crc);
+                if (state->same) {
+                    PRINT_INFO("Same image, flash not written");
+                } else if (state->delta) {
+                    if (flash_delta_flush(&state->delta_state)) {
+                        PRINT_ERR("Delta prog err @ %lX", state->delta_state.sector);
+                    }
+                    PRINT_INFO("Delta: %lu sectors written, %lu same", state->delta_state.sectors_written,
+                        state->delta_state.sectors_skipped);
+                } else {
+                    flash_erase_sched_wait(&state->erase);
+                    PRINT_INFO("Erase est %lums, waited %lums", state->erase.est_ms, state->erase.wait_us / 1000);
+                }
+
+                uint8_t sha[SHA256_LEN];
+                uint32_t sha_flags = uf2_sha_finish(state, sha);
+                if (state->same) {
+                    // a verify from an earlier upload of the same image still counts
+                    if (!memcmp(sha, state->fp.sha256, SHA256_LEN)) sha_flags |= state->fp.flags & FLASH_FINGERPRINT_SHA_VERIFIED;
+
+                    // flash matched block by block, so if they differ it's the record that's out of date
+                    if (state->crc_valid && ((state->crc != state->fp.crc) || (state->len != state->fp.len) ||
+                        (sha_flags != state->fp.flags) || memcmp(sha, state->fp.sha256, SHA256_LEN))) {
+                        state->fp.crc = state->crc;
+                        state->fp.len = state->len;
+                        state->fp.flags = sha_flags;
+                        memcpy(state->fp.sha256, sha, SHA256_LEN);
+                        flash_fingerprint_write(state->offset, &state->fp);
+                    }
+                } else if (state->is_bitstream) {
+                    flash_fingerprint_from_block(cur_blk, &state->fp);
+                    state->fp.crc = state->crc;
+                    state->fp.len = state->len;
+                    state->fp.flags = sha_flags;
+                    memcpy(state->fp.sha256, sha, SHA256_LEN);
+                    if (!state->crc_valid || flash_fingerprint_write(state->offset, &state->fp)) {
+                        flash_fingerprint_clear(state->offset);
+                    }
+                }
+                if (wr_stats->pages) {
+                    PRINT_INFO("%lu pages, avg %luus min %luus max %luus, gaps %luus", wr_stats->pages,
+                        wr_stats->total_us / wr_stats->pages, wr_stats->min_us, wr_stats->max_us, wr_stats->gap_us);
+                }
+                PRINT_INFO("%lu bytes 0xFF, not programmed", wr_stats->skipped_bytes);
+                PRINT_INFO("Upload %lums, verify %s", board_millis() - state->start_ms, UF2_VERIFY_NAMES[state->verify]);
+                const struct spi_flash_cmd_stats *cmd_stats = spi_flash_get_cmd_stats();
+                if (cmd_stats->cmds) {
+                    PRINT_INFO("%lu cmds, avg %luus, %lu bus switches", cmd_stats->cmds, cmd_stats->total_us / cmd_stats->cmds,
+                        cmd_stats->bus_switches);
+                    PRINT_INFO("%lu chip swaps", cmd_stats->chip_swaps);
+                }
+
+                // the other flash may still be mid upload, in which case it keeps the bus
+                struct flash_prog_state *other = state->is_bitstream ? &FIRMWARE_STATE : &BITSTREAM_STATE;
+                if (!other->in_progress) {
+                    release_spi_io(); // release SPI IO so that FPGA runs again
+                    startup_program_bitstream(); // reprogram the fpga
+                }
             }
         }
     }
+
+    // queue the next erase while the host sends more data
+    if (last_state && last_state->in_progress && !last_state->delta && !last_state->same) {
+        flash_erase_sched_ahead(&last_state->erase, write_cursor);
+    }
     return bufsize;
 }
 
@@ -362,6 +795,8 @@ int is_reserved_cluster(uint32_t lba)
 // callback when PC wants to write to our filesystem
 int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t *buffer, uint32_t bufsize)
 {
+    flash_pre_erase_usb_activity();
+
     // out of ramdisk
     if (!bufsize) return 0; //???
 
@@ -407,6 +842,7 @@ int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t *
         if (parse_config(get_filesystem(), &CONFIG)) {
             // if config parse fails, set everything back to default
             set_default_config(&CONFIG);
+            autotune_apply(&CONFIG);
             #ifdef TESTING_BUILD
             PRINT_TEST(0, CONFIG_PARSE_TEST_NAME, "");
             #endif
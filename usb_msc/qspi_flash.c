@@ -0,0 +1,216 @@
+#include <stdint.h>
+#include "hardware/pio.h"
+#include "hardware/clocks.h"
+#include "hardware/gpio.h"
+#include "hardware/dma.h"
+#include "flash_util.h"
+#include "qspi_flash.h"
+#include "qspi_flash.pio.h"
+#include "util.h"
+
+/*
+    PIO data phase for quad SPI on the firmware flash
+
+    Only the data phase is done here, the caller is expected to assert CS and send the command,
+    address and dummy bytes with the hardware SPI first. The data/clock pins are switched over to
+    the PIO for the transfer and handed back to the SPI/SIO afterwards.
+
+    See qspi_flash.pio for how the data is laid out. The FIFOs are fed by DMA, QSPI_CHUNK bytes at
+    a time, so that the CPU only has to convert between bytes and symbols. Each byte is moved as
+    a 16 bit transfer: a halfword written to a TX FIFO lands in both halves of the word, so the
+    write SM sees the symbols in bits 31:26 and 23:18, and a halfword read from an RX FIFO is the
+    low half the read SM pushed.
+*/
+
+#define QSPI_PIN_BASE FW_SPI_DO // lowest numbered pin we need to touch
+#define QSPI_PIN_BIT(PIN) (1u << ((PIN) - QSPI_PIN_BASE))
+#define QSPI_DATA_PINS (QSPI_PIN_BIT(FW_SPI_DI) | QSPI_PIN_BIT(FW_SPI_DO) | QSPI_PIN_BIT(FW_SPI_W_NEN) | QSPI_PIN_BIT(FW_SPI_NHOLD))
+#define QSPI_CLK_PIN QSPI_PIN_BIT(FW_SPI_CLK)
+
+#define QSPI_CHUNK 256 // bytes per DMA transfer, one page
+
+static PIO qspi_pio = pio0;
+static int qspi_write_sm = -1;
+static int qspi_read_sm = -1;
+static int qspi_dma = -1;
+
+static uint16_t QSPI_SYMBOLS[2][QSPI_CHUNK]; // one converted while the DMA has the other
+static uint16_t QSPI_BYTE_TO_SYMBOLS[256]; // as the write SM wants them, high nibble in bits 15:10
+static uint8_t QSPI_SYMBOL_TO_NIBBLE[64]; // every sampled symbol, whatever CS and CLK were
+
+/*
+    D0-D3 of a nibble to the level of GPIO QSPI_PIN_BASE + N in bit N
+*/
+static uint8_t qspi_nibble_to_symbol(uint8_t nibble)
+{
+    return (((nibble >> 0) & 1) ? QSPI_PIN_BIT(FW_SPI_DI) : 0) |
+           (((nibble >> 1) & 1) ? QSPI_PIN_BIT(FW_SPI_DO) : 0) |
+           (((nibble >> 2) & 1) ? QSPI_PIN_BIT(FW_SPI_W_NEN) : 0) |
+           (((nibble >> 3) & 1) ? QSPI_PIN_BIT(FW_SPI_NHOLD) : 0);
+}
+
+/*
+    Data pins of a sampled symbol back to a nibble
+*/
+static uint8_t qspi_symbol_to_nibble(uint8_t sym)
+{
+    return ((sym & QSPI_PIN_BIT(FW_SPI_DI)) ? 0x1 : 0) |
+           ((sym & QSPI_PIN_BIT(FW_SPI_DO)) ? 0x2 : 0) |
+           ((sym & QSPI_PIN_BIT(FW_SPI_W_NEN)) ? 0x4 : 0) |
+           ((sym & QSPI_PIN_BIT(FW_SPI_NHOLD)) ? 0x8 : 0);
+}
+
+/*
+    Load the PIO programs, claim the DMA channel and build the symbol lookup tables. Only does
+    anything the first time it's called
+*/
+void qspi_flash_init(void)
+{
+    if (qspi_write_sm >= 0) return;
+
+    uint write_offset = pio_add_program(qspi_pio, &qspi_write_program);
+    uint read_offset = pio_add_program(qspi_pio, &qspi_read_program);
+    qspi_write_sm = pio_claim_unused_sm(qspi_pio, true);
+    qspi_read_sm = pio_claim_unused_sm(qspi_pio, true);
+
+    qspi_write_program_init(qspi_pio, qspi_write_sm, write_offset, QSPI_PIN_BASE, FW_SPI_CLK);
+    qspi_read_program_init(qspi_pio, qspi_read_sm, read_offset, QSPI_PIN_BASE, FW_SPI_CLK);
+
+    qspi_dma = dma_claim_unused_channel(true);
+
+    for (uint32_t i = 0; i < 256; i++) {
+        QSPI_BYTE_TO_SYMBOLS[i] = (qspi_nibble_to_symbol(i >> 4) << 10) | (qspi_nibble_to_symbol(i & 0x0F) << 2);
+    }
+    // CS and CLK are sampled along with the data, and CLK can be either level
+    for (uint8_t i = 0; i < 64; i++) QSPI_SYMBOL_TO_NIBBLE[i] = qspi_symbol_to_nibble(i);
+}
+
+/*
+    Start moving len symbols between a buffer and sm's FIFO
+*/
+static void qspi_dma_start(uint sm, int is_tx, uint16_t *symbols, uint32_t len)
+{
+    dma_channel_config c = dma_channel_get_default_config(qspi_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_dreq(&c, pio_get_dreq(qspi_pio, sm, is_tx));
+    channel_config_set_read_increment(&c, is_tx);
+    channel_config_set_write_increment(&c, !is_tx);
+
+    if (is_tx) {
+        dma_channel_configure(qspi_dma, &c, &qspi_pio->txf[sm], symbols, len, true);
+    } else {
+        dma_channel_configure(qspi_dma, &c, symbols, &qspi_pio->rxf[sm], len, true);
+    }
+}
+
+static float qspi_clkdiv(uint32_t baud, uint32_t cycles_per_clk)
+{
+    float div = (float)clock_get_hz(clk_sys) / (float)(baud * cycles_per_clk);
+    return (div < 1.0f) ? 1.0f : div;
+}
+
+/*
+    Hand the data and clock pins over to the PIO. CLK is set low first so that we don't
+    clock the flash while switching
+*/
+static void qspi_take_pins(uint sm, int is_out)
+{
+    pio_sm_set_pins_with_mask(qspi_pio, sm, 0, QSPI_CLK_PIN | QSPI_DATA_PINS);
+    pio_sm_set_pindirs_with_mask(qspi_pio, sm, QSPI_CLK_PIN | (is_out ? QSPI_DATA_PINS : 0),
+        QSPI_CLK_PIN | QSPI_DATA_PINS);
+
+    pio_gpio_init(qspi_pio, FW_SPI_CLK);
+    pio_gpio_init(qspi_pio, FW_SPI_DI);
+    pio_gpio_init(qspi_pio, FW_SPI_DO);
+    pio_gpio_init(qspi_pio, FW_SPI_W_NEN);
+    pio_gpio_init(qspi_pio, FW_SPI_NHOLD);
+}
+
+/*
+    Give the pins back to the SPI peripheral. W_NEN and NHOLD go back to SIO, which
+    firmware_init_spi() left driving them high
+*/
+static void qspi_release_pins(void)
+{
+    gpio_set_function(FW_SPI_CLK, GPIO_FUNC_SPI);
+    gpio_set_function(FW_SPI_DI, GPIO_FUNC_SPI);
+    gpio_set_function(FW_SPI_DO, GPIO_FUNC_SPI);
+    gpio_set_function(FW_SPI_W_NEN, GPIO_FUNC_SIO);
+    gpio_set_function(FW_SPI_NHOLD, GPIO_FUNC_SIO);
+}
+
+/*
+    Clock out len bytes on all four data lines
+*/
+void qspi_flash_write(const uint8_t *data, uint32_t len, uint32_t baud)
+{
+    uint sm = qspi_write_sm;
+    uint32_t stall_mask = 1u << (PIO_FDEBUG_TXSTALL_LSB + sm);
+    uint8_t buf = 0;
+
+    pio_sm_set_clkdiv(qspi_pio, sm, qspi_clkdiv(baud, 2));
+    qspi_take_pins(sm, 1);
+    pio_sm_set_enabled(qspi_pio, sm, true);
+
+    // convert the next chunk while the last one goes out
+    uint32_t chunk = min(len, QSPI_CHUNK);
+    for (uint32_t i = 0; i < chunk; i++) QSPI_SYMBOLS[buf][i] = QSPI_BYTE_TO_SYMBOLS[data[i]];
+    while (chunk) {
+        qspi_dma_start(sm, 1, QSPI_SYMBOLS[buf], chunk);
+        data += chunk;
+        len -= chunk;
+        buf ^= 1;
+
+        chunk = min(len, QSPI_CHUNK);
+        for (uint32_t i = 0; i < chunk; i++) QSPI_SYMBOLS[buf][i] = QSPI_BYTE_TO_SYMBOLS[data[i]];
+        dma_channel_wait_for_finish_blocking(qspi_dma);
+    }
+
+    // the SM stalls on an empty FIFO with CLK low once the last nibble is out
+    qspi_pio->fdebug = stall_mask;
+    while (!(qspi_pio->fdebug & stall_mask));
+
+    pio_sm_set_enabled(qspi_pio, sm, false);
+    qspi_release_pins();
+}
+
+/*
+    Clock in len bytes on all four data lines
+
+    The SM stalls with CLK low whenever its RX FIFO is full, so the flash just sees a slower clock
+    while a chunk is being converted
+*/
+void qspi_flash_read(uint8_t *data, uint32_t len, uint32_t baud)
+{
+    uint sm = qspi_read_sm;
+    uint8_t buf = 0;
+    if (!len) return;
+
+    pio_sm_set_clkdiv(qspi_pio, sm, qspi_clkdiv(baud, 3));
+    qspi_take_pins(sm, 0);
+    pio_sm_set_enabled(qspi_pio, sm, true);
+
+    pio_sm_put(qspi_pio, sm, len * 2 - 1); // number of nibbles - 1
+
+    uint32_t chunk = min(len, QSPI_CHUNK);
+    qspi_dma_start(sm, 0, QSPI_SYMBOLS[buf], chunk);
+    while (chunk) {
+        dma_channel_wait_for_finish_blocking(qspi_dma);
+
+        // start on the next chunk before converting this one
+        uint32_t next = min(len - chunk, QSPI_CHUNK);
+        if (next) qspi_dma_start(sm, 0, QSPI_SYMBOLS[buf ^ 1], next);
+
+        const uint16_t *sym = QSPI_SYMBOLS[buf];
+        for (uint32_t i = 0; i < chunk; i++) {
+            data[i] = (QSPI_SYMBOL_TO_NIBBLE[(sym[i] >> 8) & 0x3F] << 4) | QSPI_SYMBOL_TO_NIBBLE[sym[i] & 0x3F];
+        }
+        data += chunk;
+        len -= chunk;
+        buf ^= 1;
+        chunk = next;
+    }
+
+    pio_sm_set_enabled(qspi_pio, sm, false);
+    qspi_release_pins();
+}
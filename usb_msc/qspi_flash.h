@@ -0,0 +1,6 @@
+#pragma once
+#include <stdint.h>
+
+void qspi_flash_init(void);
+void qspi_flash_write(const uint8_t *data, uint32_t len, uint32_t baud);
+void qspi_flash_read(uint8_t *data, uint32_t len, uint32_t baud);
@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <string.h>
+#include "sfdp.h"
+#include "util.h"
+
+static uint32_t sfdp_dword(const uint8_t *table, uint32_t n)
+{
+    table += n * 4;
+    return table[0] | (table[1] << 8) | (table[2] << 16) | ((uint32_t)table[3] << 24);
+}
+
+/*
+    Find the basic flash parameter table in the SFDP header and parameter headers in hdr
+    (read from SFDP address 0)
+
+    offset is set to the SFDP address of the table and dwords to its length.
+    Returns -1 if there's no valid SFDP header or BFPT
+*/
+int sfdp_find_bfpt(const uint8_t *hdr, uint32_t len, uint32_t *offset, uint32_t *dwords)
+{
+    if (len < SFDP_HEADER_LEN + SFDP_PARAM_HEADER_LEN) return -1;
+    if (sfdp_dword(hdr, 0) != SFDP_SIGNATURE) return -1;
+
+    uint32_t num_headers = min(hdr[6] + 1, SFDP_MAX_PARAM_HEADERS);
+    for (uint32_t i = 0; i < num_headers; i++) {
+        const uint8_t *param = hdr + SFDP_HEADER_LEN + i * SFDP_PARAM_HEADER_LEN;
+        if ((param + SFDP_PARAM_HEADER_LEN) > (hdr + len)) break;
+
+        uint16_t id = (param[7] << 8) | param[0];
+        if ((id != SFDP_BFPT_ID) || (param[2] != 1)) continue; // only major revision 1 is defined
+
+        *offset = param[4] | (param[5] << 8) | (param[6] << 16);
+        *dwords = min(param[3], SFDP_BFPT_MAX_DWORDS);
+        return (*dwords >= 2) ? 0 : -1; // need at least the density
+    }
+    return -1;
+}
+
+/*
+    Erase times are a 5 bit count + 2 bit unit
+*/
+static uint32_t sfdp_erase_time_ms(uint32_t field)
+{
+    static const uint32_t units_ms[] = {1, 16, 128, 1000};
+    return ((field & 0x1F) + 1) * units_ms[(field >> 5) & 0x03];
+}
+
+static uint32_t sfdp_chip_erase_time_ms(uint32_t field)
+{
+    static const uint32_t units_ms[] = {16, 256, 4000, 64000};
+    return ((field & 0x1F) + 1) * units_ms[(field >> 5) & 0x03];
+}
+
+/*
+    Decode a basic flash parameter table of dwords length into info
+
+    Returns -1 if the table is too short or the density doesn't fit in 32 bits of bytes
+*/
+int sfdp_parse_bfpt(const uint8_t *bfpt, uint32_t dwords, struct sfdp_info *info)
+{
+    memset(info, 0x00, sizeof(*info));
+    info->qer = 0xFF;
+    if (dwords < 2) return -1;
+    dwords = min(dwords, SFDP_BFPT_MAX_DWORDS);
+    info->dwords = dwords;
+
+    // DWORD1: address bytes and 1-1-4 support
+    uint32_t dw = sfdp_dword(bfpt, 0);
+    info->addr_mode = (dw >> 17) & 0x03;
+    if (info->addr_mode > SFDP_ADDR_4BYTE) info->addr_mode = SFDP_ADDR_3BYTE; // reserved
+    info->fast_read_114 = (dw >> 22) & 0x01;
+    if ((dw & 0x03) == 0x01) {
+        // 4k erase, may be the only one given in an old table
+        info->erase[0].size = 4096;
+        info->erase[0].opcode = (dw >> 8) & 0xFF;
+    }
+
+    // DWORD2: density in bits
+    dw = sfdp_dword(bfpt, 1);
+    if (dw & 0x80000000) {
+        uint32_t n = dw & 0x7FFFFFFF;
+        if ((n < 3) || (n > 34)) return -1;
+        info->size = 1UL << (n - 3);
+    } else {
+        info->size = (dw >> 3) + 1;
+    }
+
+    if (dwords >= 3) {
+        // DWORD3: 1-4-4 (low half) and 1-1-4 (high half) fast read
+        dw = sfdp_dword(bfpt, 2);
+        info->fast_read_114_dummy_clocks = ((dw >> 16) & 0x1F) + ((dw >> 21) & 0x07);
+        info->fast_read_114_opcode = dw >> 24;
+    }
+
+    if (dwords >= 9) {
+        // DWORD8/9: erase type sizes (2^N) and opcodes
+        memset(info->erase, 0x00, sizeof(info->erase));
+        for (uint32_t i = 0; i < SFDP_NUM_ERASE_TYPES; i++) {
+            dw = sfdp_dword(bfpt, 7 + i / 2) >> ((i % 2) * 16);
+            uint8_t n = dw & 0xFF;
+            if (!n || (n > 31)) continue;
+            info->erase[i].size = 1UL << n;
+            info->erase[i].opcode = (dw >> 8) & 0xFF;
+        }
+    }
+
+    uint32_t max_mult = 0;
+    if (dwords >= 10) {
+        // DWORD10: typical erase times, max = typ * 2 * (multiplier + 1)
+        dw = sfdp_dword(bfpt, 9);
+        max_mult = 2 * ((dw & 0x0F) + 1);
+        for (uint32_t i = 0; i < SFDP_NUM_ERASE_TYPES; i++) {
+            if (!info->erase[i].size) continue;
+            info->erase[i].typ_ms = sfdp_erase_time_ms(dw >> (4 + i * 7));
+            info->erase[i].max_ms = info->erase[i].typ_ms * max_mult;
+        }
+    }
+
+    if (dwords >= 11) {
+        // DWORD11: page size and chip erase time
+        dw = sfdp_dword(bfpt, 10);
+        info->page_size = 1 << ((dw >> 4) & 0x0F);
+        info->chip_erase_typ_ms = sfdp_chip_erase_time_ms(dw >> 24);
+        info->chip_erase_max_ms = info->chip_erase_typ_ms * max_mult;
+    }
+
+    if (dwords >= 13) {
+        // DWORD12/13: suspend/resume, bit 31 is 0 when it's supported
+        dw = sfdp_dword(bfpt, 11);
+        if (!(dw & 0x80000000)) {
+            static const uint32_t latency_ns[] = {128, 1000, 8000, 64000};
+            info->erase_suspend = 1;
+            info->suspend_latency_us = (((dw >> 24) & 0x1F) + 1) * latency_ns[(dw >> 29) & 0x03] / 1000 + 1;
+            info->resume_interval_us = (((dw >> 20) & 0x0F) + 1) * 64;
+
+            dw = sfdp_dword(bfpt, 12);
+            info->resume_opcode = (dw >> 16) & 0xFF;
+            info->suspend_opcode = dw >> 24;
+        }
+    }
+
+    if (dwords >= 15) {
+        // DWORD15: quad enable requirements
+        info->qer = (sfdp_dword(bfpt, 14) >> 20) & 0x07;
+    }
+    return 0;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <stdint.h>
+
+/*
+    JESD216 Serial Flash Discoverable Parameters decoding
+
+    Only depends on the SFDP bytes, so recorded tables can be fed in directly
+*/
+
+#define SFDP_SIGNATURE 0x50444653 // "SFDP", little endian
+#define SFDP_BFPT_ID 0xFF00 // basic flash parameter table
+#define SFDP_HEADER_LEN 8
+#define SFDP_PARAM_HEADER_LEN 8
+#define SFDP_MAX_PARAM_HEADERS 8
+#define SFDP_BFPT_MAX_DWORDS 23 // JESD216F
+#define SFDP_NUM_ERASE_TYPES 4
+
+enum sfdp_addr_mode {
+    SFDP_ADDR_3BYTE = 0,
+    SFDP_ADDR_3OR4BYTE,
+    SFDP_ADDR_4BYTE
+};
+
+struct sfdp_erase_type {
+    uint32_t size; // bytes, 0 if this erase type isn't used
+    uint8_t opcode;
+    uint32_t typ_ms; // 0 if not given
+    uint32_t max_ms;
+};
+
+/*
+    Fields decoded from the basic flash parameter table. Anything the table is too old to
+    have is left as 0
+*/
+struct sfdp_info {
+    uint32_t size; // bytes
+    enum sfdp_addr_mode addr_mode;
+    uint16_t page_size;
+    struct sfdp_erase_type erase[SFDP_NUM_ERASE_TYPES];
+    uint32_t chip_erase_typ_ms;
+    uint32_t chip_erase_max_ms;
+    uint8_t fast_read_114; // 1-1-4 fast read supported
+    uint8_t fast_read_114_opcode;
+    uint8_t fast_read_114_dummy_clocks; // wait states + mode clocks
+    uint8_t qer; // quad enable requirements (DWORD15), 0xFF if not in the table
+    uint8_t erase_suspend; // erase suspend/resume supported
+    uint8_t suspend_opcode;
+    uint8_t resume_opcode;
+    uint32_t suspend_latency_us; // max time from suspend to the chip being readable
+    uint32_t resume_interval_us; // min time from resume to the next suspend
+    uint8_t dwords; // length of the table
+};
+
+int sfdp_find_bfpt(const uint8_t *hdr, uint32_t len, uint32_t *offset, uint32_t *dwords);
+int sfdp_parse_bfpt(const uint8_t *bfpt, uint32_t dwords, struct sfdp_info *info);
@@ -0,0 +1,109 @@
+#include <stdint.h>
+#include <string.h>
+#include "pico/platform.h"
+#include "sha256.h"
+
+/*
+    Round constants. Not const so they're in SRAM, the compression loop reads one every round
+    and XIP misses are slow
+*/
+static uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/*
+    Process one 64 byte block. The message schedule is kept as a rolling 16 word window
+    rather than all 64 words, which keeps the stack small and more of it in registers
+*/
+static void __not_in_flash_func(sha256_block)(uint32_t *h, const uint8_t *p)
+{
+    uint32_t w[16];
+    for (int i = 0; i < 16; i++, p += 4) {
+        w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (int i = 0; i < 64; i++) {
+        if (i >= 16) {
+            uint32_t w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+            uint32_t s0 = ROR(w15, 7) ^ ROR(w15, 18) ^ (w15 >> 3);
+            uint32_t s1 = ROR(w2, 17) ^ ROR(w2, 19) ^ (w2 >> 10);
+            w[i & 15] += s0 + w[(i - 7) & 15] + s1;
+        }
+        uint32_t t1 = hh + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i & 15];
+        uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        hh = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+void sha256_init(struct sha256 *ctx)
+{
+    static const uint32_t h0[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(ctx->h, h0, sizeof(h0));
+    ctx->buf_len = 0;
+    ctx->len = 0;
+}
+
+void sha256_update(struct sha256 *ctx, const uint8_t *data, uint32_t len)
+{
+    ctx->len += len;
+    if (ctx->buf_len) {
+        uint32_t chunk = 64 - ctx->buf_len;
+        if (chunk > len) chunk = len;
+        memcpy(ctx->buf + ctx->buf_len, data, chunk);
+        ctx->buf_len += chunk;
+        data += chunk;
+        len -= chunk;
+        if (ctx->buf_len < 64) return;
+        sha256_block(ctx->h, ctx->buf);
+        ctx->buf_len = 0;
+    }
+
+    // whole blocks straight from data, no copy
+    for (; len >= 64; len -= 64, data += 64) sha256_block(ctx->h, data);
+
+    memcpy(ctx->buf, data, len);
+    ctx->buf_len = len;
+}
+
+void sha256_final(struct sha256 *ctx, uint8_t hash[SHA256_LEN])
+{
+    uint64_t bits = ctx->len * 8;
+
+    ctx->buf[ctx->buf_len++] = 0x80;
+    if (ctx->buf_len > 56) {
+        memset(ctx->buf + ctx->buf_len, 0, 64 - ctx->buf_len);
+        sha256_block(ctx->h, ctx->buf);
+        ctx->buf_len = 0;
+    }
+    memset(ctx->buf + ctx->buf_len, 0, 56 - ctx->buf_len);
+    for (int i = 0; i < 8; i++) ctx->buf[56 + i] = bits >> (56 - 8 * i);
+    sha256_block(ctx->h, ctx->buf);
+
+    for (int i = 0; i < 8; i++) {
+        hash[4 * i] = ctx->h[i] >> 24;
+        hash[4 * i + 1] = ctx->h[i] >> 16;
+        hash[4 * i + 2] = ctx->h[i] >> 8;
+        hash[4 * i + 3] = ctx->h[i];
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+
+#define SHA256_LEN 32
+
+/*
+    Streaming SHA-256. Feed data in with sha256_update() in as many pieces as needed
+*/
+struct sha256 {
+    uint32_t h[8];
+    uint8_t buf[64]; // partial block
+    uint32_t buf_len;
+    uint64_t len; // bytes so far
+};
+
+void sha256_init(struct sha256 *ctx);
+void sha256_update(struct sha256 *ctx, const uint8_t *data, uint32_t len);
+void sha256_final(struct sha256 *ctx, uint8_t hash[SHA256_LEN]);
@@ -1,6 +1,7 @@
 #pragma once
 
 #define CRC_TEST_NAME "CRC Test"
+#define SHA256_TEST_NAME "SHA-256"
 #define PROGRAM_TEST_NAME "Program Flash"
 #define ERASE_TEST_NAME "Erase Flash"
 #define FPGA_DONE_TEST_NAME "FPGA Done High"
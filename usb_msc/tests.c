@@ -2,6 +2,8 @@
 #include "stdint.h"
 #include "util.h"
 #include "crc32.h"
+#include "sha256.h"
+#include "pico/time.h"
 #include "config.h"
 #include "fpga_program.h"
 #include "flash_util.h"
@@ -56,6 +58,10 @@ int test_config(int iteration)
         .fpga_prog_speed = 7.77E6,
         .flash_prog_speed = 5.12E6,
         .prog_flash = false,
+        .delta_flash = CONF_DEFAULT_DELTA_FLASH,
+        .scratch_slots = CONF_DEFAULT_SCRATCH_SLOTS,
+        .verify = CONF_DEFAULT_VERIFY,
+        .autotune = CONF_DEFAULT_AUTOTUNE,
         .dirty = false
     };
     PRINT_TEST(!memcmp(&comp, &CONFIG, sizeof(comp)), MATCH_CONF_TEST_NAME, "");
@@ -109,4 +115,36 @@ int test_crc(int iteration)
     return 0;
 }
 
+/*
+    Known answer check, then time hashing 64kB to see what an upload costs
+*/
+int test_sha256(int iteration)
+{
+    static const uint8_t abc_sha[SHA256_LEN] = {
+        0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+        0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+    };
+    struct sha256 ctx;
+    uint8_t hash[SHA256_LEN];
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, (const uint8_t *)"abc", 3);
+    sha256_final(&ctx, hash);
+    if (memcmp(hash, abc_sha, SHA256_LEN)) {
+        PRINT_TEST(0, SHA256_TEST_NAME, "wrong hash for abc");
+        return 0;
+    }
+
+    xor_fill_buf(crc_buf, ARR_LEN(crc_buf), crc_seeds[0]);
+    uint32_t start_us = time_us_32();
+    sha256_init(&ctx);
+    for (int i = 0; i < 0x10000 / sizeof(crc_buf); i++) {
+        sha256_update(&ctx, (void *)crc_buf, sizeof(crc_buf));
+    }
+    sha256_final(&ctx, hash);
+    uint32_t us = time_us_32() - start_us;
+    PRINT_TEST(1, SHA256_TEST_NAME, "64kB in %luus, %lukB/s", us, us ? 64000000 / us : 0);
+    return 0;
+}
+
     #define PRINT_TEST(PASSED, NAME, FMT, ...) print_err_file(get_filesystem(), "TEST %.10s %4s: " FMT "\r\n", PASSED ? "PASS" : "FAIL", ##__VA_ARGS__)
\ No newline at end of file
@@ -4,6 +4,7 @@ int test_done_program(int iteration);
 int test_program_flash(int iteration);
 int test_config(int iteration);
 int test_crc(int iteration);
+int test_sha256(int iteration);
 int test_basic_flash(int iteration);
 
 #include "test_names.h"
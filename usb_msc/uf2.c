@@ -11,23 +11,34 @@ int is_uf2_block(struct UF2_Block *block)
     }
     return 0;
 }
+
+/*
+    Find the SHA-2 extension tag in block and copy it into sha
+
+    Tags follow the payload, each one 4 byte aligned, and a size of 0 ends the list.
+    Returns -1 if the block has no SHA-2 tag or the tags are malformed
+*/
 int uf2_get_sha(struct UF2_Block *block, struct extension_tag *sha)
 {
     // check that an extension is present
     if (!(block->flags & UF2_EXTENSION_TAGS_PRESENT_FLAG)) {
         return -1;
     }
+    if (block->payloadSize > sizeof(block->data)) return -1;
 
-    // navigate to the tag extension past the end of the data (4 byte aligned)
-    uint8_t *tag_loc = &block->data[block->payloadSize + (block->payloadSize & 0b11)];
-    struct extension_tag *tag_loc_typed = (struct extension_tag *)tag_loc;
-    while (tag_loc_typed->ext_type != UF2_EXTENSION_TAG_SHA_2) {
-        if (tag_loc_typed->ext_type == 0 && tag_loc_typed->total_size == 0) return -1; // it's over...
-        tag_loc = tag_loc + tag_loc_typed->total_size;
-        tag_loc_typed = (struct extension_tag *)tag_loc;
+    uint32_t loc = (block->payloadSize + 3) & ~3;
+    while (loc + 4 <= sizeof(block->data)) {
+        struct extension_tag *tag = (struct extension_tag *)&block->data[loc];
+        uint32_t type = tag->ext_type[0] | (tag->ext_type[1] << 8) | (tag->ext_type[2] << 16);
+        if (tag->total_size < 4) return -1; // it's over...
+        if (loc + tag->total_size > sizeof(block->data)) return -1;
+        if (type == UF2_EXTENSION_TAG_SHA_2) {
+            memcpy(sha, tag, tag->total_size);
+            return 0;
+        }
+        loc += (tag->total_size + 3) & ~3;
     }
-    memcpy(sha, tag_loc_typed, tag_loc_typed->total_size);
-    return 0;
+    return -1;
 }
 
 int uf2_is_last_block(struct UF2_Block *block)